@@ -7,9 +7,26 @@
 
 //#include "post_process.cpp"
 #include "post_process.hpp"
+#include "latency_controller.hpp"
+#include "peak_capacity.hpp"
+#include "pose_tracker.hpp"
+#include "pose_ring.hpp"
+#include "pose_export.hpp"
+#include "pose_archive.hpp"
+#include "pose_meta.hpp"
+#include "tensor_replay.hpp"
+#include "pose_index.hpp"
+#include "worker_supervisor.hpp"
+#include "task_scheduler.hpp"
+#include "thread_placement.hpp"
+#include "post_process_config.hpp"
 
 #include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+#include <gst/app/gstappsrc.h>
 #include <glib.h>
+#include <glib-unix.h>
+#include <signal.h>
 #include <stdio.h>
 
 #include "gstnvdsmeta.h"
@@ -21,6 +38,7 @@
 #include <queue>
 #include <cmath>
 #include <string>
+#include <map>
 
 #define EPS 1e-6
 
@@ -28,16 +46,28 @@
 
 /* The muxer output resolution must be set if the input streams will be of
  * different resolution. The muxer will scale all the input frames to this
- * resolution. */
+ * resolution. Default of --muxer-size. */
 #define MUXER_OUTPUT_WIDTH 1920
 #define MUXER_OUTPUT_HEIGHT 1080
 
+/* PTS step of the replayed frames, 30 fps */
+#define REPLAY_FRAME_DURATION (GST_SECOND / 30)
+
+/* Time allowed to find the resolution of an input file for --muxer-size native */
+#define DISCOVER_TIMEOUT (5 * GST_SECOND)
+
 /* Muxer batch formation timeout, for e.g. 40 millisec. Should ideally be set
  * based on the fastest source's framerate. */
 #define MUXER_BATCH_TIMEOUT_USEC 4000000
 
 #define OUTPUT_FILE "Pose_Estimation.mp4"
 
+/* gie-unique-id of nvinfer in deepstream_pose_estimation_config.txt */
+#define PGIE_UNIQUE_ID 1
+
+/* Shared-memory index of the supervisor when --shm-index is not set */
+#define DEFAULT_SHM_INDEX "pose-index"
+
 #define CAP_WIDTH 640
 #define CAP_HEIGHT 480
 
@@ -54,67 +84,698 @@ using Vec3D = std::vector<Vec2D<T>>;
 
 gint frame_number = 0;
 
-static Vec2D<int> topology{
-    {0, 1, 15, 13},
-    {2, 3, 13, 11},
-    {4, 5, 16, 14},
-    {6, 7, 14, 12},
-    {8, 9, 11, 12},
-    {10, 11, 5, 7},
-    {12, 13, 6, 8},
-    {14, 15, 7, 9},
-    {16, 17, 8, 10},
-    {18, 19, 1, 2},
-    {20, 21, 0, 1},
-    {22, 23, 0, 2},
-    {24, 25, 1, 3},
-    {26, 27, 2, 4},
-    {28, 29, 3, 5},
-    {30, 31, 4, 6},
-    {32, 33, 17, 0},
-    {34, 35, 17, 5},
-    {36, 37, 17, 6},
-    {38, 39, 17, 11},
-    {40, 41, 17, 12}};
-
-/*Method to parse information returned from the model*/
-std::tuple<Vec2D<int>, Vec3D<float>>
-parse_objects_from_tensor_meta(NvDsInferTensorMeta *tensor_meta)
-{
-  Vec1D<int> counts;
-  Vec3D<int> peaks;
-
-  float threshold = 0.1;
-  int window_size = 5;
-  int max_num_parts = 2;
-  int num_integral_samples = 7;
-  float link_threshold = 0.1;
-  int max_num_objects = 100;
-
-  void *cmap_data = tensor_meta->out_buf_ptrs_host[0];
-  NvDsInferDims &cmap_dims = tensor_meta->output_layers_info[0].inferDims;
-  void *paf_data = tensor_meta->out_buf_ptrs_host[1];
-  NvDsInferDims &paf_dims = tensor_meta->output_layers_info[1].inferDims;
-
-  /* Finding peaks within a given window */
-  find_peaks(counts, peaks, cmap_data, cmap_dims, threshold, window_size, max_num_parts);
-  /* Non-Maximum Suppression */
-  Vec3D<float> refined_peaks = refine_peaks(counts, peaks, cmap_data, cmap_dims, window_size);
-  /* Create a Bipartite graph to assign detected body-parts to a unique person in the frame */
-  Vec3D<float> score_graph = paf_score_graph(paf_data, paf_dims, topology, counts, refined_peaks, num_integral_samples);
-  /* Assign weights to all edges in the bipartite graph generated */
-  Vec3D<int> connections = assignment(score_graph, topology, counts, link_threshold, max_num_parts);
-  /* Connecting all the Body Parts and Forming a Human Skeleton */
-  Vec2D<int> objects = connect_parts(connections, topology, counts, max_num_objects);
-  return {objects, refined_peaks};
-}
-
-/* MetaData to handle drawing onto the on-screen-display */
+/* Command line options */
+static gdouble latency_budget_ms = 0.0;
+static gint stats_interval = 0;
+static gint live_queue_size = 2;
+static gint roi_full_scan_interval = 0;
+static gint roi_margin = 4;
+static gboolean use_tracker = FALSE;
+static gint infer_interval = 0;
+static gboolean coarse_to_fine = FALSE;
+static gboolean warm_start = FALSE;
+static gboolean quadratic_refine = FALSE;
+static gchar *output_mode_option = NULL;
+static gint max_parts_limit = 32;
+static gchar *int8_scale_option = NULL;
+static gdouble int8_scales[2] = {DEFAULT_INT8_SCALE, DEFAULT_INT8_SCALE};
+static gchar *tensor_layout_name = NULL;
+static TensorLayout tensor_layout = TENSOR_LAYOUT_CHW;
+static gchar *shm_ring_name = NULL;
+static gint shm_ring_slots = POSE_RING_DEFAULT_SLOTS;
+static gchar *export_json_path = NULL;
+static gchar *archive_path = NULL;
+static gchar *nvtracker_lib = NULL;
+static gint render_interval = 0;
+static gboolean no_display = FALSE;
+static gchar *muxer_size_name = NULL;
+static gchar *replay_spec = NULL;
+static gint replay_num_frames = 1000;
+static gint replay_streams = 1;
+static gchar *record_tensors_path = NULL;
+static gchar **input_paths = NULL;
+static gint num_workers = 0;
+static gint worker_index = -1;
+static gchar *shm_index_name = NULL;
+static gint post_process_threads = 0;
+static gchar *probe_cpus = NULL;
+static gchar *probe_sched = NULL;
+static gchar *post_process_cpus = NULL;
+static gchar *post_process_sched = NULL;
+static gchar *config_path = NULL;
+static gchar **exclusion_mask_specs = NULL;
+static gboolean perf_counters = FALSE;
+
+/* Resolution of the batched frames, nvinfer and the OSD work on this surface */
+static gint muxer_width = MUXER_OUTPUT_WIDTH;
+static gint muxer_height = MUXER_OUTPUT_HEIGHT;
+
+static GOptionEntry option_entries[] = {
+    {"latency-budget-ms", 'b', 0, G_OPTION_ARG_DOUBLE, &latency_budget_ms,
+     "Per-stream post-processing budget in ms, degrade precision when missed (0 = off)", "MS"},
+    {"stats-interval", 's', 0, G_OPTION_ARG_INT, &stats_interval,
+     "Print per-stream statistics every N seconds (0 = off)", "N"},
+    {"live-queue-size", 'q', 0, G_OPTION_ARG_INT, &live_queue_size,
+     "Depth of the leaky queues between stages for live sources (0 = no queues)", "N"},
+    {"roi-full-scan-interval", 'r', 0, G_OPTION_ARG_INT, &roi_full_scan_interval,
+     "Search peaks only around the previous poses, scanning the full heatmap every N frames (0 = always full)", "N"},
+    {"roi-margin", 0, 0, G_OPTION_ARG_INT, &roi_margin,
+     "Dilation of the previous poses and width of the entry band, in heatmap pixels", "PX"},
+    {"tracker", 't', 0, G_OPTION_ARG_NONE, &use_tracker,
+     "Track the skeletons and propagate them on frames skipped by nvinfer", NULL},
+    {"infer-interval", 'i', 0, G_OPTION_ARG_INT, &infer_interval,
+     "Number of frames nvinfer skips between inferences, implies --tracker (default 0)", "N"},
+    {"coarse-to-fine", 'c', 0, G_OPTION_ARG_NONE, &coarse_to_fine,
+     "Max-pool the heatmaps to a coarse grid and search peaks only in cells above the threshold", NULL},
+    {"quadratic-refine", 0, 0, G_OPTION_ARG_NONE, &quadratic_refine,
+     "Refine the peaks with a quadratic fit to their 3x3 neighbourhood instead of the window centroid", NULL},
+    {"output-mode", 0, 0, G_OPTION_ARG_STRING, &output_mode_option,
+     "Stop the post-processing at skeletons (default), keypoints, count or presence", "MODE"},
+    {"max-parts-limit", 0, 0, G_OPTION_ARG_INT, &max_parts_limit,
+     "Most candidates per body part a busy stream grows to, from max_num_parts (default 32, 0 = fixed)", "N"},
+    {"warm-start-assignment", 0, 0, G_OPTION_ARG_NONE, &warm_start,
+     "Seed the limb assignment of each stream with the solution of its previous frame, "
+     "in frames with 12 or more candidates per body part", NULL},
+    {"int8-scale", 0, 0, G_OPTION_ARG_STRING, &int8_scale_option,
+     "Dequantization scales of the INT8 cmap and PAF layers, one value for both (default 1/127)", "CMAP[,PAF]"},
+    {"tensor-layout", 0, 0, G_OPTION_ARG_STRING, &tensor_layout_name,
+     "Memory layout of the output layers, chw or hwc (default chw)", "LAYOUT"},
+    {"shm-ring", 0, 0, G_OPTION_ARG_STRING, &shm_ring_name,
+     "Publish the skeletons of each frame in the POSIX shared-memory ring NAME", "NAME"},
+    {"shm-slots", 0, 0, G_OPTION_ARG_INT, &shm_ring_slots,
+     "Number of records of the shared-memory ring (default 256)", "N"},
+    {"export-json", 'j', 0, G_OPTION_ARG_FILENAME, &export_json_path,
+     "Write the skeletons of each frame as JSON Lines to PATH, - for the standard output and the messages to the standard error", "PATH"},
+    {"archive", 'a', 0, G_OPTION_ARG_FILENAME, &archive_path,
+     "Append the skeletons to the indexed pose archive PATH instead of encoding the annotated video", "PATH"},
+    {"nvtracker", 0, 0, G_OPTION_ARG_FILENAME, &nvtracker_lib,
+     "Track the person objects with nvtracker and the low-level tracker library LIB", "LIB"},
+    {"render-interval", 0, 0, G_OPTION_ARG_INT, &render_interval,
+     "Number of frames of each stream left undrawn between drawn frames (default 0)", "N"},
+    {"no-display", 0, 0, G_OPTION_ARG_NONE, &no_display,
+     "Do not open a display window", NULL},
+    {"muxer-size", 0, 0, G_OPTION_ARG_STRING, &muxer_size_name,
+     "Resolution of the batched frames, WIDTHxHEIGHT or native for the input resolution (default 1920x1080)", "SIZE"},
+    {"replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_spec,
+     "Run the probes on replayed tensors instead of nvinfer, a recording or synthetic[:PEOPLE]", "SOURCE"},
+    {"replay-frames", 0, 0, G_OPTION_ARG_INT, &replay_num_frames,
+     "Number of frames to replay (default 1000)", "N"},
+    {"replay-streams", 0, 0, G_OPTION_ARG_INT, &replay_streams,
+     "Spread the replayed frames over N source ids (default 1)", "N"},
+    {"record-tensors", 0, 0, G_OPTION_ARG_FILENAME, &record_tensors_path,
+     "Append the output layers of nvinfer to PATH for --replay", "PATH"},
+    {"input", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &input_paths,
+     "Input file or camera device, repeat for several sources", "INPUT"},
+    {"workers", 'w', 0, G_OPTION_ARG_INT, &num_workers,
+     "Split the inputs over N worker processes and restart the ones that crash (0 = single process)", "N"},
+    {"shm-index", 0, 0, G_OPTION_ARG_STRING, &shm_index_name,
+     "Publish the latest skeletons of every source in the POSIX shared-memory index NAME", "NAME"},
+    {"post-process-threads", 0, 0, G_OPTION_ARG_INT, &post_process_threads,
+     "Split the post-processing of each batch into tasks over N threads (0 = in the probe thread)", "N"},
+    {"probe-cpus", 0, 0, G_OPTION_ARG_STRING, &probe_cpus,
+     "Run the streaming thread of the post-processing probe on CPUS, such as 2,3 or 4-7", "CPUS"},
+    {"probe-sched", 0, 0, G_OPTION_ARG_STRING, &probe_sched,
+     "Scheduling policy of the probe thread, other, batch, idle, fifo or rr, with an optional priority", "POLICY[:PRIO]"},
+    {"post-process-cpus", 0, 0, G_OPTION_ARG_STRING, &post_process_cpus,
+     "Pin the --post-process-threads threads one per CPU of CPUS", "CPUS"},
+    {"post-process-sched", 0, 0, G_OPTION_ARG_STRING, &post_process_sched,
+     "Scheduling policy of the --post-process-threads threads, as --probe-sched", "POLICY[:PRIO]"},
+    {"config", 0, 0, G_OPTION_ARG_FILENAME, &config_path,
+     "Read the post-processing parameters and topology from the JSON file PATH, reloaded when it changes", "PATH"},
+    {"exclusion-mask", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &exclusion_mask_specs,
+     "Never search peaks in the black pixels of the PGM image PATH, in heatmap coordinates, on source SOURCE. "
+     "Repeat it for several sources", "SOURCE:PATH"},
+    {"perf-counters", 0, 0, G_OPTION_ARG_NONE, &perf_counters,
+     "Count the cycles, instructions, cache misses and branch misses of each post-processing stage, "
+     "printed per stream with the statistics", NULL},
+    {"worker-index", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &worker_index,
+     "Index of the worker, set by the supervisor", "K"},
+    {NULL}};
+
+/* Default post-processing parameters */
+static const PostProcessParams default_params = {
+    0.1f,  /* threshold */
+    5,     /* window_size */
+    2,     /* max_num_parts */
+    7,     /* num_integral_samples */
+    0.1f,  /* link_threshold */
+    100,   /* max_num_objects */
+    false, /* greedy_assignment */
+    false, /* coarse_to_fine */
+    REFINE_CENTROID, /* refine_mode */
+    OUTPUT_SKELETONS, /* output_mode */
+};
+
+/* 'default_params' with the --output-mode of all streams, the configuration starts from them */
+static PostProcessParams base_params = default_params;
+
+/* Per-stream state, keyed by the source id of the frame meta */
+struct StreamContext
+{
+  LatencyController controller;
+  /* Candidates per body part, adapted to the scene */
+  PeakCapacity capacity;
+  guint64 num_frames;
+  gint64 total_us;
+  gint64 max_us;
+
+  /* Incremental peak search */
+  SearchRegion region;
+  gboolean has_region;
+  gint frames_since_full_scan;
+  guint64 num_full_scans;
+  guint64 num_roi_scans;
+
+  /* Skeleton tracking across frames */
+  PoseTracker tracker;
+  guint64 num_predicted_frames;
+  /* Output mode and count of the last inferred frame, repeated on the skipped frames of the modes without skeletons */
+  OutputMode last_mode;
+  int last_count;
+
+  /* Previous limb assignment, with --warm-start-assignment */
+  AssignmentState assignment_state;
+
+  /* Pixels excluded from the peak search, NULL for none */
+  const ExclusionMask *exclusion_mask;
+
+  /* Hardware events of each stage over 'num_frames', with --perf-counters */
+  PerfStageCounts counters;
+};
+
+static std::map<guint, StreamContext> stream_contexts;
+static GMutex stream_lock;
+
+/* Shared-memory output of the skeletons, NULL when --shm-ring is not set */
+static PoseRing *pose_ring = NULL;
+
+/* JSON Lines output of the skeletons, NULL when --export-json is not set */
+static PoseExporter *pose_exporter = NULL;
+
+/* Pose archive, NULL when --archive is not set */
+static PoseArchiveWriter *pose_archive = NULL;
+
+/* Latest skeletons of each source, NULL without --shm-index or --workers */
+static PoseIndex *pose_index = NULL;
+
+/* Global id of the first source of this process, the source ids of the
+   frame meta are offset by it in the published results */
+static guint first_source_id = 0;
+
+/* Set when the pipeline stopped on an error instead of the end of stream */
+static gboolean pipeline_failed = FALSE;
+
+/* Output layers recorded for --replay, NULL when --record-tensors is not set */
+static TensorRecorder *tensor_recorder = NULL;
+
+/* State of --replay */
+struct ReplayState
+{
+  Vec1D<ReplayFrame> frames;
+  guint64 num_pushed;
+  guint64 num_done;
+  gint64 start_us;
+  gint64 end_us;
+  gint64 total_latency_us;
+  gint64 max_latency_us;
+};
+
+static ReplayState replay;
+
+/* FALSE when neither a display nor a file sink is attached, nothing is drawn then */
+static gboolean render_enabled = TRUE;
+
+/* Whether the skeletons and the frame number are drawn on this frame */
+static inline gboolean
+should_render(NvDsFrameMeta *frame_meta)
+{
+  return render_enabled && frame_meta->frame_num % (render_interval + 1) == 0;
+}
+
+/* Leaky queues inserted at stage boundaries and the number of frames each dropped */
+#define MAX_LEAKY_QUEUES 16
+
+struct LeakyQueueStats
+{
+  const gchar *stage;
+  volatile gint dropped;
+};
+
+static LeakyQueueStats leaky_queue_stats[MAX_LEAKY_QUEUES];
+static gint num_leaky_queues = 0;
+
+static Vec2D<int> topology = default_topology();
+
+/* Exclusion masks of --exclusion-mask, keyed by global source id. Read only once the pipeline runs. */
+static std::map<guint, ExclusionMask> exclusion_masks;
+
+/* Parameters of --config, replaced with 'topology' under 'stream_lock' when the file changes */
+static PostProcessConfig post_process_config;
+static ConfigWatcher *config_watcher = NULL;
+
+/* Post-processing of the inferred frames of the current batch, recycled from batch to batch */
+static PoseBatch pose_batch;
+
+/* Metadata of each frame of 'pose_batch' */
+struct BatchEntry
+{
+  NvDsFrameMeta *frame_meta;
+  NvDsInferTensorMeta *tensor_meta;
+};
+
+static Vec1D<BatchEntry> batch_entries;
+
+/* Parameters of the stream before the latency controller degrades them */
+static PostProcessParams
+stream_base_params(guint source_id)
+{
+  /* The configuration names the streams by their global source id */
+  PostProcessParams params = post_process_config.streamParams(first_source_id + source_id);
+  params.coarse_to_fine = params.coarse_to_fine || coarse_to_fine;
+  if (quadratic_refine)
+    params.refine_mode = REFINE_QUADRATIC;
+  return params;
+}
+
+/* Reads the CMAP[,PAF] scales of --int8-scale, a single value applies to both layers */
+static gboolean
+parse_int8_scales(const gchar *option)
+{
+  gchar **values = g_strsplit(option, ",", -1);
+  guint count = g_strv_length(values);
+  gboolean valid = count >= 1 && count <= 2;
+
+  for (guint i = 0; valid && i < count; i++)
+  {
+    gchar *end;
+    gdouble scale = g_ascii_strtod(values[i], &end);
+
+    valid = end != values[i] && *end == '\0' && scale > 0.0 && scale < G_MAXFLOAT;
+    int8_scales[i] = scale;
+  }
+  g_strfreev(values);
+  if (!valid)
+  {
+    g_printerr("Invalid INT8 scale %s, expected CMAP[,PAF] with positive values\n", option);
+    return FALSE;
+  }
+  if (count == 1)
+    int8_scales[1] = int8_scales[0];
+  return TRUE;
+}
+
+/* Reads the SOURCE:PATH masks of --exclusion-mask */
+static gboolean
+load_exclusion_masks(void)
+{
+  for (gchar **spec = exclusion_mask_specs; spec != NULL && *spec != NULL; spec++)
+  {
+    gchar *end;
+    guint64 source_id = g_ascii_strtoull(*spec, &end, 10);
+
+    if (end == *spec || *end != ':' || end[1] == '\0' || source_id > G_MAXUINT)
+    {
+      g_printerr("Invalid exclusion mask %s, expected SOURCE:PATH\n", *spec);
+      return FALSE;
+    }
+
+    ExclusionMask &mask = exclusion_masks[(guint)source_id];
+    if (!exclusion_mask_load(&mask, end + 1))
+      return FALSE;
+    g_print("source %u: %dx%d exclusion mask, %d of %d tiles skipped\n", (guint)source_id, mask.width,
+            mask.height, mask.numExcludedTiles(), mask.tiles_w * mask.tiles_h);
+  }
+  return TRUE;
+}
+
+/* Sets the parameters the latency controller of the stream starts from */
+static void
+update_base_params(StreamContext &ctx, guint source_id)
+{
+  PostProcessParams params = stream_base_params(source_id);
+  params.max_num_parts = ctx.capacity.get();
+  ctx.controller.setBaseParams(params);
+}
+
+/* Returns the state of the stream, creating it on the first frame.
+   Must be called with 'stream_lock' held. */
+static StreamContext &
+get_stream_context(guint source_id)
+{
+  auto it = stream_contexts.find(source_id);
+  if (it == stream_contexts.end())
+  {
+    StreamContext &ctx = stream_contexts[source_id];
+    ctx.num_frames = 0;
+    ctx.total_us = 0;
+    ctx.max_us = 0;
+    ctx.has_region = FALSE;
+    ctx.frames_since_full_scan = 0;
+    ctx.num_full_scans = 0;
+    ctx.num_roi_scans = 0;
+    ctx.num_predicted_frames = 0;
+    ctx.last_mode = stream_base_params(source_id).output_mode;
+    ctx.last_count = 0;
+    ctx.counters = PerfStageCounts();
+    auto mask = exclusion_masks.find(first_source_id + source_id);
+    ctx.exclusion_mask = mask != exclusion_masks.end() ? &mask->second : NULL;
+    ctx.capacity.reset(stream_base_params(source_id).max_num_parts, max_parts_limit);
+    update_base_params(ctx, source_id);
+    ctx.controller.setBudget((gint64)(latency_budget_ms * 1000));
+    return ctx;
+  }
+  return it->second;
+}
+
+/* Adds a frame to 'pose_batch' with the parameters chosen by the latency controller of its stream */
+static void
+add_frame_tensor(NvDsInferTensorMeta *tensor_meta, NvDsFrameMeta *frame_meta)
+{
+  const SearchRegion *region = NULL;
+  StreamContext &ctx = get_stream_context(frame_meta->source_id);
+
+  /* The search region follows the skeletons, the other modes scan the whole map */
+  if (roi_full_scan_interval > 0 && ctx.has_region && ctx.frames_since_full_scan < roi_full_scan_interval &&
+      ctx.controller.params().output_mode == OUTPUT_SKELETONS)
+    region = &ctx.region;
+
+  if (tensor_recorder)
+  {
+    tensor_record_frame(tensor_recorder, tensor_meta, frame_meta->source_id, frame_meta->frame_num,
+                        frame_meta->source_frame_width, frame_meta->source_frame_height);
+  }
+
+  /* The layers are read in the data type of the engine, FP32, FP16 or INT8 */
+  TensorView cmap = make_tensor_view(tensor_meta, 0, int8_scales[0], tensor_layout);
+  if (ctx.exclusion_mask && !ctx.exclusion_mask->fits(cmap.width, cmap.height))
+  {
+    g_printerr("stream %u: the exclusion mask is %dx%d but the heatmaps are %dx%d, ignoring it\n",
+               first_source_id + frame_meta->source_id, ctx.exclusion_mask->width, ctx.exclusion_mask->height,
+               cmap.width, cmap.height);
+    ctx.exclusion_mask = NULL;
+  }
+  pose_batch.add(cmap, make_tensor_view(tensor_meta, 1, int8_scales[1], tensor_layout),
+                 ctx.controller.params(), region, warm_start ? &ctx.assignment_state : NULL,
+                 ctx.exclusion_mask);
+  batch_entries.push_back({frame_meta, tensor_meta});
+}
+
+/* Updates the state of the stream with the post-processed frame */
+static void
+finish_frame_tensor(PoseBatchFrame &frame, NvDsInferTensorMeta *tensor_meta, NvDsFrameMeta *frame_meta)
+{
+  StreamContext &ctx = get_stream_context(frame_meta->source_id);
+  PoseResult &result = frame.result;
+
+  if (frame.full_scan)
+  {
+    ctx.frames_since_full_scan = 0;
+    ctx.num_full_scans++;
+  }
+  else
+  {
+    ctx.frames_since_full_scan++;
+    ctx.num_roi_scans++;
+  }
+  if (roi_full_scan_interval > 0 && result.mode == OUTPUT_SKELETONS)
+  {
+    build_search_region(ctx.region, result.objects, result.peaks,
+                        tensor_meta->output_layers_info[0].inferDims, roi_margin);
+    ctx.has_region = TRUE;
+  }
+  if (use_tracker && result.mode == OUTPUT_SKELETONS)
+  {
+    ctx.tracker.update(result.objects, result.peaks, frame_meta->frame_num, result.ids);
+  }
+  ctx.last_mode = result.mode;
+  ctx.last_count = result.count;
+
+  /* A frame whose candidates the latency controller cut down says nothing about the scene,
+     and the presence mode counts no peaks */
+  if (frame.supported && frame.params.output_mode != OUTPUT_PRESENCE &&
+      frame.params.max_num_parts == ctx.capacity.get() && ctx.capacity.update(frame.counts))
+    update_base_params(ctx, frame_meta->source_id);
+
+  gint64 elapsed = frame.timings.total();
+  perf_stage_counts_add(&ctx.counters, &frame.counters);
+  ctx.num_frames++;
+  ctx.total_us += elapsed;
+  if (elapsed > ctx.max_us)
+    ctx.max_us = elapsed;
+
+  int prev_level = ctx.controller.getLevel();
+  if (ctx.controller.update(elapsed))
+  {
+    g_print("stream %u: post-processing %.2f ms (budget %.2f ms), level %d -> %d\n",
+            first_source_id + frame_meta->source_id, ctx.controller.averageUs() / 1000.0,
+            ctx.controller.getBudget() / 1000.0, prev_level, ctx.controller.getLevel());
+  }
+}
+
+/* Copies the skeletons of a frame into a shared-memory record */
+static void
+fill_pose_record(PoseRecord *record, PoseResult &result, NvDsFrameMeta *frame_meta, guint stream_id)
+{
+  guint num_persons = MIN(result.objects.size(), (gsize)POSE_RING_MAX_PERSONS);
+
+  record->stream_id = stream_id;
+  record->flags = result.predicted ? POSE_RECORD_PREDICTED : 0;
+  if (result.objects.size() > num_persons)
+    record->flags |= POSE_RECORD_TRUNCATED;
+  if (result.mode != OUTPUT_SKELETONS)
+    record->flags |= POSE_RECORD_NO_SKELETONS;
+  record->frame_num = frame_meta->frame_num;
+  record->pts = frame_meta->buf_pts;
+  record->width = frame_meta->source_frame_width;
+  record->height = frame_meta->source_frame_height;
+  record->num_persons = num_persons;
+  record->num_people = result.count;
+
+  for (guint n = 0; n < num_persons; n++)
+  {
+    Vec1D<int> &object = result.objects[n];
+    PosePerson &person = record->persons[n];
+    person.track_id = n < result.ids.size() ? result.ids[n] : 0;
+    for (int c = 0; c < POSE_RING_NUM_KEYPOINTS; c++)
+    {
+      PoseKeypoint &kp = person.keypoints[c];
+      int k = c < (int)object.size() ? object[c] : -1;
+      if (k < 0)
+      {
+        kp.x = kp.y = -1.0f;
+        kp.score = 0.0f;
+        continue;
+      }
+      kp.x = result.peaks[c][k][1];
+      kp.y = result.peaks[c][k][0];
+      kp.score = result.scores.empty() ? 0.0f : result.scores[c][k];
+    }
+  }
+
+  record->timestamp_us = g_get_real_time();
+}
+
+/* Attaches the skeletons of a frame as object meta and hands them to the JSON export,
+   the archive and the shared-memory ring and index */
+static void
+publish_pose_result(PoseResult &result, NvDsFrameMeta *frame_meta)
+{
+  guint stream_id = first_source_id + frame_meta->source_id;
+
+  attach_pose_meta(frame_meta, result, PGIE_UNIQUE_ID, muxer_width, muxer_height);
+
+  if (pose_exporter)
+  {
+    pose_export_push(pose_exporter, stream_id, frame_meta->frame_num, frame_meta->buf_pts,
+                     frame_meta->source_frame_width, frame_meta->source_frame_height, result);
+  }
+
+  if (pose_archive)
+  {
+    pose_archive->add(stream_id, frame_meta->frame_num, frame_meta->buf_pts, frame_meta->source_frame_width,
+                      frame_meta->source_frame_height, result);
+  }
+
+  if (pose_ring)
+  {
+    fill_pose_record(pose_ring_begin_write(pose_ring), result, frame_meta, stream_id);
+    pose_ring_end_write(pose_ring);
+  }
+
+  PoseRecord *record = pose_index ? pose_index_begin_write(pose_index, stream_id) : NULL;
+  if (record)
+  {
+    fill_pose_record(record, result, frame_meta, stream_id);
+    pose_index_end_write(pose_index, stream_id);
+  }
+}
+
+/* Propagates the tracked skeletons of the stream to a frame nvinfer skipped */
+static PoseResult
+predict_frame(StreamContext &ctx, NvDsFrameMeta *frame_meta)
+{
+  PoseResult result;
+
+  ctx.tracker.predict(frame_meta->frame_num, result.objects, result.peaks, result.ids);
+  result.predicted = true;
+  result.mode = OUTPUT_SKELETONS;
+  result.count = result.objects.size();
+  ctx.num_predicted_frames++;
+  return result;
+}
+
+/* Repeats the mode and count of the last inferred frame of a stream without skeletons to a frame nvinfer skipped */
+static PoseResult
+repeat_frame(StreamContext &ctx)
+{
+  PoseResult result;
+
+  result.predicted = true;
+  result.mode = ctx.last_mode;
+  result.count = ctx.last_count;
+  ctx.num_predicted_frames++;
+  return result;
+}
+
+/* Threads of the post-processing tasks, NULL with --post-process-threads 0 */
+static TaskScheduler *post_process_scheduler = NULL;
+
+/* --probe-* and --post-process-* placements. The probe thread places itself on its first buffer. */
+static ThreadPlacement probe_placement;
+static ThreadPlacement post_process_placement;
+static volatile gint probe_thread_placed = 0;
+
+static void
+place_post_process_thread(int worker, gpointer data)
+{
+  gchar *name = g_strdup_printf("post-process thread %d", worker);
+  thread_placement_apply(&post_process_placement, name, worker);
+  g_free(name);
+}
+
+/* Reloads --config. The probe holds 'stream_lock' for a whole batch, so the
+   new values apply from the next batch on and never within one. */
+static void
+on_config_changed(const gchar *path, gpointer data)
+{
+  PostProcessConfig config;
+
+  if (!post_process_config_load(&config, path, base_params, default_topology()))
+  {
+    g_printerr("Keeping the previous post-processing configuration\n");
+    return;
+  }
+
+  g_mutex_lock(&stream_lock);
+  gboolean topology_changed = config.topology != topology;
+  post_process_config = config;
+  topology = config.topology;
+  for (auto &entry : stream_contexts)
+  {
+    StreamContext &ctx = entry.second;
+    ctx.capacity.reset(stream_base_params(entry.first).max_num_parts, max_parts_limit);
+    update_base_params(ctx, entry.first);
+    /* The previous matching belongs to other limbs */
+    if (topology_changed)
+      ctx.assignment_state = AssignmentState();
+  }
+  g_mutex_unlock(&stream_lock);
+  g_print("Reloaded the post-processing configuration %s\n", path);
+}
+
+/* Prints the per-stream statistics */
+static gboolean
+print_stream_stats(gpointer data)
+{
+  g_mutex_lock(&stream_lock);
+  for (auto &entry : stream_contexts)
+  {
+    StreamContext &ctx = entry.second;
+    g_print("stream %u: frames %" G_GUINT64_FORMAT ", post-processing avg %.2f ms max %.2f ms, "
+            "level %d (degraded %" G_GUINT64_FORMAT ", recovered %" G_GUINT64_FORMAT "), "
+            "peak search full %" G_GUINT64_FORMAT " roi %" G_GUINT64_FORMAT ", "
+            "tracks %d, predicted frames %" G_GUINT64_FORMAT "\n",
+            first_source_id + entry.first, ctx.num_frames,
+            ctx.num_frames ? ctx.total_us / 1000.0 / ctx.num_frames : 0.0, ctx.max_us / 1000.0,
+            ctx.controller.getLevel(), ctx.controller.num_degrades, ctx.controller.num_recovers,
+            ctx.num_full_scans, ctx.num_roi_scans,
+            ctx.tracker.numTracks(), ctx.num_predicted_frames);
+    g_print("stream %u: %d candidates per part (limit %d), saturated frames %" G_GUINT64_FORMAT
+            ", grown %" G_GUINT64_FORMAT ", shrunk %" G_GUINT64_FORMAT "\n",
+            first_source_id + entry.first, ctx.capacity.get(), ctx.capacity.getLimit(),
+            ctx.capacity.num_saturated, ctx.capacity.num_grows, ctx.capacity.num_shrinks);
+    if (perf_counters)
+    {
+      gchar *prefix = g_strdup_printf("stream %u: ", first_source_id + entry.first);
+      perf_stage_counts_print(prefix, &ctx.counters, ctx.num_frames);
+      g_free(prefix);
+    }
+    if (warm_start)
+      g_print("stream %u: warm-started assignment, %.2f augmenting paths per row\n", first_source_id + entry.first,
+              ctx.assignment_state.num_rows
+                  ? (double)ctx.assignment_state.num_augmentations / ctx.assignment_state.num_rows
+                  : 0.0);
+  }
+  g_mutex_unlock(&stream_lock);
+
+  for (gint i = 0; i < num_leaky_queues; i++)
+  {
+    g_print("queue %s: dropped %d frames\n", leaky_queue_stats[i].stage,
+            g_atomic_int_get(&leaky_queue_stats[i].dropped));
+  }
+
+  if (post_process_scheduler)
+  {
+    std::vector<TaskThreadStats> thread_stats;
+    post_process_scheduler->getStats(thread_stats);
+    for (size_t t = 0; t < thread_stats.size(); t++)
+    {
+      TaskThreadStats &stats = thread_stats[t];
+      if (t + 1 < thread_stats.size())
+        g_print("post-process thread %zu: ", t);
+      else
+        g_print("post-process callers: ");
+      g_print("tasks %" G_GUINT64_FORMAT ", steals %" G_GUINT64_FORMAT ", idle %.1f ms\n",
+              stats.num_tasks, stats.num_steals, stats.idle_us / 1000.0);
+    }
+  }
+
+  if (pose_exporter)
+  {
+    g_print("json export: written %d frames (%" G_GUINT64_FORMAT " bytes), queued %d, dropped %d\n",
+            g_atomic_int_get(&pose_exporter->num_written),
+            __atomic_load_n(&pose_exporter->num_bytes, __ATOMIC_RELAXED),
+            g_atomic_int_get(&pose_exporter->num_queued), g_atomic_int_get(&pose_exporter->num_dropped));
+  }
+
+  if (pose_archive)
+  {
+    g_print("pose archive: %" G_GUINT64_FORMAT " chunks (%" G_GUINT64_FORMAT " bytes), queued %d, dropped %d\n",
+            __atomic_load_n(&pose_archive->num_chunks, __ATOMIC_RELAXED),
+            __atomic_load_n(&pose_archive->num_bytes, __ATOMIC_RELAXED),
+            g_atomic_int_get(&pose_archive->num_queued), g_atomic_int_get(&pose_archive->num_dropped));
+  }
+
+  if (tensor_recorder)
+  {
+    g_print("tensor recording: written %d frames (%" G_GUINT64_FORMAT " bytes), queued %d, dropped %d\n",
+            g_atomic_int_get(&tensor_recorder->num_written),
+            __atomic_load_n(&tensor_recorder->num_bytes, __ATOMIC_RELAXED),
+            g_atomic_int_get(&tensor_recorder->num_queued), g_atomic_int_get(&tensor_recorder->num_dropped));
+  }
+  return TRUE;
+}
+
+/* MetaData to handle drawing onto the on-screen-display, 'frame_width' and
+   'frame_height' are the dimensions of the surface the OSD draws on */
 static void
 create_display_meta(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, NvDsFrameMeta *frame_meta, int frame_width, int frame_height)
 {
   int K = topology.size();
   int count = objects.size();
+  /* Sizes were chosen for 1080p, keep their proportion on smaller surfaces */
+  int radius = MAX(2, 8 * frame_height / MUXER_OUTPUT_HEIGHT);
+  int line_width = MAX(1, 3 * frame_height / MUXER_OUTPUT_HEIGHT);
   NvDsBatchMeta *bmeta = frame_meta->base_meta.batch_meta;
   NvDsDisplayMeta *dmeta = nvds_acquire_display_meta_from_pool(bmeta);
   nvds_add_display_meta_to_frame(frame_meta, dmeta);
@@ -128,8 +789,8 @@ create_display_meta(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, NvDsFra
       if (k >= 0)
       {
         auto &peak = normalized_peaks[j][k];
-        int x = peak[1] * MUXER_OUTPUT_WIDTH;
-        int y = peak[0] * MUXER_OUTPUT_HEIGHT;
+        int x = peak[1] * frame_width;
+        int y = peak[0] * frame_height;
         if (dmeta->num_circles == MAX_ELEMENTS_IN_DISPLAY_META)
         {
           dmeta = nvds_acquire_display_meta_from_pool(bmeta);
@@ -138,7 +799,7 @@ create_display_meta(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, NvDsFra
         NvOSD_CircleParams &cparams = dmeta->circle_params[dmeta->num_circles];
         cparams.xc = x;
         cparams.yc = y;
-        cparams.radius = 8;
+        cparams.radius = radius;
         cparams.circle_color = NvOSD_ColorParams{244, 67, 54, 1};
         cparams.has_bg_color = 1;
         cparams.bg_color = NvOSD_ColorParams{0, 255, 0, 1};
@@ -154,10 +815,10 @@ create_display_meta(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, NvDsFra
       {
         auto &peak0 = normalized_peaks[c_a][object[c_a]];
         auto &peak1 = normalized_peaks[c_b][object[c_b]];
-        int x0 = peak0[1] * MUXER_OUTPUT_WIDTH;
-        int y0 = peak0[0] * MUXER_OUTPUT_HEIGHT;
-        int x1 = peak1[1] * MUXER_OUTPUT_WIDTH;
-        int y1 = peak1[0] * MUXER_OUTPUT_HEIGHT;
+        int x0 = peak0[1] * frame_width;
+        int y0 = peak0[0] * frame_height;
+        int x1 = peak1[1] * frame_width;
+        int y1 = peak1[0] * frame_height;
         if (dmeta->num_lines == MAX_ELEMENTS_IN_DISPLAY_META)
         {
           dmeta = nvds_acquire_display_meta_from_pool(bmeta);
@@ -168,7 +829,7 @@ create_display_meta(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, NvDsFra
         lparams.x2 = x1;
         lparams.y1 = y0;
         lparams.y2 = y1;
-        lparams.line_width = 3;
+        lparams.line_width = line_width;
         lparams.line_color = NvOSD_ColorParams{0, 255, 0, 1};
         dmeta->num_lines++;
       }
@@ -189,6 +850,13 @@ pgie_src_pad_buffer_probe(GstPad *pad, GstPadProbeInfo *info,
   NvDsMetaList *l_user = NULL;
   NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buf);
 
+  if (thread_placement_is_set(&probe_placement) &&
+      g_atomic_int_compare_and_exchange(&probe_thread_placed, 0, 1))
+    thread_placement_apply(&probe_placement, "probe thread", -1);
+
+  g_mutex_lock(&stream_lock);
+  pose_batch.clear();
+  batch_entries.clear();
   for (l_frame = batch_meta->frame_meta_list; l_frame != NULL;
        l_frame = l_frame->next)
   {
@@ -202,10 +870,7 @@ pgie_src_pad_buffer_probe(GstPad *pad, GstPadProbeInfo *info,
       {
         NvDsInferTensorMeta *tensor_meta =
             (NvDsInferTensorMeta *)user_meta->user_meta_data;
-        Vec2D<int> objects;
-        Vec3D<float> normalized_peaks;
-        tie(objects, normalized_peaks) = parse_objects_from_tensor_meta(tensor_meta);
-        create_display_meta(objects, normalized_peaks, frame_meta, frame_meta->source_frame_width, frame_meta->source_frame_height);
+        add_frame_tensor(tensor_meta, frame_meta);
       }
     }
 
@@ -221,14 +886,43 @@ pgie_src_pad_buffer_probe(GstPad *pad, GstPadProbeInfo *info,
         {
           NvDsInferTensorMeta *tensor_meta =
               (NvDsInferTensorMeta *)user_meta->user_meta_data;
-          Vec2D<int> objects;
-          Vec3D<float> normalized_peaks;
-          tie(objects, normalized_peaks) = parse_objects_from_tensor_meta(tensor_meta);
-          create_display_meta(objects, normalized_peaks, frame_meta, frame_meta->source_frame_width, frame_meta->source_frame_height);
+          add_frame_tensor(tensor_meta, frame_meta);
         }
       }
     }
   }
+
+  /* All the inferred frames of the batch in one pass, stage by stage */
+  pose_batch.run(topology, post_process_scheduler);
+
+  guint next = 0;
+  for (l_frame = batch_meta->frame_meta_list; l_frame != NULL;
+       l_frame = l_frame->next)
+  {
+    NvDsFrameMeta *frame_meta = (NvDsFrameMeta *)(l_frame->data);
+    gboolean inferred = FALSE;
+
+    for (; next < batch_entries.size() && batch_entries[next].frame_meta == frame_meta; next++)
+    {
+      PoseBatchFrame &frame = pose_batch[next];
+      finish_frame_tensor(frame, batch_entries[next].tensor_meta, frame_meta);
+      publish_pose_result(frame.result, frame_meta);
+      if (should_render(frame_meta))
+        create_display_meta(frame.result.objects, frame.result.peaks, frame_meta, muxer_width, muxer_height);
+      inferred = TRUE;
+    }
+
+    /* No inference on this frame, draw the skeletons predicted by the tracker, or repeat the last count */
+    if (!inferred && use_tracker)
+    {
+      StreamContext &ctx = get_stream_context(frame_meta->source_id);
+      PoseResult result = ctx.last_mode == OUTPUT_SKELETONS ? predict_frame(ctx, frame_meta) : repeat_frame(ctx);
+      publish_pose_result(result, frame_meta);
+      if (should_render(frame_meta))
+        create_display_meta(result.objects, result.peaks, frame_meta, muxer_width, muxer_height);
+    }
+  }
+  g_mutex_unlock(&stream_lock);
   return GST_PAD_PROBE_OK;
 }
 
@@ -252,6 +946,8 @@ osd_sink_pad_buffer_probe(GstPad *pad, GstPadProbeInfo *info,
   {
     NvDsFrameMeta *frame_meta = (NvDsFrameMeta *)(l_frame->data);
     int offset = 0;
+    if (!should_render(frame_meta))
+      continue;
     for (l_obj = frame_meta->obj_meta_list; l_obj != NULL; l_obj = l_obj->next)
     {
       obj_meta = (NvDsObjectMeta *)(l_obj->data);
@@ -309,6 +1005,7 @@ bus_call(GstBus *bus, GstMessage *msg, gpointer data)
       g_printerr("Error details: %s\n", debug);
     g_free(debug);
     g_error_free(error);
+    pipeline_failed = TRUE;
     g_main_loop_quit(loop);
     break;
   }
@@ -401,6 +1098,42 @@ make_caps_and_link(
   return (element);
 }
 
+/* A leaky queue is full when it is about to drop its oldest buffer */
+static void
+on_leaky_queue_overrun(GstElement *queue, gpointer data)
+{
+  LeakyQueueStats *stats = (LeakyQueueStats *)data;
+  g_atomic_int_inc(&stats->dropped);
+}
+
+/* Queue which keeps at most 'size' buffers and drops the oldest ones,
+   so that a slow downstream stage always receives the freshest frame */
+GstElement *
+make_leaky_queue_and_link(
+  const gchar *stage, gint size, GstBin *bin, GstElement *src
+)
+{
+  GstElement *element;
+
+  element = make_element_and_link("queue", NULL, bin, src);
+  g_object_set(G_OBJECT(element),
+    "leaky", 2,
+    "max-size-buffers", size,
+    "max-size-bytes", 0,
+    "max-size-time", (guint64)0,
+    NULL
+  );
+
+  if (num_leaky_queues < MAX_LEAKY_QUEUES) {
+    LeakyQueueStats *stats = &leaky_queue_stats[num_leaky_queues++];
+    stats->stage = stage;
+    stats->dropped = 0;
+    g_signal_connect(element, "overrun", G_CALLBACK(on_leaky_queue_overrun), stats);
+  }
+
+  return (element);
+}
+
 GstElement *
 construct_camera_source_bin(
   GstBin *bin, const gchar *device, gint width, gint height
@@ -486,13 +1219,129 @@ construct_file_source_bin(GstBin *bin, const gchar *file_path)
   return (element);
 }
 
+/* Pushes the next replayed frame, or the end of stream once all were pushed */
+static void
+on_replay_need_data(GstElement *appsrc, guint length, gpointer data)
+{
+  if (replay.num_pushed >= (guint64)replay_num_frames)
+  {
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    return;
+  }
+
+  guint64 n = replay.num_pushed++;
+  ReplayFrame &frame = replay.frames[n % replay.frames.size()];
+  guint source_id = replay_streams > 1 ? n % replay_streams : frame.source_id;
+  gint64 frame_num = n / replay_streams;
+  gint64 now = g_get_monotonic_time();
+
+  if (n == 0)
+    replay.start_us = now;
+  gst_app_src_push_buffer(GST_APP_SRC(appsrc),
+                          tensor_replay_buffer(frame, source_id, frame_num, frame_num * REPLAY_FRAME_DURATION, now));
+}
+
+/* Measures the time from the push of a replayed frame to the end of the pipeline */
+static GstPadProbeReturn
+replay_sink_pad_buffer_probe(GstPad *pad, GstPadProbeInfo *info, gpointer u_data)
+{
+  GstBuffer *buf = (GstBuffer *)info->data;
+  NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  gint64 now = g_get_monotonic_time();
+
+  for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame != NULL; l_frame = l_frame->next)
+  {
+    NvDsFrameMeta *frame_meta = (NvDsFrameMeta *)(l_frame->data);
+    gint64 latency = now - frame_meta->misc_frame_info[0];
+    replay.total_latency_us += latency;
+    replay.max_latency_us = MAX(replay.max_latency_us, latency);
+    replay.num_done++;
+  }
+  replay.end_us = now;
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+print_replay_stats()
+{
+  double seconds = (replay.end_us - replay.start_us) / 1e6;
+  g_print("replay: %" G_GUINT64_FORMAT " frames in %.2f s, %.1f fps, latency avg %.3f ms max %.3f ms\n",
+          replay.num_done, seconds, seconds > 0 ? replay.num_done / seconds : 0.0,
+          replay.num_done ? replay.total_latency_us / 1000.0 / replay.num_done : 0.0,
+          replay.max_latency_us / 1000.0);
+}
+
+/* Stand-in for the source, nvstreammux, nvinfer and nvdsosd: appsrc pushes
+   buffers carrying batch and tensor meta through identity elements, whose pads
+   get the same probes as nvinfer and nvdsosd */
+GstElement *
+construct_replay_bin(GstBin *bin, GstPad **p_pgie_src_pad, GstPad **p_osd_sink_pad)
+{
+  GstElement *element = NULL;
+  GstPad *sink_pad = NULL;
+
+  element = make_element_and_link("appsrc", "replay-source", bin, element);
+  g_object_set(G_OBJECT(element), "format", GST_FORMAT_TIME, "is-live", FALSE, NULL);
+  g_signal_connect(element, "need-data", G_CALLBACK(on_replay_need_data), NULL);
+
+  element = make_element_and_link("identity", "infer-stand-in", bin, element);
+  *p_pgie_src_pad = gst_element_get_static_pad(element, "src");
+
+  element = make_element_and_link("identity", "osd-stand-in", bin, element);
+  *p_osd_sink_pad = gst_element_get_static_pad(element, "sink");
+
+  element = make_element_and_link("fakesink", NULL, bin, element);
+  g_object_set(G_OBJECT(element), "sync", FALSE, NULL);
+  sink_pad = gst_element_get_static_pad(element, "sink");
+  gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, replay_sink_pad_buffer_probe, NULL, NULL);
+  gst_object_unref(sink_pad);
+
+  return (element);
+}
+
+/* Finds the resolution of the video stream of 'file_path' */
+static gboolean
+discover_video_size(const gchar *file_path, gint *width, gint *height)
+{
+  GError *error = NULL;
+  gboolean found = FALSE;
+  gchar *uri = gst_filename_to_uri(file_path, &error);
+  GstDiscoverer *discoverer = uri ? gst_discoverer_new(DISCOVER_TIMEOUT, &error) : NULL;
+  GstDiscovererInfo *info = discoverer ? gst_discoverer_discover_uri(discoverer, uri, &error) : NULL;
+
+  if (info)
+  {
+    GList *streams = gst_discoverer_info_get_video_streams(info);
+    if (streams)
+    {
+      GstDiscovererVideoInfo *video = GST_DISCOVERER_VIDEO_INFO(streams->data);
+      *width = gst_discoverer_video_info_get_width(video);
+      *height = gst_discoverer_video_info_get_height(video);
+      found = *width > 0 && *height > 0;
+      gst_discoverer_stream_info_list_free(streams);
+    }
+    g_object_unref(info);
+  }
+  if (error)
+  {
+    g_printerr("Could not find the resolution of %s: %s\n", file_path, error->message);
+    g_error_free(error);
+  }
+  if (discoverer)
+    g_object_unref(discoverer);
+  g_free(uri);
+  return found;
+}
+
 GstElement *
 construct_inference_bin(
   GstBin *bin, GstElement *source_elements[], gint num_sources, gboolean is_live,
+  gint width, gint height, gint queue_size, gint interval, const gchar *tracker_lib, gboolean render,
   GstPad **p_pgie_src_pad, GstPad **p_osd_sink_pad
 )
 {
   GstElement *element = NULL;
+  GstElement *source = NULL;
   GstPadTemplate *pad_template = NULL;
   GstPad *sink_pad = NULL;
   GstPad *src_pad = NULL;
@@ -500,9 +1349,9 @@ construct_inference_bin(
 
   element = make_element_and_link("nvstreammux", NULL, bin, element);
   g_object_set(G_OBJECT(element), 
-    "width", 1920, 
-    "height", 1080, 
-    "batch-size", 1, 
+    "width", width, 
+    "height", height, 
+    "batch-size", num_sources, 
     "batched-push-timeout", MUXER_BATCH_TIMEOUT_USEC,
     NULL
   );
@@ -511,8 +1360,12 @@ construct_inference_bin(
   }
 
   for (gint i = 0;i < num_sources;i++) {
+    source = source_elements[i];
+    if (queue_size > 0) {
+      source = make_leaky_queue_and_link("source", queue_size, bin, source);
+    }
     src_pad = gst_element_get_static_pad(
-      source_elements[i], "src"
+      source, "src"
     );
     if (src_pad == NULL) {
         g_printerr("src pad error\n");
@@ -537,12 +1390,36 @@ construct_inference_bin(
     "config-file-path", "deepstream_pose_estimation_config.txt", 
     NULL
   );
+  if (num_sources > 1) {
+    /* One batch holds a frame of every source */
+    g_object_set(G_OBJECT(element), "batch-size", num_sources, NULL);
+  }
+  if (interval > 0) {
+    g_object_set(G_OBJECT(element), "interval", interval, NULL);
+  }
   *p_pgie_src_pad = gst_element_get_static_pad(element, "src");
 
-  element = make_element_and_link("nvvideoconvert", NULL, bin, element);
+  /* The person objects are attached on the nvinfer src pad, before the tracker sees the buffer */
+  if (tracker_lib != NULL) {
+    element = make_element_and_link("nvtracker", NULL, bin, element);
+    g_object_set(G_OBJECT(element),
+      "ll-lib-file", tracker_lib,
+      "enable-batch-process", TRUE,
+      NULL
+    );
+  }
 
-  element = make_element_and_link("nvdsosd", NULL, bin, element);
-  *p_osd_sink_pad = gst_element_get_static_pad(element, "sink");
+  if (queue_size > 0) {
+    element = make_leaky_queue_and_link("inference", queue_size, bin, element);
+  }
+
+  /* Without a display or file sink nothing is drawn, the OSD is left out */
+  if (render) {
+    element = make_element_and_link("nvvideoconvert", NULL, bin, element);
+
+    element = make_element_and_link("nvdsosd", NULL, bin, element);
+    *p_osd_sink_pad = gst_element_get_static_pad(element, "sink");
+  }
 
   element = make_element_and_link("tee", NULL, bin, element);
   
@@ -551,19 +1428,26 @@ construct_inference_bin(
 
 GstElement *
 construct_display_bin(
-  GstBin *bin, GstElement *tee_element
+  GstBin *bin, GstElement *tee_element, gint queue_size
 )
 {
   GstElement *element = NULL;
   GstElement *element0 = NULL;
 
+  if (queue_size > 0) {
+    element = make_leaky_queue_and_link("display", queue_size, bin, element);
+    element0 = element;
+  }
+
 #ifdef PLATFORM_TEGRA
   element = make_element_and_link("nvegltransform", NULL, bin, element);
-  element0 = element;
+  if (element0 == NULL)
+    element0 = element;
   element = make_element_and_link("nveglglessink", NULL, bin, element);
 #else
   element = make_element_and_link("nveglglessink", NULL, bin, element);
-  element0 = element;
+  if (element0 == NULL)
+    element0 = element;
 #endif
 
   if (!link_element_to_tee_src_pad(tee_element, element0))
@@ -575,6 +1459,26 @@ construct_display_bin(
   return (element);
 }
 
+/* Terminates the pipeline when the results are only published, not rendered */
+GstElement *
+construct_fake_sink_bin(
+  GstBin *bin, GstElement *tee_element
+)
+{
+  GstElement *element = NULL;
+
+  element = make_element_and_link("fakesink", NULL, bin, element);
+  g_object_set(G_OBJECT(element), "sync", FALSE, "async", FALSE, NULL);
+
+  if (!link_element_to_tee_src_pad(tee_element, element))
+  {
+    g_printerr("Could not link tee to fakesink\n");
+    return (NULL);
+  }
+
+  return (element);
+}
+
 GstElement *
 construct_file_sink_bin(
   GstBin *bin, GstElement *tee_element, const gchar *file_path 
@@ -609,67 +1513,347 @@ construct_file_sink_bin(
   return (element);
 }
 
+/* Stops the workers on SIGINT and SIGTERM, the main loop quits once they exited */
+static gboolean
+on_supervisor_signal(gpointer data)
+{
+  worker_supervisor_stop((WorkerSupervisor *)data);
+  return TRUE;
+}
+
+/* Ends the pipeline of a worker with EOS on SIGINT and SIGTERM, to flush its outputs */
+static gboolean
+on_worker_signal(gpointer data)
+{
+  gst_element_send_event(GST_ELEMENT(data), gst_event_new_eos());
+  return TRUE;
+}
+
+/* Starts the workers and supervises them until they all finished or were stopped */
+static int
+run_supervisor(gchar **command_line, guint num_sources, GMainLoop *loop)
+{
+  guint workers = MIN((guint)num_workers, num_sources);
+  const gchar *index_name = shm_index_name ? shm_index_name : DEFAULT_SHM_INDEX;
+
+  PoseIndex *index = pose_index_create(index_name, num_sources);
+  if (!index)
+    return -1;
+  g_print("supervising %u workers for %u sources, latest skeletons in shared-memory index %s\n",
+          workers, num_sources, index_name);
+
+  WorkerSupervisor *supervisor = worker_supervisor_start(command_line, workers, num_sources, index, loop);
+  guint sigint_id = g_unix_signal_add(SIGINT, on_supervisor_signal, supervisor);
+  guint sigterm_id = g_unix_signal_add(SIGTERM, on_supervisor_signal, supervisor);
+  g_main_loop_run(loop);
+
+  g_source_remove(sigint_id);
+  g_source_remove(sigterm_id);
+  worker_supervisor_print_stats(supervisor);
+  worker_supervisor_free(supervisor);
+  pose_index_close(index);
+  g_main_loop_unref(loop);
+  return 0;
+}
+
+/* Prints the status and statistics on the standard error, the standard output carrying the JSON export */
+static void
+print_to_stderr(const gchar *message)
+{
+  fputs(message, stderr);
+}
+
+/* Appends the worker index to the name of a per-process output, so that workers do not share it */
+static gchar *
+worker_output_name(gchar *name, const gchar *separator)
+{
+  if (name == NULL || strcmp(name, "-") == 0)
+    return name;
+
+  gchar *worker_name = g_strdup_printf("%s%s%d", name, separator, worker_index);
+  g_free(name);
+  return worker_name;
+}
+
 int main(int argc, char *argv[])
 {
   GMainLoop *loop = NULL;
   GstBus *bus = NULL;
   GstElement *pipeline = NULL;
-  GstElement *vid_src = NULL;
   GstElement *tee = NULL;
   GstElement *nvsink = NULL;
-  GstElement *element_list[8];
+  Vec1D<GstElement *> source_elements;
+  Vec1D<const gchar *> inputs;
+  gchar **command_line = NULL;
   GstPad *pgie_src_pad = NULL;
   GstPad *osd_sink_pad = NULL;
   gboolean is_live = FALSE;
+  gboolean file_sink = FALSE;
   guint bus_watch_id;
-  gchar input_path[80];
+  guint stats_timer_id = 0;
   gchar output_path[80];
+  GOptionContext *option_context = NULL;
+  GError *error = NULL;
+
+  /* Workers are started with the same command line */
+  command_line = g_strdupv(argv);
 
   /* Standard GStreamer initialization */
   gst_init(&argc, &argv);
   loop = g_main_loop_new(NULL, FALSE);
 
-  /* get the input path and the output path */
-  g_strlcpy(input_path, "/dev/video0", sizeof input_path);
+  /* Parse the options, the remaining arguments are the input and output paths */
+  option_context = g_option_context_new("[INPUT] [OUTPUT-PATH]");
+  g_option_context_add_main_entries(option_context, option_entries, NULL);
+  if (!g_option_context_parse(option_context, &argc, &argv, &error))
+  {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    g_option_context_free(option_context);
+    return -1;
+  }
+  g_option_context_free(option_context);
+  if (g_strcmp0(export_json_path, "-") == 0)
+    g_set_print_handler(print_to_stderr);
+  g_mutex_init(&stream_lock);
+  if (tensor_layout_name != NULL)
+  {
+    if (g_ascii_strcasecmp(tensor_layout_name, "hwc") == 0)
+      tensor_layout = TENSOR_LAYOUT_HWC;
+    else if (g_ascii_strcasecmp(tensor_layout_name, "chw") != 0)
+    {
+      g_printerr("Unknown tensor layout %s\n", tensor_layout_name);
+      return -1;
+    }
+  }
+  if (int8_scale_option != NULL && !parse_int8_scales(int8_scale_option))
+    return -1;
+  if (output_mode_option != NULL && !output_mode_parse(output_mode_option, &base_params.output_mode))
+  {
+    g_printerr("Unknown output mode %s\n", output_mode_option);
+    return -1;
+  }
+  post_process_config_init(&post_process_config, base_params, topology);
+  if (config_path != NULL)
+  {
+    if (!post_process_config_load(&post_process_config, config_path, base_params, topology))
+      return -1;
+    topology = post_process_config.topology;
+  }
+  if (!load_exclusion_masks())
+    return -1;
+  if (infer_interval > 0)
+    use_tracker = TRUE;
+  if (render_interval < 0)
+  {
+    g_printerr("The render interval must not be negative\n");
+    return -1;
+  }
+  if (latency_budget_ms > 0)
+    g_print("post-processing latency budget %.2f ms per stream\n", latency_budget_ms);
+  if (max_parts_limit < 0 || max_parts_limit > CONFIG_MAX_NUM_PARTS)
+  {
+    g_printerr("The limit of candidates per body part must be between 0 and %d\n", CONFIG_MAX_NUM_PARTS);
+    return -1;
+  }
+  if (post_process_threads < 0)
+  {
+    g_printerr("The number of post-processing threads must not be negative\n");
+    return -1;
+  }
+  if (!thread_placement_parse(&probe_placement, probe_cpus, probe_sched) ||
+      !thread_placement_parse(&post_process_placement, post_process_cpus, post_process_sched))
+    return -1;
+  if (thread_placement_is_set(&post_process_placement) && post_process_threads == 0)
+    g_printerr("--post-process-cpus and --post-process-sched have no effect without --post-process-threads\n");
+
+  /* The inputs given with --input, then the positional one */
+  for (gchar **path = input_paths; path != NULL && *path != NULL; path++)
+    inputs.push_back(*path);
+  if (argc >= 2)
+    inputs.push_back(argv[1]);
+  if (inputs.empty())
+    inputs.push_back("/dev/video0");
+
+  if (num_workers > 0 && worker_index < 0)
+  {
+    int ret = run_supervisor(command_line, inputs.size(), loop);
+    g_strfreev(command_line);
+    return ret;
+  }
+  g_strfreev(command_line);
+
+  if (worker_index >= 0)
+  {
+    guint first, count;
+
+    if (num_workers <= 0 || (guint)worker_index >= MIN((guint)num_workers, inputs.size()))
+    {
+      g_printerr("Invalid worker index %d\n", worker_index);
+      return -1;
+    }
+    worker_source_range(worker_index, MIN((guint)num_workers, inputs.size()), inputs.size(), &first, &count);
+    inputs = Vec1D<const gchar *>(inputs.begin() + first, inputs.begin() + first + count);
+    first_source_id = first;
+
+    /* Workers run headless, each with its own per-process outputs */
+    no_display = TRUE;
+    shm_ring_name = worker_output_name(shm_ring_name, "-");
+    export_json_path = worker_output_name(export_json_path, ".");
+    archive_path = worker_output_name(archive_path, ".");
+    record_tensors_path = worker_output_name(record_tensors_path, ".");
+
+    pose_index = pose_index_open(shm_index_name ? shm_index_name : DEFAULT_SHM_INDEX, TRUE);
+    if (!pose_index)
+      return -1;
+    g_print("worker %d: sources %u to %u\n", worker_index, first, first + count - 1);
+  }
+  else if (shm_index_name != NULL)
+  {
+    pose_index = pose_index_create(shm_index_name, inputs.size());
+    if (!pose_index)
+      return -1;
+    g_print("publishing the latest skeletons in shared-memory index %s\n", shm_index_name);
+  }
+  if (shm_ring_name != NULL)
+  {
+    if (shm_ring_slots <= 0)
+    {
+      g_printerr("The shared-memory ring needs at least one slot\n");
+      return -1;
+    }
+    pose_ring = pose_ring_create(shm_ring_name, shm_ring_slots);
+    if (!pose_ring)
+      return -1;
+    g_print("publishing skeletons in shared-memory ring %s, %d slots\n", shm_ring_name, shm_ring_slots);
+  }
+  if (export_json_path != NULL)
+  {
+    pose_exporter = pose_export_open(export_json_path);
+    if (!pose_exporter)
+      return -1;
+    g_print("exporting skeletons to %s\n", export_json_path);
+  }
+  if (archive_path != NULL)
+  {
+    pose_archive = new PoseArchiveWriter;
+    if (!pose_archive->open(archive_path))
+      return -1;
+    g_print("archiving skeletons to %s\n", archive_path);
+  }
+
+  /* get the output path */
   memset(output_path, 0, sizeof output_path);
-  if (argc >= 2) {
-    g_strlcpy(input_path, argv[1], sizeof input_path);
-    if (argc >= 3) {
-      g_strlcpy(output_path, argv[2], sizeof output_path);
-      g_strlcat(output_path, OUTPUT_FILE, sizeof output_path);
-      g_print("output file %s\n", output_path);
+  if (argc >= 3 && worker_index < 0) {
+    g_strlcpy(output_path, argv[2], sizeof output_path);
+    g_strlcat(output_path, OUTPUT_FILE, sizeof output_path);
+    g_print("output file %s\n", output_path);
+  }
+  for (const gchar *input : inputs)
+    g_print("input file %s\n", input);
+  if (inputs.size() > 1 && !no_display) {
+    /* The batched frames are not tiled, there is no single picture to show */
+    g_print("several sources, no display\n");
+    no_display = TRUE;
+  }
+
+  /* Resolution of the batched frames */
+  if (muxer_size_name != NULL && g_ascii_strcasecmp(muxer_size_name, "native") == 0) {
+    if (strncmp(inputs[0], "/dev/video", strlen("/dev/video")) == 0) {
+      muxer_width = CAP_WIDTH;
+      muxer_height = CAP_HEIGHT;
+    }
+    else if (!discover_video_size(inputs[0], &muxer_width, &muxer_height)) {
+      muxer_width = MUXER_OUTPUT_WIDTH;
+      muxer_height = MUXER_OUTPUT_HEIGHT;
+    }
+  }
+  else if (muxer_size_name != NULL) {
+    if (sscanf(muxer_size_name, "%dx%d", &muxer_width, &muxer_height) != 2
+        || muxer_width <= 0 || muxer_height <= 0) {
+      g_printerr("Invalid muxer size %s, expected WIDTHxHEIGHT or native\n", muxer_size_name);
+      return -1;
     }
   }
-  g_print("input file %s\n", input_path);
+  g_print("muxer resolution %dx%d\n", muxer_width, muxer_height);
+
+  /* Replayed tensors */
+  if (replay_spec != NULL) {
+    if (replay_num_frames <= 0 || replay_streams <= 0) {
+      g_printerr("--replay-frames and --replay-streams must be positive\n");
+      return -1;
+    }
+    if (g_str_has_prefix(replay_spec, "synthetic")) {
+      int num_people = replay_spec[strlen("synthetic")] == ':' ? atoi(replay_spec + strlen("synthetic:")) : 8;
+      tensor_replay_synthetic(num_people, tensor_layout, muxer_width, muxer_height, replay.frames);
+      g_print("replaying %d frames of %d synthetic people\n", replay_num_frames, num_people);
+    }
+    else if (tensor_replay_load(replay_spec, replay.frames)) {
+      g_print("replaying %d frames from %s (%zu recorded)\n", replay_num_frames, replay_spec, replay.frames.size());
+    }
+    else {
+      return -1;
+    }
+  }
+  if (record_tensors_path != NULL) {
+    tensor_recorder = tensor_record_open(record_tensors_path);
+    if (!tensor_recorder)
+      return -1;
+    g_print("recording the output layers to %s\n", record_tensors_path);
+  }
 
   /* Create gstreamer elements */
   /* Create Pipeline element that will form a connection of other elements */
   pipeline = gst_pipeline_new("deepstream-tensorrt-openpose-pipeline");
 
-  if (strncmp(input_path, "/dev/video", strlen("/dev/video")) == 0) {
-    is_live = TRUE;
-    vid_src = construct_camera_source_bin(
-      GST_BIN(pipeline), input_path, CAP_WIDTH, CAP_HEIGHT
-    );
+  if (replay_spec != NULL) {
+    /* No GPU element, the display meta is built but not drawn */
+    construct_replay_bin(GST_BIN(pipeline), &pgie_src_pad, &osd_sink_pad);
+    render_enabled = TRUE;
   }
   else {
-    is_live = FALSE;
-    vid_src = construct_file_source_bin(
-      GST_BIN(pipeline), input_path
+    for (const gchar *input : inputs) {
+      if (strncmp(input, "/dev/video", strlen("/dev/video")) == 0) {
+        is_live = TRUE;
+        source_elements.push_back(construct_camera_source_bin(
+          GST_BIN(pipeline), input, CAP_WIDTH, CAP_HEIGHT
+        ));
+      }
+      else {
+        source_elements.push_back(construct_file_source_bin(
+          GST_BIN(pipeline), input
+        ));
+      }
+    }
+
+    file_sink = output_path[0] != 0 && !is_live && !pose_archive && inputs.size() == 1;
+    render_enabled = file_sink || !no_display;
+    if (!render_enabled)
+      g_print("no display or file sink, skipping the on-screen display\n");
+
+    tee = construct_inference_bin(
+      GST_BIN(pipeline), source_elements.data(), source_elements.size(), is_live, muxer_width, muxer_height,
+      is_live ? live_queue_size : 0, infer_interval, nvtracker_lib, render_enabled,
+      &pgie_src_pad, &osd_sink_pad
     );
-  }
 
-  element_list[0] = vid_src;
-  tee = construct_inference_bin(
-    GST_BIN(pipeline), element_list, 1, is_live,
-    &pgie_src_pad, &osd_sink_pad
-  );
+    if (file_sink) {
+      construct_file_sink_bin(GST_BIN(pipeline), tee, output_path);
+    }
 
-  if (output_path[0] != 0 && !is_live) {
-    construct_file_sink_bin(GST_BIN(pipeline), tee, output_path);
+    if (!no_display) {
+      nvsink = construct_display_bin(GST_BIN(pipeline), tee, is_live ? live_queue_size : 0);
+    }
+
+    if (!render_enabled) {
+      construct_fake_sink_bin(GST_BIN(pipeline), tee);
+    }
   }
 
-  nvsink = construct_display_bin(GST_BIN(pipeline), tee);
+  if (worker_index >= 0) {
+    g_unix_signal_add(SIGINT, on_worker_signal, pipeline);
+    g_unix_signal_add(SIGTERM, on_worker_signal, pipeline);
+  }
 
   /* we add a message handler */
   bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
@@ -685,12 +1869,32 @@ int main(int argc, char *argv[])
   /* Lets add probe to get informed of the meta data generated, we add probe to
    * the sink pad of the osd element, since by that time, the buffer would have
    * had got all the metadata. */
-  if (!osd_sink_pad)
+  if (!osd_sink_pad && render_enabled)
     g_print("Unable to get sink pad\n");
-  else
+  else if (osd_sink_pad)
     gst_pad_add_probe(osd_sink_pad, GST_PAD_PROBE_TYPE_BUFFER,
                       osd_sink_pad_buffer_probe, (gpointer)nvsink, NULL);
 
+  if (post_process_threads > 0)
+  {
+    post_process_scheduler = new TaskScheduler(
+        post_process_threads,
+        thread_placement_is_set(&post_process_placement) ? place_post_process_thread : NULL);
+    g_print("post-processing on %d threads\n", post_process_threads);
+  }
+
+  /* The counters are opened per thread, the main thread only checks that the system allows them */
+  if (perf_counters && !perf_counters_available())
+    perf_counters = FALSE;
+  pose_batch.setProfiling(perf_counters);
+
+  if (stats_interval > 0)
+    stats_timer_id = g_timeout_add_seconds(stats_interval, print_stream_stats, NULL);
+
+  /* A configuration that cannot be watched is still used, only not reloaded */
+  if (config_path != NULL)
+    config_watcher = config_watcher_new(config_path, on_config_changed, NULL);
+
   /* Set the pipeline to "playing" state */
   g_print("Now playing...\n");
   gst_element_set_state(pipeline, GST_STATE_PLAYING);
@@ -705,9 +1909,25 @@ int main(int argc, char *argv[])
   /* Out of the main loop, clean up nicely */
   g_print("Returned, stopping playback\n");
   gst_element_set_state(pipeline, GST_STATE_NULL);
+  pose_export_close(pose_exporter);
+  pose_exporter = NULL;
+  if (pose_archive)
+    pose_archive->close();
+  tensor_record_close(tensor_recorder);
+  tensor_recorder = NULL;
+  print_stream_stats(NULL);
+  if (replay_spec != NULL)
+    print_replay_stats();
+  if (stats_timer_id)
+    g_source_remove(stats_timer_id);
+  config_watcher_free(config_watcher);
   g_print("Deleting pipeline\n");
   gst_object_unref(GST_OBJECT(pipeline));
   g_source_remove(bus_watch_id);
   g_main_loop_unref(loop);
-  return 0;
+  pose_ring_close(pose_ring);
+  pose_index_close(pose_index);
+  delete pose_archive;
+  delete post_process_scheduler;
+  return pipeline_failed ? -1 : 0;
 }
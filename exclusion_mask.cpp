@@ -0,0 +1,107 @@
+#include "exclusion_mask.hpp"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+/* Reads the next decimal field of a PGM header or of a P2 raster, skipping whitespace and comments.
+ * Fails on a field above G_MAXINT. */
+static gboolean
+read_pgm_number(const gchar **pos, const gchar *end, long *value)
+{
+  const gchar *p = *pos;
+
+  while (p < end && (isspace((guchar)*p) || *p == '#'))
+  {
+    if (*p == '#')
+      while (p < end && *p != '\n')
+        p++;
+    else
+      p++;
+  }
+  if (p == end || !isdigit((guchar)*p))
+    return FALSE;
+
+  *value = 0;
+  while (p < end && isdigit((guchar)*p))
+  {
+    *value = *value * 10 + (*p++ - '0');
+    if (*value > G_MAXINT)
+      return FALSE;
+  }
+  *pos = p;
+  return TRUE;
+}
+
+gboolean
+exclusion_mask_load(ExclusionMask *mask, const gchar *path)
+{
+  gchar *contents;
+  gsize length;
+  GError *error = NULL;
+  long width, height, max_value;
+
+  if (!g_file_get_contents(path, &contents, &length, &error))
+  {
+    g_printerr("Failed to read the exclusion mask %s: %s\n", path, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  const gchar *pos = contents + 2;
+  const gchar *end = contents + length;
+  gboolean binary = length >= 2 && contents[0] == 'P' && contents[1] == '5';
+  gboolean ascii = length >= 2 && contents[0] == 'P' && contents[1] == '2';
+
+  if ((!binary && !ascii) || !read_pgm_number(&pos, end, &width) || !read_pgm_number(&pos, end, &height) ||
+      !read_pgm_number(&pos, end, &max_value) || width <= 0 || height <= 0 || max_value <= 0 ||
+      max_value > 255)
+  {
+    g_printerr("%s is not an 8-bit PGM image\n", path);
+    g_free(contents);
+    return FALSE;
+  }
+  if (width > EXCLUSION_MASK_MAX_SIZE || height > EXCLUSION_MASK_MAX_SIZE)
+  {
+    g_printerr("The exclusion mask %s is %ldx%ld, larger than %dx%d\n", path, width, height,
+               EXCLUSION_MASK_MAX_SIZE, EXCLUSION_MASK_MAX_SIZE);
+    g_free(contents);
+    return FALSE;
+  }
+
+  /* A single whitespace character ends the header of a P5 image, its raster must follow in full */
+  if (binary && (pos == end || end - (pos + 1) < width * height))
+  {
+    g_printerr("The exclusion mask %s is truncated\n", path);
+    g_free(contents);
+    return FALSE;
+  }
+
+  std::vector<uint8_t> excluded(width * height);
+  gboolean ok = TRUE;
+
+  if (binary)
+  {
+    pos++;
+    for (long p = 0; p < width * height; p++)
+      excluded[p] = pos[p] == 0;
+  }
+  else
+  {
+    for (long p = 0; p < width * height && ok; p++)
+    {
+      long value;
+      ok = read_pgm_number(&pos, end, &value);
+      excluded[p] = value == 0;
+    }
+  }
+  g_free(contents);
+
+  if (!ok)
+  {
+    g_printerr("The exclusion mask %s is truncated\n", path);
+    return FALSE;
+  }
+
+  mask->set(width, height, excluded.data());
+  return TRUE;
+}
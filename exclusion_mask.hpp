@@ -0,0 +1,97 @@
+#pragma once
+
+#include "search_region.hpp"
+
+#include <glib.h>
+
+#include <vector>
+#include <stdint.h>
+
+/* Largest width and height of a mask, far above any heatmap, so a corrupted header cannot exhaust the memory */
+#define EXCLUSION_MASK_MAX_SIZE 4096
+
+/**
+ * Static mask of the heatmap pixels of one camera where nobody can be,
+ * such as walls, sky or glass. find_peaks skips the tiles whose pixels are
+ * all excluded without reading them, and drops the peaks found on an
+ * excluded pixel of a partly excluded tile.
+ */
+class ExclusionMask
+{
+public:
+  ExclusionMask() : width(0), height(0), tiles_w(0), tiles_h(0)
+  {
+  }
+
+  /**
+   * Sets a width x height mask from 'excluded', one byte per pixel in row
+   * order, nonzero where no peak may be
+   */
+  void set(int width, int height, const uint8_t *excluded)
+  {
+    this->width = width;
+    this->height = height;
+    this->tiles_w = (width + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+    this->tiles_h = (height + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+    this->pixels.assign(excluded, excluded + width * height);
+    this->tiles.assign(tiles_w * tiles_h, 1);
+    for (int i = 0; i < height; i++)
+    {
+      for (int j = 0; j < width; j++)
+      {
+        if (!pixels[i * width + j])
+        {
+          tiles[(i / SEARCH_TILE_SIZE) * tiles_w + j / SEARCH_TILE_SIZE] = 0;
+        }
+      }
+    }
+  }
+
+  /* Whether the mask was drawn for width x height heatmaps */
+  inline bool fits(int width, int height) const
+  {
+    return width == this->width && height == this->height;
+  }
+
+  inline bool tileExcluded(int ti, int tj) const
+  {
+    return tiles[ti * tiles_w + tj] != 0;
+  }
+
+  inline bool pixelExcluded(int i, int j) const
+  {
+    return pixels[i * width + j] != 0;
+  }
+
+  /**
+   * Returns the number of tiles skipped entirely
+   */
+  int numExcludedTiles() const
+  {
+    int count = 0;
+    for (uint8_t tile : tiles)
+    {
+      if (tile)
+      {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  int width;
+  int height;
+  int tiles_w;
+  int tiles_h;
+
+private:
+  std::vector<uint8_t> pixels;
+  std::vector<uint8_t> tiles;
+};
+
+/**
+ * Reads a PGM image (P2 or P5) in heatmap coordinates into 'mask', black
+ * pixels being excluded. Prints the error and returns FALSE when the file
+ * cannot be read or is not a PGM image.
+ */
+gboolean exclusion_mask_load(ExclusionMask *mask, const gchar *path);
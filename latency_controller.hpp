@@ -0,0 +1,154 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include <algorithm>
+
+/* Number of degradation levels, level 0 being the configured parameters */
+#define LATENCY_LEVELS 4
+
+/* Frames to wait after a level change before the next decision */
+#define LATENCY_COOLDOWN_FRAMES 15
+
+/* Consecutive frames under the slack threshold required to step back up */
+#define LATENCY_RECOVERY_FRAMES 60
+
+/* Fraction of the budget a frame must stay under to count as slack */
+#define LATENCY_SLACK_RATIO 0.6
+
+/* Smoothing factor of the moving average of post-processing times */
+#define LATENCY_EWMA_ALPHA 0.2
+
+/* Level 3 never cuts the candidates per body part below this, so two people still fit */
+#define LATENCY_MIN_PARTS 2
+
+/**
+ * Keeps the post-processing time of one stream under a latency budget.
+ * Each level trades some precision for a cheaper setting of the
+ * post-processing parameters:
+ *   1: fewer PAF integral samples
+ *   2: greedy limb assignment instead of Munkres
+ *   3: half the candidates per body part, but not below LATENCY_MIN_PARTS
+ */
+class LatencyController
+{
+public:
+  LatencyController() : num_degrades(0), num_recovers(0), base(), budget_us(0),
+                        level(0), ewma_us(0), cooldown(0), slack_frames(0)
+  {
+  }
+
+  /**
+   * Sets the per-frame budget in microseconds, 0 disables the controller
+   */
+  inline void setBudget(gint64 budget)
+  {
+    budget_us = budget;
+    if (budget_us <= 0)
+    {
+      level = 0;
+    }
+  }
+
+  inline void setBaseParams(const PostProcessParams &params)
+  {
+    base = params;
+  }
+
+  /**
+   * Returns the parameters to use for the next frame
+   */
+  PostProcessParams params() const
+  {
+    PostProcessParams p = base;
+    if (level >= 1)
+    {
+      p.num_integral_samples = std::max(3, base.num_integral_samples / 2);
+    }
+    if (level >= 2)
+    {
+      p.greedy_assignment = true;
+    }
+    if (level >= 3)
+    {
+      p.max_num_parts = std::max(std::min(base.max_num_parts, LATENCY_MIN_PARTS), base.max_num_parts / 2);
+    }
+    return p;
+  }
+
+  /**
+   * Feeds the post-processing time of the last frame and moves one level
+   * down when the budget is missed, or one level up after sustained slack.
+   * Returns true when the level changed.
+   */
+  bool update(gint64 elapsed_us)
+  {
+    if (budget_us <= 0)
+    {
+      return false;
+    }
+
+    ewma_us = (ewma_us == 0) ? elapsed_us
+                             : LATENCY_EWMA_ALPHA * elapsed_us + (1.0 - LATENCY_EWMA_ALPHA) * ewma_us;
+
+    if (elapsed_us < budget_us * LATENCY_SLACK_RATIO)
+    {
+      slack_frames++;
+    }
+    else
+    {
+      slack_frames = 0;
+    }
+
+    if (cooldown > 0)
+    {
+      cooldown--;
+      return false;
+    }
+
+    if (ewma_us > budget_us && level < LATENCY_LEVELS - 1)
+    {
+      level++;
+      num_degrades++;
+      cooldown = LATENCY_COOLDOWN_FRAMES;
+      slack_frames = 0;
+      return true;
+    }
+
+    if (slack_frames >= LATENCY_RECOVERY_FRAMES && level > 0)
+    {
+      level--;
+      num_recovers++;
+      cooldown = LATENCY_COOLDOWN_FRAMES;
+      slack_frames = 0;
+      return true;
+    }
+    return false;
+  }
+
+  inline int getLevel() const
+  {
+    return level;
+  }
+
+  inline double averageUs() const
+  {
+    return ewma_us;
+  }
+
+  inline gint64 getBudget() const
+  {
+    return budget_us;
+  }
+
+  guint64 num_degrades;
+  guint64 num_recovers;
+
+private:
+  PostProcessParams base;
+  gint64 budget_us;
+  int level;
+  double ewma_us;
+  int cooldown;
+  int slack_frames;
+};
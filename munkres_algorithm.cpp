@@ -6,6 +6,7 @@
 #include <array>
 #include <queue>
 #include <cmath>
+#include <algorithm>
 
 /*
 template <class T>
@@ -244,4 +245,168 @@ void munkres_algorithm(Vec2D<float> &cost_graph, PairGraph &star_graph, int nrow
       break;
     }
   }
-}
\ No newline at end of file
+}
+
+/* Rows and columns of the warm-started solver. The problem is solved with at
+   most as many rows as columns, 'transposed' when the caller has more rows. */
+struct WarmStartProblem
+{
+  const Vec2D<float> *cost_graph;
+  bool transposed;
+  int n;
+  int m;
+
+  inline float cost(int i, int j) const
+  {
+    return transposed ? (*cost_graph)[j][i] : (*cost_graph)[i][j];
+  }
+};
+
+int munkres_warm_start(const Vec2D<float> &cost_graph, PairGraph &star_graph, int nrows, int ncols,
+                       Vec1D<float> &row_potentials, Vec1D<float> &col_potentials,
+                       const Vec1D<int> &seed_col_for_row)
+{
+  WarmStartProblem problem = {&cost_graph, nrows > ncols, std::min(nrows, ncols), std::max(nrows, ncols)};
+  int n = problem.n;
+  int m = problem.m;
+  Vec1D<float> &u = problem.transposed ? col_potentials : row_potentials;
+  Vec1D<float> &v = problem.transposed ? row_potentials : col_potentials;
+  Vec1D<int> row_match(n, -1), col_match(m, -1);
+  int num_augmentations = 0;
+
+  star_graph.clear();
+  u.resize(n, 0.0f);
+  v.resize(m, 0.0f);
+  if (n == 0)
+    return 0;
+
+  /* Seeded pairs, in the orientation of the problem */
+  for (int r = 0; r < nrows; r++)
+  {
+    int c = r < (int)seed_col_for_row.size() ? seed_col_for_row[r] : -1;
+    if (c < 0 || c >= ncols)
+      continue;
+    int i = problem.transposed ? c : r;
+    int j = problem.transposed ? r : c;
+    if (row_match[i] < 0 && col_match[j] < 0)
+    {
+      row_match[i] = j;
+      col_match[j] = i;
+    }
+  }
+
+  /* Make the seeds dual feasible. With more columns than rows, a column may
+     only have a negative potential while it is matched. Each row then takes
+     the largest potential its reduced costs allow, and seeded pairs that are
+     not tight anymore are dropped, until nothing changes. */
+  for (int j = 0; j < m; j++)
+    v[j] = std::min(v[j], 0.0f);
+
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int j = 0; j < m; j++)
+    {
+      if (col_match[j] < 0)
+        v[j] = 0.0f;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      float min = problem.cost(i, 0) - v[0];
+      for (int j = 1; j < m; j++)
+        min = std::min(min, problem.cost(i, j) - v[j]);
+      u[i] = min;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      int j = row_match[i];
+      if (j >= 0 && (problem.cost(i, j) - v[j]) - u[i] > 0.0f)
+      {
+        row_match[i] = -1;
+        col_match[j] = -1;
+        changed = true;
+      }
+    }
+  }
+
+  /* Shortest augmenting path from each free row, keeping the reduced costs non-negative */
+  Vec1D<float> min_slack(m);
+  Vec1D<int> way(m);
+  Vec1D<char> used(m);
+
+  for (int r = 0; r < n; r++)
+  {
+    if (row_match[r] >= 0)
+      continue;
+
+    std::fill(min_slack.begin(), min_slack.end(), INFINITY);
+    std::fill(way.begin(), way.end(), -1);
+    std::fill(used.begin(), used.end(), 0);
+
+    int i = r;
+    int j_cur = -1;
+    for (;;)
+    {
+      float delta = INFINITY;
+      int j_next = -1;
+
+      for (int j = 0; j < m; j++)
+      {
+        if (used[j])
+          continue;
+        float slack = (problem.cost(i, j) - v[j]) - u[i];
+        if (slack < min_slack[j])
+        {
+          min_slack[j] = slack;
+          way[j] = j_cur;
+        }
+        if (min_slack[j] < delta)
+        {
+          delta = min_slack[j];
+          j_next = j;
+        }
+      }
+
+      u[r] += delta;
+      for (int j = 0; j < m; j++)
+      {
+        if (used[j])
+        {
+          u[col_match[j]] += delta;
+          v[j] -= delta;
+        }
+        else
+        {
+          min_slack[j] -= delta;
+        }
+      }
+
+      used[j_next] = 1;
+      j_cur = j_next;
+      i = col_match[j_cur];
+      if (i < 0)
+        break;
+    }
+
+    /* Flip the path back to the free row */
+    while (j_cur >= 0)
+    {
+      int j_prev = way[j_cur];
+      int i_new = j_prev >= 0 ? col_match[j_prev] : r;
+      col_match[j_cur] = i_new;
+      row_match[i_new] = j_cur;
+      j_cur = j_prev;
+    }
+    num_augmentations++;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    if (problem.transposed)
+      star_graph.set(row_match[i], i);
+    else
+      star_graph.set(i, row_match[i]);
+  }
+  return num_augmentations;
+}
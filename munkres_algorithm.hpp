@@ -28,3 +28,18 @@ void munkresStep5(Vec2D<float> &cost_graph, const CoverTable &cover_table,
 
 void munkres_algorithm(Vec2D<float> &cost_graph, PairGraph &star_graph, int nrows,
               int ncols);
+
+/**
+ * Solves the same problem as 'munkres_algorithm' with shortest augmenting
+ * paths, starting from a previous solution instead of from scratch.
+ * 'row_potentials' and 'col_potentials' hold the dual variables of the
+ * previous solution mapped onto the current rows and columns, 0 where
+ * unknown, and 'seed_col_for_row' its matching, -1 where unknown. Seeds
+ * that are not optimal anymore are dropped, so the result has the optimal
+ * cost whatever the seeds; only the number of augmentations depends on
+ * them. The potentials are replaced by those of the new solution.
+ * 'cost_graph' is not modified. Returns the number of augmentations.
+ */
+int munkres_warm_start(const Vec2D<float> &cost_graph, PairGraph &star_graph, int nrows, int ncols,
+                       Vec1D<float> &row_potentials, Vec1D<float> &col_potentials,
+                       const Vec1D<int> &seed_col_for_row);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include <algorithm>
+
+/* Frames over which the high-water mark is taken before the capacity may shrink */
+#define PEAK_CAPACITY_WINDOW_FRAMES 300
+
+/* Candidates per part kept above the high-water mark when shrinking */
+#define PEAK_CAPACITY_HEADROOM 2
+
+/**
+ * Number of candidates per body part of one stream, the max_num_parts of
+ * its post-processing, which sizes the peak buffers and the assignment
+ * matrices. A part found at capacity may have lost peaks, so such a frame
+ * counts as saturated and the capacity doubles, up to a hard limit. Once a
+ * whole window of frames stayed below capacity, it shrinks to the
+ * high-water mark of the window plus some headroom, by at most half per
+ * window, so a crowd passing by does not make it oscillate.
+ */
+class PeakCapacity
+{
+public:
+  PeakCapacity() : num_saturated(0), num_grows(0), num_shrinks(0), capacity(1), limit(1),
+                   fixed(true), high_water(0), window_frames(0)
+  {
+  }
+
+  /**
+   * Starts over from 'initial' candidates per part, growing up to 'limit'.
+   * A limit not above 'initial' keeps the capacity fixed. The counters are
+   * kept.
+   */
+  inline void reset(int initial, int max_capacity)
+  {
+    capacity = std::max(1, initial);
+    limit = std::max(capacity, max_capacity);
+    fixed = limit == capacity;
+    high_water = 0;
+    window_frames = 0;
+  }
+
+  inline int get() const
+  {
+    return capacity;
+  }
+
+  inline int getLimit() const
+  {
+    return limit;
+  }
+
+  /**
+   * Feeds the number of peaks of each part in the last frame, searched
+   * with the current capacity. Returns true when the capacity changed.
+   */
+  bool update(const Vec1D<int> &counts)
+  {
+    int count = counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+
+    if (count >= capacity)
+    {
+      num_saturated++;
+      high_water = 0;
+      window_frames = 0;
+      if (capacity < limit)
+      {
+        capacity = std::min(limit, capacity * 2);
+        num_grows++;
+        return true;
+      }
+      return false;
+    }
+
+    high_water = std::max(high_water, count);
+    if (fixed || ++window_frames < PEAK_CAPACITY_WINDOW_FRAMES)
+    {
+      return false;
+    }
+
+    int target = std::max(high_water + PEAK_CAPACITY_HEADROOM, capacity / 2);
+    high_water = 0;
+    window_frames = 0;
+    if (target < capacity)
+    {
+      capacity = target;
+      num_shrinks++;
+      return true;
+    }
+    return false;
+  }
+
+  /* Frames with a part at capacity, including those at the limit */
+  guint64 num_saturated;
+  guint64 num_grows;
+  guint64 num_shrinks;
+
+private:
+  int capacity;
+  int limit;
+  /* Neither grows nor shrinks, set when the limit is not above the initial capacity */
+  bool fixed;
+  int high_water;
+  int window_frames;
+};
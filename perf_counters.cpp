@@ -0,0 +1,149 @@
+#include "perf_counters.hpp"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const gchar *perf_stage_names[PERF_NUM_STAGES] = {
+    "find_peaks", "refine_peaks", "paf_score_graph", "assignment", "connect_parts",
+};
+
+static const guint64 perf_counter_configs[PERF_NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/* Counter group of a thread. The group is read in one call, its values come in the order the counters were opened. */
+struct ThreadCounters
+{
+  gboolean opened;
+  int leader;
+  int num_open;
+  int counters[PERF_NUM_COUNTERS];
+};
+
+static __thread ThreadCounters thread_counters;
+
+/* Set once the failure to open the counters was reported */
+static volatile gint unavailable_reported = 0;
+
+static int
+open_counter(guint64 config, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  /* User space only, which the default perf_event_paranoid level allows */
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  /* A pinned group is never multiplexed, it goes into an error state instead */
+  attr.pinned = group_fd < 0;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void
+open_thread_counters(ThreadCounters *tc)
+{
+  int error = 0;
+
+  tc->opened = TRUE;
+  tc->leader = -1;
+  tc->num_open = 0;
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++)
+  {
+    int fd = open_counter(perf_counter_configs[c], tc->leader);
+    if (fd < 0)
+    {
+      error = errno;
+      continue;
+    }
+    if (tc->leader < 0)
+      tc->leader = fd;
+    tc->counters[tc->num_open++] = c;
+  }
+
+  if (tc->leader < 0 && g_atomic_int_compare_and_exchange(&unavailable_reported, 0, 1))
+  {
+    /* ENOENT usually means a virtual machine without a PMU */
+    g_printerr("Hardware counters unavailable: %s%s\n", strerror(error),
+               error == EACCES || error == EPERM ? ", see /proc/sys/kernel/perf_event_paranoid" : "");
+  }
+}
+
+gboolean
+perf_counters_read(PerfCounts *counts)
+{
+  ThreadCounters *tc = &thread_counters;
+  guint64 buffer[1 + PERF_NUM_COUNTERS];
+
+  memset(counts, 0, sizeof(*counts));
+  if (!tc->opened)
+    open_thread_counters(tc);
+  if (tc->leader < 0)
+    return FALSE;
+
+  /* {nr, values...}, nothing is read while the pinned group is in an error state */
+  ssize_t length = read(tc->leader, buffer, sizeof(guint64) * (1 + tc->num_open));
+  if (length < (ssize_t)(sizeof(guint64) * (1 + tc->num_open)))
+    return FALSE;
+  for (int i = 0; i < tc->num_open; i++)
+    counts->values[tc->counters[i]] = buffer[1 + i];
+  return TRUE;
+}
+
+gboolean
+perf_counters_available(void)
+{
+  PerfCounts counts;
+
+  return perf_counters_read(&counts);
+}
+
+void
+perf_counts_add_since(PerfCounts *total, const PerfCounts *start)
+{
+  PerfCounts now;
+
+  if (!perf_counters_read(&now))
+    return;
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++)
+    __atomic_fetch_add(&total->values[c], now.values[c] - start->values[c], __ATOMIC_RELAXED);
+}
+
+void
+perf_stage_counts_add(PerfStageCounts *total, const PerfStageCounts *stages)
+{
+  for (int s = 0; s < PERF_NUM_STAGES; s++)
+  {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++)
+      total->stages[s].values[c] += stages->stages[s].values[c];
+  }
+}
+
+void
+perf_stage_counts_print(const gchar *prefix, const PerfStageCounts *stages, guint64 num_frames)
+{
+  for (int s = 0; s < PERF_NUM_STAGES; s++)
+  {
+    const guint64 *values = stages->stages[s].values;
+    double n = num_frames ? (double)num_frames : 1.0;
+    double kilo_instructions = values[PERF_INSTRUCTIONS] / 1000.0;
+
+    g_print("%s%-16s %10.0f cycles %10.0f instructions %5.2f IPC %8.0f cache misses %6.2f MPKI"
+            " %8.0f branch misses %6.2f MPKI\n",
+            prefix, perf_stage_names[s], values[PERF_CYCLES] / n, values[PERF_INSTRUCTIONS] / n,
+            values[PERF_CYCLES] ? (double)values[PERF_INSTRUCTIONS] / values[PERF_CYCLES] : 0.0,
+            values[PERF_CACHE_MISSES] / n,
+            kilo_instructions > 0.0 ? values[PERF_CACHE_MISSES] / kilo_instructions : 0.0,
+            values[PERF_BRANCH_MISSES] / n,
+            kilo_instructions > 0.0 ? values[PERF_BRANCH_MISSES] / kilo_instructions : 0.0);
+  }
+}
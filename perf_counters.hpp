@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Hardware performance counters of the calling thread, read with Linux
+ * perf_event. Each thread that runs a post-processing stage opens its own
+ * group of counters on first use, counting the user-space events of that
+ * thread only, on whatever CPU it runs. The counters of a group are
+ * scheduled together, so the ratios between them are exact. Counters the
+ * CPU or the virtual machine does not offer read as 0, and when none can
+ * be opened, for instance because of /proc/sys/kernel/perf_event_paranoid,
+ * the reason is printed once.
+ */
+
+enum PerfCounter
+{
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  /* Last level cache misses */
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_NUM_COUNTERS,
+};
+
+struct PerfCounts
+{
+  guint64 values[PERF_NUM_COUNTERS];
+};
+
+/* Post-processing stages, as in PostProcessTimings */
+enum PerfStage
+{
+  PERF_STAGE_FIND_PEAKS,
+  PERF_STAGE_REFINE_PEAKS,
+  PERF_STAGE_PAF_SCORE_GRAPH,
+  PERF_STAGE_ASSIGNMENT,
+  PERF_STAGE_CONNECT_PARTS,
+  PERF_NUM_STAGES,
+};
+
+struct PerfStageCounts
+{
+  PerfCounts stages[PERF_NUM_STAGES];
+};
+
+/* Names of the stages, in PerfStage order */
+extern const gchar *perf_stage_names[PERF_NUM_STAGES];
+
+/* Reads the counters of the calling thread into 'counts'. Returns FALSE, with zeros, when none is available. */
+gboolean perf_counters_read(PerfCounts *counts);
+
+/* Whether the counters can be read in this process, opening those of the calling thread */
+gboolean perf_counters_available(void);
+
+/* Adds the events of the calling thread since 'start' was read to 'total', which other threads may update too */
+void perf_counts_add_since(PerfCounts *total, const PerfCounts *start);
+
+void perf_stage_counts_add(PerfStageCounts *total, const PerfStageCounts *stages);
+
+/* Prints one line per stage: the events per frame, the instructions per cycle and the misses per kilo-instruction */
+void perf_stage_counts_print(const gchar *prefix, const PerfStageCounts *stages, guint64 num_frames);
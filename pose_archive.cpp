@@ -0,0 +1,604 @@
+#include "pose_archive.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+
+/* Quantization steps of the normalized coordinates and of the scores */
+#define COORD_STEPS 65535.0f
+#define SCORE_STEPS 255.0f
+
+static void
+put_varint(Vec1D<guint8> &out, guint64 v)
+{
+  while (v >= 0x80)
+  {
+    out.push_back((guint8)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((guint8)v);
+}
+
+static void
+put_zigzag(Vec1D<guint8> &out, gint64 v)
+{
+  put_varint(out, ((guint64)v << 1) ^ (guint64)(v >> 63));
+}
+
+/* Sequential reader of one column, 'ok' turns false on a truncated column */
+struct ColumnReader
+{
+  const guint8 *p;
+  const guint8 *end;
+  bool ok;
+
+  guint64 varint()
+  {
+    guint64 v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (p >= end)
+      {
+        ok = false;
+        return 0;
+      }
+      guint8 b = *p++;
+      v |= (guint64)(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return v;
+    }
+    ok = false;
+    return v;
+  }
+
+  gint64 zigzag()
+  {
+    guint64 v = varint();
+    return (gint64)(v >> 1) ^ -(gint64)(v & 1);
+  }
+
+  guint8 byte()
+  {
+    if (p >= end)
+    {
+      ok = false;
+      return 0;
+    }
+    return *p++;
+  }
+};
+
+static inline int
+quantize_coord(float v)
+{
+  return (int)(std::min(std::max(v, 0.0f), 1.0f) * COORD_STEPS + 0.5f);
+}
+
+static inline int
+quantize_score(float v)
+{
+  return (int)(std::min(std::max(v, 0.0f), 1.0f) * SCORE_STEPS + 0.5f);
+}
+
+/* Coordinates of the person a keypoint delta refers to: the same track, else the same index in the previous frame */
+static const Vec1D<int> *
+reference_person(guint64 id, unsigned int n, std::map<guint64, Vec1D<int>> &last_by_id,
+                 const Vec2D<int> &previous_frame)
+{
+  if (id != 0)
+  {
+    auto it = last_by_id.find(id);
+    if (it != last_by_id.end())
+      return &it->second;
+  }
+  return n < previous_frame.size() ? &previous_frame[n] : NULL;
+}
+
+/* Opens 'path' for appending, writing 'magic' to a new file or checking it in an existing one */
+static FILE *
+open_for_append(const gchar *path, guint32 magic)
+{
+  FILE *file = fopen(path, "a+b");
+  if (!file)
+  {
+    g_printerr("Failed to open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  PoseArchiveFileHeader header;
+  fseek(file, 0, SEEK_END);
+  if (ftell(file) == 0)
+  {
+    header.magic = magic;
+    header.version = POSE_ARCHIVE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+    fflush(file);
+    return file;
+  }
+
+  fseek(file, 0, SEEK_SET);
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != magic ||
+      header.version != POSE_ARCHIVE_VERSION)
+  {
+    g_printerr("%s is not a pose archive of version %d\n", path, POSE_ARCHIVE_VERSION);
+    fclose(file);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  return file;
+}
+
+/* Pushed by 'close' to stop the writer thread */
+static ArchivedFrame stop_marker;
+
+bool PoseArchiveWriter::open(const gchar *path)
+{
+  gchar *index_path = g_strconcat(path, ".idx", NULL);
+
+  data = open_for_append(path, POSE_ARCHIVE_MAGIC);
+  index = data ? open_for_append(index_path, POSE_ARCHIVE_INDEX_MAGIC) : NULL;
+  g_free(index_path);
+  if (!index)
+  {
+    close();
+    return false;
+  }
+  queue = g_async_queue_new();
+  thread = g_thread_new("pose-archive", writerThread, this);
+  return true;
+}
+
+void PoseArchiveWriter::add(guint stream_id, gint64 frame_num, guint64 pts, guint width, guint height,
+                            const PoseResult &result)
+{
+  if (g_atomic_int_get(&num_queued) >= POSE_ARCHIVE_MAX_QUEUED)
+  {
+    g_atomic_int_inc(&num_dropped);
+    return;
+  }
+
+  ArchivedFrame *frame = new ArchivedFrame;
+  frame->stream_id = stream_id;
+  frame->flags = (result.predicted ? POSE_ARCHIVE_PREDICTED : 0) |
+                 (result.mode != OUTPUT_SKELETONS ? POSE_ARCHIVE_NO_SKELETONS : 0);
+  frame->frame_num = frame_num;
+  frame->pts = pts;
+  frame->timestamp_us = 0;
+  frame->width = width;
+  frame->height = height;
+  frame->count = MAX(result.count, 0);
+  frame->ids.assign(result.objects.size(), 0);
+  frame->keypoints.resize(result.objects.size());
+  for (unsigned int n = 0; n < result.objects.size(); n++)
+  {
+    const Vec1D<int> &object = result.objects[n];
+    if (n < result.ids.size())
+      frame->ids[n] = result.ids[n];
+    frame->keypoints[n].assign(object.size(), Vec1D<float>(3, -1.0f));
+    for (unsigned int c = 0; c < object.size(); c++)
+    {
+      int k = object[c];
+      if (k < 0)
+        continue;
+      frame->keypoints[n][c][0] = result.peaks[c][k][1];
+      frame->keypoints[n][c][1] = result.peaks[c][k][0];
+      frame->keypoints[n][c][2] = result.scores.empty() ? 0.0f : result.scores[c][k];
+    }
+  }
+  g_atomic_int_inc(&num_queued);
+  g_async_queue_push(queue, frame);
+}
+
+gint64 PoseArchiveWriter::frameTime(guint stream_id, guint64 pts)
+{
+  if (pts == G_MAXUINT64)
+    return g_get_real_time();
+
+  /* The first frame of a stream, or a PTS going back after a seek, anchors the PTS to the wall clock.
+   * A new anchor never goes back before the last frame, so the chunks of a stream do not overlap. */
+  gint64 pts_us = (gint64)(pts / 1000);
+  bool anchored = pts_origins.count(stream_id) != 0;
+  std::pair<gint64, gint64> &origin = pts_origins[stream_id];
+  if (!anchored)
+    origin.first = g_get_real_time() - pts_us;
+  else if (pts_us < origin.second)
+    origin.first = std::max(g_get_real_time() - pts_us, origin.first + origin.second + 1 - pts_us);
+  origin.second = pts_us;
+  return origin.first + pts_us;
+}
+
+void PoseArchiveWriter::append(ArchivedFrame &frame)
+{
+  PendingChunk &chunk = pending[frame.stream_id];
+
+  frame.timestamp_us = frameTime(frame.stream_id, frame.pts);
+  if (!chunk.frames.empty() &&
+      (frame.timestamp_us - chunk.header.t_start >= POSE_ARCHIVE_CHUNK_US ||
+       chunk.frames.size() >= POSE_ARCHIVE_MAX_CHUNK_FRAMES ||
+       frame.width != chunk.header.width || frame.height != chunk.header.height))
+  {
+    writeChunk(chunk);
+  }
+
+  if (chunk.frames.empty())
+  {
+    memset(&chunk.header, 0, sizeof(chunk.header));
+    chunk.header.magic = POSE_ARCHIVE_CHUNK_MAGIC;
+    chunk.header.stream_id = frame.stream_id;
+    chunk.header.width = frame.width;
+    chunk.header.height = frame.height;
+    chunk.header.t_start = frame.timestamp_us;
+    chunk.header.first_frame_num = frame.frame_num;
+  }
+
+  for (auto &person : frame.keypoints)
+    chunk.header.num_keypoints = std::max(chunk.header.num_keypoints, (guint32)person.size());
+  chunk.header.num_persons += frame.keypoints.size();
+  chunk.header.num_frames++;
+  chunk.header.t_end = frame.timestamp_us;
+  chunk.frames.push_back(std::move(frame));
+}
+
+/* Encodes and writes the queued frames, the pending chunks of all streams once the queue is empty */
+gpointer PoseArchiveWriter::writerThread(gpointer data)
+{
+  PoseArchiveWriter *writer = (PoseArchiveWriter *)data;
+  gboolean running = TRUE;
+
+  while (running)
+  {
+    ArchivedFrame *frame = (ArchivedFrame *)g_async_queue_pop(writer->queue);
+    while (frame)
+    {
+      if (frame == &stop_marker)
+      {
+        running = FALSE;
+        break;
+      }
+      writer->append(*frame);
+      delete frame;
+      g_atomic_int_add(&writer->num_queued, -1);
+      frame = (ArchivedFrame *)g_async_queue_try_pop(writer->queue);
+    }
+  }
+  writer->flush();
+  return NULL;
+}
+
+void PoseArchiveWriter::writeChunk(PendingChunk &chunk)
+{
+  PoseArchiveChunkHeader &header = chunk.header;
+  int C = header.num_keypoints;
+  Vec1D<guint8> columns[POSE_NUM_COLUMNS];
+  std::map<guint64, Vec1D<int>> last_by_id;
+  Vec2D<int> previous_frame, current_frame;
+  gint64 prev_time = header.t_start;
+  gint64 prev_frame_num = header.first_frame_num;
+  gint64 prev_pts = 0;
+
+  for (auto &frame : chunk.frames)
+  {
+    put_zigzag(columns[POSE_COLUMN_TIME], frame.timestamp_us - prev_time);
+    put_zigzag(columns[POSE_COLUMN_FRAME_NUM], frame.frame_num - prev_frame_num);
+    put_zigzag(columns[POSE_COLUMN_PTS], (gint64)frame.pts - prev_pts);
+    columns[POSE_COLUMN_FRAME_FLAGS].push_back((guint8)frame.flags);
+    put_varint(columns[POSE_COLUMN_NUM_PERSONS], frame.keypoints.size());
+    put_varint(columns[POSE_COLUMN_COUNT], frame.count);
+    prev_time = frame.timestamp_us;
+    prev_frame_num = frame.frame_num;
+    prev_pts = (gint64)frame.pts;
+
+    current_frame.assign(frame.keypoints.size(), Vec1D<int>(2 * C, -1));
+    for (unsigned int n = 0; n < frame.keypoints.size(); n++)
+    {
+      Vec2D<float> &person = frame.keypoints[n];
+      Vec1D<int> &q = current_frame[n];
+      guint64 id = frame.ids[n];
+      const Vec1D<int> *ref = reference_person(id, n, last_by_id, previous_frame);
+      guint64 mask = 0;
+
+      for (unsigned int c = 0; c < person.size(); c++)
+      {
+        if (person[c][0] < 0.0f)
+          continue;
+        mask |= (guint64)1 << c;
+        q[2 * c] = quantize_coord(person[c][0]);
+        q[2 * c + 1] = quantize_coord(person[c][1]);
+      }
+      put_varint(columns[POSE_COLUMN_TRACK_ID], id);
+      put_varint(columns[POSE_COLUMN_KEYPOINT_MASK], mask);
+      for (int c = 0; c < C; c++)
+      {
+        if (!(mask & ((guint64)1 << c)))
+          continue;
+        int rx = (ref && (*ref)[2 * c] >= 0) ? (*ref)[2 * c] : 0;
+        int ry = (ref && (*ref)[2 * c + 1] >= 0) ? (*ref)[2 * c + 1] : 0;
+        put_zigzag(columns[POSE_COLUMN_KEYPOINTS], q[2 * c] - rx);
+        put_zigzag(columns[POSE_COLUMN_KEYPOINTS], q[2 * c + 1] - ry);
+        columns[POSE_COLUMN_SCORES].push_back((guint8)quantize_score(person[c][2]));
+      }
+      if (id != 0)
+        last_by_id[id] = q;
+    }
+    previous_frame.swap(current_frame);
+  }
+
+  PoseArchiveIndexEntry entry;
+  entry.stream_id = header.stream_id;
+  entry.num_frames = header.num_frames;
+  entry.t_start = header.t_start;
+  entry.t_end = header.t_end;
+  entry.offset = ftell(data);
+  entry.size = sizeof(header);
+  for (int i = 0; i < POSE_NUM_COLUMNS; i++)
+  {
+    header.column_size[i] = columns[i].size();
+    entry.size += columns[i].size();
+  }
+
+  /* The chunk goes first, an index entry never points past the end of the data file */
+  fwrite(&header, sizeof(header), 1, data);
+  for (int i = 0; i < POSE_NUM_COLUMNS; i++)
+    fwrite(columns[i].data(), 1, columns[i].size(), data);
+  if (fflush(data) != 0 || fwrite(&entry, sizeof(entry), 1, index) != 1 || fflush(index) != 0)
+    g_printerr("Pose archive write failed: %s\n", strerror(errno));
+
+  __atomic_add_fetch(&num_chunks, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&num_bytes, entry.size + sizeof(entry), __ATOMIC_RELAXED);
+  chunk.frames.clear();
+}
+
+void PoseArchiveWriter::flush()
+{
+  for (auto &entry : pending)
+  {
+    if (!entry.second.frames.empty())
+      writeChunk(entry.second);
+  }
+}
+
+void PoseArchiveWriter::close()
+{
+  if (thread)
+  {
+    g_async_queue_push(queue, &stop_marker);
+    g_thread_join(thread);
+    g_async_queue_unref(queue);
+  }
+  thread = NULL;
+  queue = NULL;
+  if (data)
+    fclose(data);
+  if (index)
+    fclose(index);
+  data = NULL;
+  index = NULL;
+  pending.clear();
+  pts_origins.clear();
+}
+
+/* Maps 'path' read-only, returns NULL and leaves 'size' at 0 for an empty or missing file */
+static const guint8 *
+map_file(const gchar *path, gsize &size)
+{
+  struct stat st;
+  size = 0;
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+  {
+    if (fd < 0)
+      g_printerr("Failed to open %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      ::close(fd);
+    return NULL;
+  }
+
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+  {
+    g_printerr("Failed to map %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  size = st.st_size;
+  return (const guint8 *)addr;
+}
+
+static bool
+check_file_header(const guint8 *file, gsize size, guint32 magic)
+{
+  PoseArchiveFileHeader header;
+  if (!file || size < sizeof(header))
+    return false;
+  memcpy(&header, file, sizeof(header));
+  return header.magic == magic && header.version == POSE_ARCHIVE_VERSION;
+}
+
+bool PoseArchiveReader::open(const gchar *path)
+{
+  gchar *index_path = g_strconcat(path, ".idx", NULL);
+
+  close();
+  data = map_file(path, data_size);
+  index = map_file(index_path, index_size);
+  if (!check_file_header(data, data_size, POSE_ARCHIVE_MAGIC) ||
+      !check_file_header(index, index_size, POSE_ARCHIVE_INDEX_MAGIC))
+  {
+    g_printerr("%s is not a pose archive of version %d\n", path, POSE_ARCHIVE_VERSION);
+    g_free(index_path);
+    close();
+    return false;
+  }
+  g_free(index_path);
+
+  /* Entries of a partially written chunk are dropped */
+  gsize num_entries = (index_size - sizeof(PoseArchiveFileHeader)) / sizeof(PoseArchiveIndexEntry);
+  for (gsize i = 0; i < num_entries; i++)
+  {
+    PoseArchiveIndexEntry entry;
+    memcpy(&entry, index + sizeof(PoseArchiveFileHeader) + i * sizeof(entry), sizeof(entry));
+    if (entry.offset < sizeof(PoseArchiveFileHeader) || entry.offset + entry.size > data_size)
+      continue;
+    entries[entry.stream_id].push_back(entry);
+  }
+  for (auto &stream : entries)
+  {
+    std::stable_sort(stream.second.begin(), stream.second.end(),
+                     [](const PoseArchiveIndexEntry &a, const PoseArchiveIndexEntry &b) {
+                       return a.t_start < b.t_start;
+                     });
+    Vec1D<gint64> &stream_ends = ends[stream.first];
+    gint64 end = G_MININT64;
+    for (const auto &entry : stream.second)
+    {
+      end = std::max(end, entry.t_end);
+      stream_ends.push_back(end);
+    }
+  }
+  return true;
+}
+
+void PoseArchiveReader::close()
+{
+  if (data)
+    munmap((void *)data, data_size);
+  if (index)
+    munmap((void *)index, index_size);
+  data = NULL;
+  index = NULL;
+  data_size = 0;
+  index_size = 0;
+  entries.clear();
+  ends.clear();
+}
+
+bool PoseArchiveReader::decodeChunk(const PoseArchiveIndexEntry &entry, Vec1D<ArchivedFrame> &frames) const
+{
+  PoseArchiveChunkHeader header;
+  ColumnReader columns[POSE_NUM_COLUMNS];
+
+  memcpy(&header, data + entry.offset, sizeof(header));
+  if (header.magic != POSE_ARCHIVE_CHUNK_MAGIC || header.num_keypoints > 64)
+    return false;
+
+  const guint8 *p = data + entry.offset + sizeof(header);
+  const guint8 *end = data + entry.offset + entry.size;
+  for (int i = 0; i < POSE_NUM_COLUMNS; i++)
+  {
+    if (header.column_size[i] > (gsize)(end - p))
+      return false;
+    columns[i].p = p;
+    columns[i].end = p + header.column_size[i];
+    columns[i].ok = true;
+    p += header.column_size[i];
+  }
+
+  int C = header.num_keypoints;
+  std::map<guint64, Vec1D<int>> last_by_id;
+  Vec2D<int> previous_frame, current_frame;
+  gint64 prev_time = header.t_start;
+  gint64 prev_frame_num = header.first_frame_num;
+  gint64 prev_pts = 0;
+
+  for (guint f = 0; f < header.num_frames; f++)
+  {
+    ArchivedFrame frame;
+    frame.stream_id = header.stream_id;
+    frame.width = header.width;
+    frame.height = header.height;
+    frame.timestamp_us = prev_time = prev_time + columns[POSE_COLUMN_TIME].zigzag();
+    frame.frame_num = prev_frame_num = prev_frame_num + columns[POSE_COLUMN_FRAME_NUM].zigzag();
+    prev_pts += columns[POSE_COLUMN_PTS].zigzag();
+    frame.pts = (guint64)prev_pts;
+    frame.flags = columns[POSE_COLUMN_FRAME_FLAGS].byte();
+
+    guint64 num_persons = columns[POSE_COLUMN_NUM_PERSONS].varint();
+    if (num_persons > header.num_persons)
+      return false;
+    frame.count = (guint)columns[POSE_COLUMN_COUNT].varint();
+    frame.ids.assign(num_persons, 0);
+    frame.keypoints.assign(num_persons, Vec2D<float>(C, Vec1D<float>(3, -1.0f)));
+    current_frame.assign(num_persons, Vec1D<int>(2 * C, -1));
+
+    for (unsigned int n = 0; n < num_persons; n++)
+    {
+      guint64 id = columns[POSE_COLUMN_TRACK_ID].varint();
+      guint64 mask = columns[POSE_COLUMN_KEYPOINT_MASK].varint();
+      const Vec1D<int> *ref = reference_person(id, n, last_by_id, previous_frame);
+      Vec1D<int> &q = current_frame[n];
+
+      frame.ids[n] = id;
+      for (int c = 0; c < C; c++)
+      {
+        if (!(mask & ((guint64)1 << c)))
+          continue;
+        int rx = (ref && (*ref)[2 * c] >= 0) ? (*ref)[2 * c] : 0;
+        int ry = (ref && (*ref)[2 * c + 1] >= 0) ? (*ref)[2 * c + 1] : 0;
+        q[2 * c] = rx + (int)columns[POSE_COLUMN_KEYPOINTS].zigzag();
+        q[2 * c + 1] = ry + (int)columns[POSE_COLUMN_KEYPOINTS].zigzag();
+        frame.keypoints[n][c][0] = q[2 * c] / COORD_STEPS;
+        frame.keypoints[n][c][1] = q[2 * c + 1] / COORD_STEPS;
+        frame.keypoints[n][c][2] = columns[POSE_COLUMN_SCORES].byte() / SCORE_STEPS;
+      }
+      if (id != 0)
+        last_by_id[id] = q;
+    }
+    previous_frame.swap(current_frame);
+
+    for (int i = 0; i < POSE_NUM_COLUMNS; i++)
+    {
+      if (!columns[i].ok)
+        return false;
+    }
+    frames.push_back(frame);
+  }
+  return true;
+}
+
+void PoseArchiveReader::query(guint stream_id, gint64 t0, gint64 t1, Vec1D<ArchivedFrame> &frames) const
+{
+  auto stream = entries.find(stream_id);
+  if (stream == entries.end())
+    return;
+
+  /* Chunks of different runs or workers may overlap, so the range starts at the first chunk
+   * after which some chunk ends at t0 or later, and chunks ending before t0 are skipped */
+  const Vec1D<PoseArchiveIndexEntry> &chunks = stream->second;
+  const Vec1D<gint64> &stream_ends = ends.at(stream_id);
+  auto it = chunks.begin() + (std::lower_bound(stream_ends.begin(), stream_ends.end(), t0) - stream_ends.begin());
+
+  gsize first_frame = frames.size();
+  bool sorted = true;
+  Vec1D<ArchivedFrame> chunk_frames;
+  for (; it != chunks.end() && it->t_start <= t1; ++it)
+  {
+    if (it->t_end < t0)
+      continue;
+    chunk_frames.clear();
+    if (!decodeChunk(*it, chunk_frames))
+    {
+      g_printerr("Corrupted pose archive chunk at offset %" G_GUINT64_FORMAT "\n", it->offset);
+      continue;
+    }
+    for (auto &frame : chunk_frames)
+    {
+      if (frame.timestamp_us < t0 || frame.timestamp_us > t1)
+        continue;
+      if (frames.size() > first_frame && frame.timestamp_us < frames.back().timestamp_us)
+        sorted = false;
+      frames.push_back(frame);
+    }
+  }
+  if (!sorted)
+  {
+    std::stable_sort(frames.begin() + first_frame, frames.end(),
+                     [](const ArchivedFrame &a, const ArchivedFrame &b) { return a.timestamp_us < b.timestamp_us; });
+  }
+}
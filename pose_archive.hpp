@@ -0,0 +1,204 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+/*
+ * Append-only archive of the skeletons, without the video.
+ *
+ * The data file is a sequence of chunks, each holding up to one second of
+ * one stream. A chunk stores its frames column by column: timestamps, frame
+ * numbers, PTS, flags, skeleton counts, people counts, track ids, keypoint
+ * masks, keypoint coordinates and scores. The people count is that of the
+ * output mode, so the frames of the count and presence modes keep it
+ * without skeletons. Coordinates are quantized to 16 bits and stored
+ * as zigzag varint deltas to the same track, or to the person with the same
+ * index, in the previous frame. Scores are quantized to 8 bits.
+ *
+ * For each chunk written, a fixed-size entry with its stream, time range and
+ * offset is appended to the index file "<path>.idx". Readers map both files
+ * and decode only the chunks overlapping the requested time range.
+ *
+ * Frame times follow the buffer PTS, anchored to the wall clock at the first
+ * frame of each stream and again whenever the PTS goes back, never before
+ * the last frame of the stream. Chunks of earlier runs or of restarted
+ * workers may still overlap, and readers order their frames by time. The
+ * streaming thread only queues a copy of the skeletons; a writer thread
+ * encodes and writes the chunks.
+ */
+
+#define POSE_ARCHIVE_MAGIC 0x56524150u       /* "PARV" */
+#define POSE_ARCHIVE_INDEX_MAGIC 0x58445050u /* "PPDX" */
+#define POSE_ARCHIVE_CHUNK_MAGIC 0x4b484350u /* "PCHK" */
+#define POSE_ARCHIVE_VERSION 2
+
+/* Length of a chunk in us of stream time */
+#define POSE_ARCHIVE_CHUNK_US 1000000
+
+/* Frames after which a chunk is closed even if it spans less than a second */
+#define POSE_ARCHIVE_MAX_CHUNK_FRAMES 1024
+
+/* Frames waiting for the writer thread above which new frames are dropped */
+#define POSE_ARCHIVE_MAX_QUEUED 4096
+
+/* Columns of a chunk, in file order */
+typedef enum
+{
+  POSE_COLUMN_TIME = 0,
+  POSE_COLUMN_FRAME_NUM,
+  POSE_COLUMN_PTS,
+  POSE_COLUMN_FRAME_FLAGS,
+  POSE_COLUMN_NUM_PERSONS,
+  POSE_COLUMN_COUNT,
+  POSE_COLUMN_TRACK_ID,
+  POSE_COLUMN_KEYPOINT_MASK,
+  POSE_COLUMN_KEYPOINTS,
+  POSE_COLUMN_SCORES,
+  POSE_NUM_COLUMNS
+} PoseArchiveColumn;
+
+/* Flags of an archived frame */
+#define POSE_ARCHIVE_PREDICTED 0x1
+/* The stream was in the keypoints, count or presence output mode, the frame has no skeletons */
+#define POSE_ARCHIVE_NO_SKELETONS 0x2
+
+struct PoseArchiveFileHeader
+{
+  guint32 magic;
+  guint32 version;
+};
+
+struct PoseArchiveChunkHeader
+{
+  guint32 magic;
+  guint32 stream_id;
+  guint32 num_frames;
+  guint32 num_persons;
+  guint32 num_keypoints;
+  guint32 width;
+  guint32 height;
+  guint32 reserved;
+  gint64 t_start;
+  gint64 t_end;
+  gint64 first_frame_num;
+  guint32 column_size[POSE_NUM_COLUMNS];
+};
+
+struct PoseArchiveIndexEntry
+{
+  guint32 stream_id;
+  guint32 num_frames;
+  /* Time of the first and last frame of the chunk, in us since the epoch */
+  gint64 t_start;
+  gint64 t_end;
+  /* Position of the chunk header in the data file and size with its columns */
+  guint64 offset;
+  guint64 size;
+};
+
+/* One decoded frame */
+struct ArchivedFrame
+{
+  guint stream_id;
+  guint flags;
+  gint64 frame_num;
+  guint64 pts;
+  gint64 timestamp_us;
+  guint width;
+  guint height;
+  /* PoseResult::count, the skeletons or the estimate of the output mode */
+  guint count;
+  Vec1D<guint64> ids;
+  /* keypoints[n][c] is {x, y, score}, normalized, x and y negative when missing */
+  Vec3D<float> keypoints;
+};
+
+/* Frames of one stream not written yet */
+struct PendingChunk
+{
+  PoseArchiveChunkHeader header;
+  Vec1D<ArchivedFrame> frames;
+};
+
+class PoseArchiveWriter
+{
+public:
+  PoseArchiveWriter()
+      : num_chunks(0), num_bytes(0), num_queued(0), num_dropped(0), data(NULL), index(NULL), queue(NULL),
+        thread(NULL)
+  {
+  }
+  ~PoseArchiveWriter() { close(); }
+
+  /* Creates or appends to the archive 'path' and its index and starts the writer thread */
+  bool open(const gchar *path);
+
+  /* Queues the skeletons of a frame, dropped when the writer is too far behind */
+  void add(guint stream_id, gint64 frame_num, guint64 pts, guint width, guint height, const PoseResult &result);
+
+  /* Writes the queued frames and the pending chunks of all streams, then closes the files */
+  void close();
+
+  /* Updated by the writer thread, read them atomically */
+  guint64 num_chunks;
+  guint64 num_bytes;
+  volatile gint num_queued;
+  volatile gint num_dropped;
+
+private:
+  static gpointer writerThread(gpointer data);
+
+  /* Time of a frame in us since the epoch, from its PTS */
+  gint64 frameTime(guint stream_id, guint64 pts);
+
+  /* Adds a frame to the chunk of its stream, writes the chunk once it spans a second */
+  void append(ArchivedFrame &frame);
+
+  void flush();
+  void writeChunk(PendingChunk &chunk);
+
+  FILE *data;
+  FILE *index;
+  GAsyncQueue *queue;
+  GThread *thread;
+  /* Owned by the writer thread */
+  std::map<guint, PendingChunk> pending;
+  /* Wall clock time of PTS 0 and the last PTS of each stream, in us */
+  std::map<guint, std::pair<gint64, gint64>> pts_origins;
+};
+
+class PoseArchiveReader
+{
+public:
+  PoseArchiveReader() : data(NULL), data_size(0), index(NULL), index_size(0) {}
+  ~PoseArchiveReader() { close(); }
+
+  /* Maps the archive 'path' and its index */
+  bool open(const gchar *path);
+
+  void close();
+
+  /* Appends the frames of 'stream_id' with t0 <= timestamp <= t1, in us, to 'frames' in time order */
+  void query(guint stream_id, gint64 t0, gint64 t1, Vec1D<ArchivedFrame> &frames) const;
+
+  /* Index entries of each stream, ordered by time */
+  const std::map<guint, Vec1D<PoseArchiveIndexEntry>> &streams() const { return entries; }
+
+private:
+  bool decodeChunk(const PoseArchiveIndexEntry &entry, Vec1D<ArchivedFrame> &frames) const;
+
+  const guint8 *data;
+  gsize data_size;
+  const guint8 *index;
+  gsize index_size;
+  std::map<guint, Vec1D<PoseArchiveIndexEntry>> entries;
+  /* Latest t_end of the entries up to each one, to find overlapping chunks */
+  std::map<guint, Vec1D<gint64>> ends;
+};
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Reads a pose archive written by the application with --archive.
+ *
+ * Usage: pose-archive-query ARCHIVE
+ *          lists the streams and the time range archived for each
+ *        pose-archive-query ARCHIVE STREAM T0 T1
+ *          prints the skeletons of STREAM between T0 and T1, in seconds
+ *          since the epoch
+ */
+
+#include "pose_archive.hpp"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+list_streams(const PoseArchiveReader &reader)
+{
+  for (auto &stream : reader.streams())
+  {
+    const Vec1D<PoseArchiveIndexEntry> &chunks = stream.second;
+    guint64 num_frames = 0;
+    for (auto &chunk : chunks)
+      num_frames += chunk.num_frames;
+    g_print("stream %u: %.3f - %.3f, %zu chunks, %" G_GUINT64_FORMAT " frames\n", stream.first,
+            chunks.front().t_start / 1e6, chunks.back().t_end / 1e6, chunks.size(), num_frames);
+  }
+}
+
+static void
+print_frame(const ArchivedFrame &frame)
+{
+  g_print("%.6f frame %" G_GINT64_FORMAT " pts %" G_GUINT64_FORMAT " %u person(s)%s%s\n",
+          frame.timestamp_us / 1e6, frame.frame_num, frame.pts, frame.count,
+          (frame.flags & POSE_ARCHIVE_NO_SKELETONS) ? " without skeletons" : "",
+          (frame.flags & POSE_ARCHIVE_PREDICTED) ? " predicted" : "");
+
+  for (unsigned int n = 0; n < frame.keypoints.size(); n++)
+  {
+    g_print("  id %" G_GUINT64_FORMAT ":", frame.ids[n]);
+    for (auto &kp : frame.keypoints[n])
+    {
+      if (kp[0] < 0.0f)
+        g_print(" -");
+      else
+        g_print(" (%.0f,%.0f)", kp[0] * frame.width, kp[1] * frame.height);
+    }
+    g_print("\n");
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2 && argc != 5)
+  {
+    g_printerr("Usage: %s ARCHIVE [STREAM T0 T1]\n", argv[0]);
+    return -1;
+  }
+
+  PoseArchiveReader reader;
+  if (!reader.open(argv[1]))
+    return -1;
+
+  if (argc == 2)
+  {
+    list_streams(reader);
+    return 0;
+  }
+
+  guint stream_id = atoi(argv[2]);
+  gint64 t0 = (gint64)(g_ascii_strtod(argv[3], NULL) * 1e6);
+  gint64 t1 = (gint64)(g_ascii_strtod(argv[4], NULL) * 1e6);
+  Vec1D<ArchivedFrame> frames;
+
+  gint64 start = g_get_monotonic_time();
+  reader.query(stream_id, t0, t1, frames);
+  gint64 elapsed = g_get_monotonic_time() - start;
+
+  for (auto &frame : frames)
+    print_frame(frame);
+  g_print("%zu frames in %.3f ms\n", frames.size(), elapsed / 1000.0);
+  return 0;
+}
@@ -0,0 +1,212 @@
+#include "pose_export.hpp"
+
+#include <json-glib/json-glib.h>
+#include <errno.h>
+#include <string.h>
+
+struct PoseExportFrame
+{
+  guint stream_id;
+  gint64 frame_num;
+  guint64 pts;
+  guint width;
+  guint height;
+  PoseResult result;
+};
+
+/* Pushed by 'pose_export_close' to stop the writer thread */
+static PoseExportFrame stop_marker;
+
+/* Appends the JSON line of 'frame' to 'batch' */
+static void
+append_frame_json(JsonBuilder *builder, JsonGenerator *generator, GString *batch,
+                  const PoseExportFrame *frame)
+{
+  const PoseResult &result = frame->result;
+
+  json_builder_reset(builder);
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "source");
+  json_builder_add_int_value(builder, frame->stream_id);
+  json_builder_set_member_name(builder, "frame");
+  json_builder_add_int_value(builder, frame->frame_num);
+  json_builder_set_member_name(builder, "pts");
+  if (frame->pts == G_MAXUINT64)
+    json_builder_add_null_value(builder);
+  else
+    json_builder_add_int_value(builder, frame->pts);
+  json_builder_set_member_name(builder, "width");
+  json_builder_add_int_value(builder, frame->width);
+  json_builder_set_member_name(builder, "height");
+  json_builder_add_int_value(builder, frame->height);
+  json_builder_set_member_name(builder, "predicted");
+  json_builder_add_boolean_value(builder, result.predicted);
+  json_builder_set_member_name(builder, "count");
+  json_builder_add_int_value(builder, result.count);
+
+  /* The keypoints mode has peaks but no skeletons, they are listed per body part */
+  if (result.mode == OUTPUT_KEYPOINTS)
+  {
+    json_builder_set_member_name(builder, "keypoints");
+    json_builder_begin_array(builder);
+    for (unsigned int c = 0; c < result.counts.size(); c++)
+    {
+      json_builder_begin_array(builder);
+      for (int k = 0; k < result.counts[c]; k++)
+      {
+        json_builder_begin_array(builder);
+        json_builder_add_double_value(builder, result.peaks[c][k][1] * frame->width);
+        json_builder_add_double_value(builder, result.peaks[c][k][0] * frame->height);
+        json_builder_add_double_value(builder, result.scores[c][k]);
+        json_builder_end_array(builder);
+      }
+      json_builder_end_array(builder);
+    }
+    json_builder_end_array(builder);
+  }
+
+  json_builder_set_member_name(builder, "persons");
+  json_builder_begin_array(builder);
+  for (unsigned int n = 0; n < result.objects.size(); n++)
+  {
+    const Vec1D<int> &object = result.objects[n];
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "id");
+    json_builder_add_int_value(builder, n < result.ids.size() ? result.ids[n] : 0);
+    json_builder_set_member_name(builder, "keypoints");
+    json_builder_begin_array(builder);
+    for (unsigned int c = 0; c < object.size(); c++)
+    {
+      int k = object[c];
+      if (k < 0)
+      {
+        json_builder_add_null_value(builder);
+        continue;
+      }
+      json_builder_begin_array(builder);
+      json_builder_add_double_value(builder, result.peaks[c][k][1] * frame->width);
+      json_builder_add_double_value(builder, result.peaks[c][k][0] * frame->height);
+      json_builder_add_double_value(builder, result.scores.empty() ? 0.0 : result.scores[c][k]);
+      json_builder_end_array(builder);
+    }
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+  }
+  json_builder_end_array(builder);
+  json_builder_end_object(builder);
+
+  JsonNode *root = json_builder_get_root(builder);
+  gsize length;
+  json_generator_set_root(generator, root);
+  gchar *line = json_generator_to_data(generator, &length);
+  g_string_append_len(batch, line, length);
+  g_string_append_c(batch, '\n');
+  g_free(line);
+  json_node_unref(root);
+}
+
+static void
+flush_batch(PoseExporter *exporter, GString *batch)
+{
+  if (batch->len == 0)
+    return;
+
+  if (fwrite(batch->str, 1, batch->len, exporter->file) != batch->len || fflush(exporter->file) != 0)
+    g_printerr("Pose export write failed: %s\n", strerror(errno));
+  __atomic_add_fetch(&exporter->num_bytes, batch->len, __ATOMIC_RELAXED);
+  g_string_truncate(batch, 0);
+}
+
+/* Serializes and writes the queued frames, one batch per wakeup */
+static gpointer
+export_thread(gpointer data)
+{
+  PoseExporter *exporter = (PoseExporter *)data;
+  JsonBuilder *builder = json_builder_new();
+  JsonGenerator *generator = json_generator_new();
+  GString *batch = g_string_sized_new(POSE_EXPORT_BATCH_BYTES);
+  gboolean running = TRUE;
+
+  while (running)
+  {
+    PoseExportFrame *frame = (PoseExportFrame *)g_async_queue_pop(exporter->queue);
+    while (frame)
+    {
+      if (frame == &stop_marker)
+      {
+        running = FALSE;
+        break;
+      }
+      append_frame_json(builder, generator, batch, frame);
+      delete frame;
+      g_atomic_int_add(&exporter->num_queued, -1);
+      g_atomic_int_inc(&exporter->num_written);
+      if (batch->len >= POSE_EXPORT_BATCH_BYTES)
+        flush_batch(exporter, batch);
+      frame = (PoseExportFrame *)g_async_queue_try_pop(exporter->queue);
+    }
+    flush_batch(exporter, batch);
+  }
+
+  g_string_free(batch, TRUE);
+  g_object_unref(generator);
+  g_object_unref(builder);
+  return NULL;
+}
+
+PoseExporter *
+pose_export_open(const gchar *path)
+{
+  gboolean is_stdout = g_strcmp0(path, "-") == 0;
+  FILE *file = is_stdout ? stdout : fopen(path, "w");
+  if (!file)
+  {
+    g_printerr("Failed to open %s for export: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  PoseExporter *exporter = g_new0(PoseExporter, 1);
+  exporter->file = file;
+  exporter->close_file = !is_stdout;
+  exporter->queue = g_async_queue_new();
+  exporter->thread = g_thread_new("pose-export", export_thread, exporter);
+  return exporter;
+}
+
+gboolean
+pose_export_push(PoseExporter *exporter, guint stream_id, gint64 frame_num, guint64 pts,
+                 guint width, guint height, const PoseResult &result)
+{
+  if (g_atomic_int_get(&exporter->num_queued) >= POSE_EXPORT_MAX_QUEUED)
+  {
+    g_atomic_int_inc(&exporter->num_dropped);
+    return FALSE;
+  }
+
+  PoseExportFrame *frame = new PoseExportFrame;
+  frame->stream_id = stream_id;
+  frame->frame_num = frame_num;
+  frame->pts = pts;
+  frame->width = width;
+  frame->height = height;
+  frame->result = result;
+  g_atomic_int_inc(&exporter->num_queued);
+  g_async_queue_push(exporter->queue, frame);
+  return TRUE;
+}
+
+void
+pose_export_close(PoseExporter *exporter)
+{
+  if (!exporter)
+    return;
+
+  g_async_queue_push(exporter->queue, &stop_marker);
+  g_thread_join(exporter->thread);
+  g_async_queue_unref(exporter->queue);
+  if (exporter->close_file)
+    fclose(exporter->file);
+  else
+    fflush(exporter->file);
+  g_free(exporter);
+}
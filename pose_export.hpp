@@ -0,0 +1,48 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include <glib.h>
+#include <stdio.h>
+
+/* Frames waiting for the writer thread above which new frames are dropped */
+#define POSE_EXPORT_MAX_QUEUED 4096
+
+/* Size of the output buffer, a batch is written once it is full or the queue is empty */
+#define POSE_EXPORT_BATCH_BYTES (256 * 1024)
+
+/**
+ * JSON Lines export of the skeletons, one object per frame:
+ *
+ *   {"source":0,"frame":42,"pts":1400000000,"width":1920,"height":1080,
+ *    "predicted":false,"count":1,"persons":[{"id":3,"keypoints":[[x,y,score],null,...]}]}
+ *
+ * Keypoints are in pixels of the source frame, missing ones are null and
+ * "id" is 0 when tracking is off. "pts" is null when the buffer has no
+ * timestamp. "count" is PoseResult::count. In the
+ * keypoints output mode, "keypoints" lists the [x,y,score] peaks of each
+ * body part and "persons" is empty. The streaming thread only copies the
+ * result into a queue; a writer thread serializes the frames with json-glib
+ * and writes them in batches, so the pipeline never waits for the disk.
+ */
+struct PoseExporter
+{
+  FILE *file;
+  gboolean close_file;
+  GAsyncQueue *queue;
+  GThread *thread;
+  volatile gint num_queued;
+  volatile gint num_dropped;
+  volatile gint num_written;
+  guint64 num_bytes;
+};
+
+/* Opens 'path' for export, "-" is the standard output */
+PoseExporter *pose_export_open(const gchar *path);
+
+/* Queues the skeletons of a frame, returns FALSE when the writer is too far behind and the frame was dropped */
+gboolean pose_export_push(PoseExporter *exporter, guint stream_id, gint64 frame_num, guint64 pts,
+                          guint width, guint height, const PoseResult &result);
+
+/* Writes the queued frames and closes the output */
+void pose_export_close(PoseExporter *exporter);
@@ -0,0 +1,202 @@
+#include "pose_index.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* shm_open wants a name starting with a single slash */
+static gchar *
+shm_object_name(const gchar *name)
+{
+  return name[0] == '/' ? g_strdup(name) : g_strconcat("/", name, NULL);
+}
+
+static PoseIndex *
+map_index(const gchar *name, int fd, gsize size, gboolean writable, gboolean owner)
+{
+  void *addr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+  {
+    g_printerr("Failed to map the pose index %s: %s\n", name, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  PoseIndex *index = g_new0(PoseIndex, 1);
+  index->name = g_strdup(name);
+  index->fd = fd;
+  index->size = size;
+  index->header = (PoseIndexHeader *)addr;
+  index->entries = (PoseIndexEntry *)((guint8 *)addr + sizeof(PoseIndexHeader));
+  index->owner = owner;
+  return index;
+}
+
+PoseIndex *
+pose_index_create(const gchar *name, guint num_sources)
+{
+  gchar *shm_name = shm_object_name(name);
+  gsize size = sizeof(PoseIndexHeader) + (gsize)num_sources * sizeof(PoseIndexEntry);
+
+  shm_unlink(shm_name);
+  int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 || ftruncate(fd, size) < 0)
+  {
+    g_printerr("Failed to create the pose index %s: %s\n", shm_name, strerror(errno));
+    if (fd >= 0)
+    {
+      close(fd);
+      shm_unlink(shm_name);
+    }
+    g_free(shm_name);
+    return NULL;
+  }
+
+  PoseIndex *index = map_index(shm_name, fd, size, TRUE, TRUE);
+  g_free(shm_name);
+  if (!index)
+    return NULL;
+
+  /* ftruncate zero-fills the object, all entry locks start even */
+  index->header->num_sources = num_sources;
+  index->header->record_size = sizeof(PoseRecord);
+  index->header->version = POSE_INDEX_VERSION;
+  __atomic_store_n(&index->header->magic, POSE_INDEX_MAGIC, __ATOMIC_RELEASE);
+  return index;
+}
+
+PoseIndex *
+pose_index_open(const gchar *name, gboolean writable)
+{
+  gchar *shm_name = shm_object_name(name);
+  struct stat st;
+
+  int fd = shm_open(shm_name, writable ? O_RDWR : O_RDONLY, 0);
+  if (fd < 0 || fstat(fd, &st) < 0)
+  {
+    g_printerr("Failed to open the pose index %s: %s\n", shm_name, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    g_free(shm_name);
+    return NULL;
+  }
+  if ((gsize)st.st_size < sizeof(PoseIndexHeader))
+  {
+    g_printerr("Pose index %s is not initialized\n", shm_name);
+    close(fd);
+    g_free(shm_name);
+    return NULL;
+  }
+
+  PoseIndex *index = map_index(shm_name, fd, st.st_size, writable, FALSE);
+  g_free(shm_name);
+  if (!index)
+    return NULL;
+
+  PoseIndexHeader *header = index->header;
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != POSE_INDEX_MAGIC ||
+      header->version != POSE_INDEX_VERSION || header->record_size != sizeof(PoseRecord) ||
+      index->size < sizeof(PoseIndexHeader) + (gsize)header->num_sources * sizeof(PoseIndexEntry))
+  {
+    g_printerr("Pose index %s has an incompatible layout\n", index->name);
+    pose_index_close(index);
+    return NULL;
+  }
+  return index;
+}
+
+PoseRecord *
+pose_index_begin_write(PoseIndex *index, guint source_id)
+{
+  if (source_id >= index->header->num_sources)
+    return NULL;
+
+  PoseIndexEntry *entry = &index->entries[source_id];
+
+  /* Odd lock, readers copying this entry will retry */
+  __atomic_store_n(&entry->lock, entry->lock + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return &entry->record;
+}
+
+void
+pose_index_end_write(PoseIndex *index, guint source_id)
+{
+  PoseIndexEntry *entry = &index->entries[source_id];
+
+  entry->record.sequence = entry->num_records;
+  __atomic_store_n(&entry->num_records, entry->num_records + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->lock, entry->lock + 1, __ATOMIC_RELEASE);
+}
+
+void
+pose_index_set_owner(PoseIndex *index, guint source_id, guint worker, pid_t pid, guint num_restarts)
+{
+  if (source_id >= index->header->num_sources)
+    return;
+
+  PoseIndexEntry *entry = &index->entries[source_id];
+  __atomic_store_n(&entry->worker, worker, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->pid, pid, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->num_restarts, num_restarts, __ATOMIC_RELEASE);
+}
+
+void
+pose_index_recover(PoseIndex *index, guint source_id)
+{
+  if (source_id >= index->header->num_sources)
+    return;
+
+  PoseIndexEntry *entry = &index->entries[source_id];
+  if (!(__atomic_load_n(&entry->lock, __ATOMIC_ACQUIRE) & 1))
+    return;
+
+  /* The record may be torn, drop it until the next worker writes one */
+  memset(&entry->record, 0, sizeof(PoseRecord));
+  __atomic_store_n(&entry->num_records, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->lock, entry->lock + 1, __ATOMIC_RELEASE);
+}
+
+gboolean
+pose_index_read(PoseIndex *index, guint source_id, PoseIndexEntry *entry)
+{
+  if (source_id >= index->header->num_sources)
+    return FALSE;
+
+  PoseIndexEntry *src = &index->entries[source_id];
+  for (;;)
+  {
+    guint64 lock = __atomic_load_n(&src->lock, __ATOMIC_ACQUIRE);
+    if (lock & 1)
+    {
+      /* Being written, filling a record takes a few us */
+      continue;
+    }
+
+    memcpy(entry, src, sizeof(PoseIndexEntry));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&src->lock, __ATOMIC_RELAXED) == lock)
+      return entry->num_records > 0;
+  }
+}
+
+void
+pose_index_close(PoseIndex *index)
+{
+  if (!index)
+    return;
+
+  munmap(index->header, index->size);
+  close(index->fd);
+  if (index->owner)
+  {
+    gchar *shm_name = shm_object_name(index->name);
+    shm_unlink(shm_name);
+    g_free(shm_name);
+  }
+  g_free(index->name);
+  g_free(index);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "pose_ring.hpp"
+
+#include <sys/types.h>
+
+/*
+ * Latest pose record of every source in one POSIX shared-memory object,
+ * indexed by the global source id.
+ *
+ * The supervisor started with --workers creates the index, and each worker
+ * writes the entries of the sources it owns. An entry has a single writer
+ * at a time and the same sequence lock as a ring slot, so readers copy
+ * entries without blocking the workers. The supervisor also records in each
+ * entry the worker owning the source, its pid and how often it was
+ * restarted.
+ */
+
+#define POSE_INDEX_MAGIC 0x58444950u /* "PIDX" */
+#define POSE_INDEX_VERSION 1
+
+struct PoseIndexEntry
+{
+  guint64 lock;
+  /* Number of records written for the source, 0 before the first frame */
+  guint64 num_records;
+  /* Worker owning the source, written by the supervisor */
+  guint32 worker;
+  gint32 pid;
+  guint32 num_restarts;
+  guint32 reserved;
+  PoseRecord record;
+};
+
+struct PoseIndexHeader
+{
+  guint32 magic;
+  guint32 version;
+  guint32 num_sources;
+  guint32 record_size;
+  guint64 reserved[6];
+};
+
+struct PoseIndex
+{
+  gchar *name;
+  int fd;
+  gsize size;
+  PoseIndexHeader *header;
+  PoseIndexEntry *entries;
+  /* TRUE for the creator, which unlinks the object on close */
+  gboolean owner;
+};
+
+/* Creates the shared-memory object 'name' with 'num_sources' entries, replacing any previous one */
+PoseIndex *pose_index_create(const gchar *name, guint num_sources);
+
+/* Maps an existing index, read-write for a worker or read-only for a reader */
+PoseIndex *pose_index_open(const gchar *name, gboolean writable);
+
+/* Returns the record of 'source_id' to be filled in place, NULL when out of range */
+PoseRecord *pose_index_begin_write(PoseIndex *index, guint source_id);
+
+/* Publishes the record returned by 'pose_index_begin_write' */
+void pose_index_end_write(PoseIndex *index, guint source_id);
+
+/* Records the worker process owning 'source_id' */
+void pose_index_set_owner(PoseIndex *index, guint source_id, guint worker, pid_t pid, guint num_restarts);
+
+/**
+ * Releases the entry of a source whose worker died in the middle of a
+ * write, readers would otherwise wait for the lock forever. The torn
+ * record is dropped.
+ */
+void pose_index_recover(PoseIndex *index, guint source_id);
+
+/**
+ * Copies the entry of 'source_id' with its latest record. Returns FALSE
+ * when the source is out of range or has no record yet.
+ */
+gboolean pose_index_read(PoseIndex *index, guint source_id, PoseIndexEntry *entry);
+
+/* Unmaps the index, the creator also unlinks the shared-memory object */
+void pose_index_close(PoseIndex *index);
@@ -0,0 +1,103 @@
+#include "pose_meta.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+NvDsMetaType
+pose_user_meta_type()
+{
+  static NvDsMetaType type = NVDS_INVALID_META;
+
+  if (type == NVDS_INVALID_META)
+    type = nvds_get_user_meta_type((gchar *)POSE_USER_META_NAME);
+  return type;
+}
+
+static gpointer
+copy_pose_meta(gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *)data;
+  return g_memdup(user_meta->user_meta_data, sizeof(NvDsPoseMeta));
+}
+
+static void
+release_pose_meta(gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *)data;
+  g_free(user_meta->user_meta_data);
+  user_meta->user_meta_data = NULL;
+}
+
+void
+attach_pose_meta(NvDsFrameMeta *frame_meta, PoseResult &result, gint unique_component_id,
+                 int frame_width, int frame_height)
+{
+  NvDsBatchMeta *bmeta = frame_meta->base_meta.batch_meta;
+
+  for (unsigned int n = 0; n < result.objects.size(); n++)
+  {
+    Vec1D<int> &object = result.objects[n];
+    NvDsPoseMeta *pose = (NvDsPoseMeta *)g_malloc0(sizeof(NvDsPoseMeta));
+    float x0 = frame_width, y0 = frame_height, x1 = 0.0f, y1 = 0.0f;
+    float score_sum = 0.0f;
+
+    pose->track_id = n < result.ids.size() ? result.ids[n] : 0;
+    pose->num_keypoints = POSE_META_NUM_KEYPOINTS;
+    for (int c = 0; c < POSE_META_NUM_KEYPOINTS; c++)
+    {
+      NvDsPoseKeypoint &kp = pose->keypoints[c];
+      int k = c < (int)object.size() ? object[c] : -1;
+      if (k < 0)
+      {
+        kp.x = kp.y = kp.score = -1.0f;
+        continue;
+      }
+      kp.x = result.peaks[c][k][1] * frame_width;
+      kp.y = result.peaks[c][k][0] * frame_height;
+      kp.score = result.scores.empty() ? 0.0f : result.scores[c][k];
+      x0 = std::min(x0, kp.x);
+      y0 = std::min(y0, kp.y);
+      x1 = std::max(x1, kp.x);
+      y1 = std::max(y1, kp.y);
+      score_sum += kp.score;
+      pose->num_visible++;
+    }
+    if (pose->num_visible == 0)
+    {
+      g_free(pose);
+      continue;
+    }
+
+    /* Box around the keypoints, padded since they lie inside the body outline */
+    float pad_x = (x1 - x0) * POSE_META_BOX_PADDING;
+    float pad_y = (y1 - y0) * POSE_META_BOX_PADDING;
+    x0 = std::max(0.0f, x0 - pad_x);
+    y0 = std::max(0.0f, y0 - pad_y);
+    x1 = std::min((float)frame_width - 1, x1 + pad_x);
+    y1 = std::min((float)frame_height - 1, y1 + pad_y);
+
+    NvDsObjectMeta *obj_meta = nvds_acquire_obj_meta_from_pool(bmeta);
+    obj_meta->unique_component_id = unique_component_id;
+    obj_meta->class_id = POSE_META_CLASS_ID;
+    obj_meta->object_id = pose->track_id ? pose->track_id : UNTRACKED_OBJECT_ID;
+    obj_meta->confidence = score_sum / pose->num_visible;
+    obj_meta->rect_params.left = x0;
+    obj_meta->rect_params.top = y0;
+    obj_meta->rect_params.width = x1 - x0;
+    obj_meta->rect_params.height = y1 - y0;
+    /* The skeleton is drawn by the display meta, not the box */
+    obj_meta->rect_params.border_width = 0;
+    obj_meta->rect_params.has_bg_color = 0;
+    obj_meta->text_params.display_text = NULL;
+    g_strlcpy(obj_meta->obj_label, "person", sizeof(obj_meta->obj_label));
+
+    NvDsUserMeta *user_meta = nvds_acquire_user_meta_from_pool(bmeta);
+    user_meta->user_meta_data = pose;
+    user_meta->base_meta.meta_type = pose_user_meta_type();
+    user_meta->base_meta.copy_func = (NvDsMetaCopyFunc)copy_pose_meta;
+    user_meta->base_meta.release_func = (NvDsMetaReleaseFunc)release_pose_meta;
+    nvds_add_user_meta_to_obj(obj_meta, user_meta);
+    nvds_add_obj_meta_to_frame(frame_meta, obj_meta, NULL);
+  }
+}
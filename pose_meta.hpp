@@ -0,0 +1,50 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include "nvdsmeta.h"
+
+/* Name of the user meta type, for 'nvds_get_user_meta_type' in other plugins */
+#define POSE_USER_META_NAME "TRTPOSE.KEYPOINTS"
+
+/* Number of keypoints of the TRTPose human model */
+#define POSE_META_NUM_KEYPOINTS 18
+
+/* Class id of the person objects */
+#define POSE_META_CLASS_ID 0
+
+/* Padding added around the keypoints of a person for its bounding box, relative to the box size */
+#define POSE_META_BOX_PADDING 0.1f
+
+/* Keypoint in pixels of the frame the object meta refers to, x, y and score are -1 when missing */
+struct NvDsPoseKeypoint
+{
+  float x;
+  float y;
+  float score;
+};
+
+/**
+ * User meta attached to each person NvDsObjectMeta. It is a flat struct,
+ * copied with g_memdup and released with g_free, so it survives
+ * nvstreamdemux, tee and the other elements that copy metadata.
+ */
+struct NvDsPoseMeta
+{
+  guint64 track_id;
+  guint num_keypoints;
+  guint num_visible;
+  NvDsPoseKeypoint keypoints[POSE_META_NUM_KEYPOINTS];
+};
+
+/* Meta type registered for POSE_USER_META_NAME */
+NvDsMetaType pose_user_meta_type();
+
+/**
+ * Attaches one NvDsObjectMeta per person of 'result' to the frame, with
+ * the box around its keypoints and an NvDsPoseMeta holding the keypoints.
+ * 'frame_width' and 'frame_height' are the dimensions of the frame buffer
+ * the coordinates refer to.
+ */
+void attach_pose_meta(NvDsFrameMeta *frame_meta, PoseResult &result, gint unique_component_id,
+                      int frame_width, int frame_height);
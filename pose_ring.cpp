@@ -0,0 +1,205 @@
+#include "pose_ring.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* shm_open wants a name starting with a single slash */
+static gchar *
+shm_object_name(const gchar *name)
+{
+  return name[0] == '/' ? g_strdup(name) : g_strconcat("/", name, NULL);
+}
+
+static PoseRing *
+map_ring(const gchar *name, int fd, gsize size, gboolean writer)
+{
+  void *addr = mmap(NULL, size, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+  {
+    g_printerr("Failed to map the pose ring %s: %s\n", name, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  PoseRing *ring = g_new0(PoseRing, 1);
+  ring->name = g_strdup(name);
+  ring->fd = fd;
+  ring->size = size;
+  ring->header = (PoseRingHeader *)addr;
+  ring->slots = (PoseRingSlot *)((guint8 *)addr + sizeof(PoseRingHeader));
+  ring->writer = writer;
+  return ring;
+}
+
+PoseRing *
+pose_ring_create(const gchar *name, guint num_slots)
+{
+  gchar *shm_name = shm_object_name(name);
+  gsize size = sizeof(PoseRingHeader) + (gsize)num_slots * sizeof(PoseRingSlot);
+
+  shm_unlink(shm_name);
+  int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0 || ftruncate(fd, size) < 0)
+  {
+    g_printerr("Failed to create the pose ring %s: %s\n", shm_name, strerror(errno));
+    if (fd >= 0)
+    {
+      close(fd);
+      shm_unlink(shm_name);
+    }
+    g_free(shm_name);
+    return NULL;
+  }
+
+  PoseRing *ring = map_ring(shm_name, fd, size, TRUE);
+  g_free(shm_name);
+  if (!ring)
+    return NULL;
+
+  /* ftruncate zero-fills the object, all slot locks start even */
+  ring->header->magic = POSE_RING_MAGIC;
+  ring->header->version = POSE_RING_VERSION;
+  ring->header->num_slots = num_slots;
+  ring->header->record_size = sizeof(PoseRecord);
+  __atomic_store_n(&ring->header->write_seq, 0, __ATOMIC_RELEASE);
+  return ring;
+}
+
+PoseRecord *
+pose_ring_begin_write(PoseRing *ring)
+{
+  guint64 seq = ring->header->write_seq;
+  PoseRingSlot *slot = &ring->slots[seq % ring->header->num_slots];
+
+  /* Odd lock, readers copying this slot will retry */
+  __atomic_store_n(&slot->lock, slot->lock + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ring->pending = slot;
+  return &slot->record;
+}
+
+void
+pose_ring_end_write(PoseRing *ring)
+{
+  PoseRingSlot *slot = ring->pending;
+  guint64 seq = ring->header->write_seq;
+
+  slot->record.sequence = seq;
+  __atomic_store_n(&slot->lock, slot->lock + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->header->write_seq, seq + 1, __ATOMIC_RELEASE);
+  ring->pending = NULL;
+}
+
+PoseRing *
+pose_ring_open(const gchar *name, gboolean from_start)
+{
+  gchar *shm_name = shm_object_name(name);
+  struct stat st;
+
+  int fd = shm_open(shm_name, O_RDONLY, 0);
+  if (fd < 0 || fstat(fd, &st) < 0)
+  {
+    g_printerr("Failed to open the pose ring %s: %s\n", shm_name, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    g_free(shm_name);
+    return NULL;
+  }
+  if ((gsize)st.st_size < sizeof(PoseRingHeader))
+  {
+    g_printerr("Pose ring %s is not initialized\n", shm_name);
+    close(fd);
+    g_free(shm_name);
+    return NULL;
+  }
+
+  PoseRing *ring = map_ring(shm_name, fd, st.st_size, FALSE);
+  g_free(shm_name);
+  if (!ring)
+    return NULL;
+
+  PoseRingHeader *header = ring->header;
+  if (header->magic != POSE_RING_MAGIC || header->version != POSE_RING_VERSION ||
+      header->record_size != sizeof(PoseRecord) ||
+      ring->size < sizeof(PoseRingHeader) + (gsize)header->num_slots * sizeof(PoseRingSlot))
+  {
+    g_printerr("Pose ring %s has an incompatible layout\n", ring->name);
+    pose_ring_close(ring);
+    return NULL;
+  }
+
+  guint64 write_seq = __atomic_load_n(&header->write_seq, __ATOMIC_ACQUIRE);
+  if (!from_start)
+    ring->read_seq = write_seq;
+  else if (write_seq > header->num_slots)
+    ring->read_seq = write_seq - header->num_slots;
+  return ring;
+}
+
+PoseRingStatus
+pose_ring_read(PoseRing *ring, PoseRecord *record)
+{
+  guint num_slots = ring->header->num_slots;
+
+  for (;;)
+  {
+    guint64 write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+    if (ring->read_seq >= write_seq)
+      return POSE_RING_EMPTY;
+
+    if (write_seq - ring->read_seq > num_slots)
+    {
+      /* The writer lapped the reader */
+      ring->num_lost += write_seq - ring->read_seq - num_slots;
+      ring->read_seq = write_seq - num_slots;
+    }
+
+    PoseRingSlot *slot = &ring->slots[ring->read_seq % num_slots];
+    guint64 lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+    if (lock & 1)
+    {
+      /* The oldest record is being overwritten */
+      ring->num_lost++;
+      ring->read_seq++;
+      continue;
+    }
+
+    memcpy(record, &slot->record, sizeof(PoseRecord));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) != lock)
+      continue;
+
+    if (record->sequence != ring->read_seq)
+    {
+      /* Overwritten between the two loads of write_seq and lock */
+      ring->num_lost++;
+      ring->read_seq++;
+      continue;
+    }
+
+    ring->read_seq++;
+    return POSE_RING_OK;
+  }
+}
+
+void
+pose_ring_close(PoseRing *ring)
+{
+  if (!ring)
+    return;
+
+  munmap(ring->header, ring->size);
+  close(ring->fd);
+  if (ring->writer)
+  {
+    gchar *shm_name = shm_object_name(ring->name);
+    shm_unlink(shm_name);
+    g_free(shm_name);
+  }
+  g_free(ring->name);
+  g_free(ring);
+}
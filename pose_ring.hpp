@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/*
+ * Fixed-layout pose records in a POSIX shared-memory ring buffer.
+ *
+ * The application is the single writer. Each slot is guarded by a sequence
+ * lock: its sequence is odd while the writer fills the record in place and
+ * even once the record is complete. Readers never block the writer, they
+ * copy a slot and retry when its sequence changed during the copy. The
+ * header counts the records written so far, a reader that falls more than
+ * the ring size behind skips ahead and reports the records it lost.
+ */
+
+#define POSE_RING_MAGIC 0x474e5250u /* "PRNG" */
+#define POSE_RING_VERSION 1
+
+#define POSE_RING_MAX_PERSONS 32
+#define POSE_RING_NUM_KEYPOINTS 18
+
+/* Default number of slots of the ring */
+#define POSE_RING_DEFAULT_SLOTS 256
+
+/* PoseRecord flags */
+#define POSE_RECORD_PREDICTED 0x1 /* Skeletons propagated by the tracker, no inference */
+#define POSE_RECORD_TRUNCATED 0x2 /* More than POSE_RING_MAX_PERSONS people in the frame */
+#define POSE_RECORD_NO_SKELETONS 0x4 /* Output mode without skeletons, only 'num_people' is set */
+
+/* Normalized keypoint position, score 0 and negative coordinates when missing */
+struct PoseKeypoint
+{
+  float x;
+  float y;
+  float score;
+};
+
+struct PosePerson
+{
+  /* Tracker id, 0 when tracking is off */
+  guint64 track_id;
+  PoseKeypoint keypoints[POSE_RING_NUM_KEYPOINTS];
+};
+
+struct PoseRecord
+{
+  /* Index of the record in the stream of records, starts at 0 */
+  guint64 sequence;
+  guint32 stream_id;
+  guint32 flags;
+  gint64 frame_num;
+  /* Presentation timestamp of the frame in ns */
+  guint64 pts;
+  /* Wall clock time the record was written, in us */
+  gint64 timestamp_us;
+  /* Resolution of the source frame, to scale the normalized keypoints */
+  guint32 width;
+  guint32 height;
+  guint32 num_persons;
+  /* People in the frame before the truncation, or the estimate of the count and presence modes */
+  guint32 num_people;
+  PosePerson persons[POSE_RING_MAX_PERSONS];
+};
+
+struct PoseRingSlot
+{
+  guint64 lock;
+  PoseRecord record;
+};
+
+struct PoseRingHeader
+{
+  guint32 magic;
+  guint32 version;
+  guint32 num_slots;
+  guint32 record_size;
+  /* Number of records written so far */
+  guint64 write_seq;
+  guint64 reserved[5];
+};
+
+struct PoseRing
+{
+  gchar *name;
+  int fd;
+  gsize size;
+  PoseRingHeader *header;
+  PoseRingSlot *slots;
+  gboolean writer;
+  /* Reader side: next record to read and records lost to overruns */
+  guint64 read_seq;
+  guint64 num_lost;
+  /* Writer side: slot being written */
+  PoseRingSlot *pending;
+};
+
+/* Return values of pose_ring_read */
+typedef enum
+{
+  POSE_RING_OK = 0,
+  POSE_RING_EMPTY = 1,
+} PoseRingStatus;
+
+/* Creates the shared-memory object 'name' with 'num_slots' slots, replacing any previous one */
+PoseRing *pose_ring_create(const gchar *name, guint num_slots);
+
+/* Returns the record of the next slot, to be filled in place and published with 'pose_ring_end_write' */
+PoseRecord *pose_ring_begin_write(PoseRing *ring);
+
+/* Publishes the record returned by 'pose_ring_begin_write' */
+void pose_ring_end_write(PoseRing *ring);
+
+/**
+ * Opens an existing ring for reading. When 'from_start' is false the reader
+ * starts with the next record written, otherwise with the oldest one still
+ * in the ring.
+ */
+PoseRing *pose_ring_open(const gchar *name, gboolean from_start);
+
+/**
+ * Copies the next record into 'record'. Returns POSE_RING_EMPTY when the
+ * reader caught up with the writer. Records overwritten before they could
+ * be read are added to 'ring->num_lost'.
+ */
+PoseRingStatus pose_ring_read(PoseRing *ring, PoseRecord *record);
+
+/* Unmaps the ring, the writer also unlinks the shared-memory object */
+void pose_ring_close(PoseRing *ring);
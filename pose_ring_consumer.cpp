@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Test consumer of the pose ring written by the application with --shm-ring.
+ * Prints each record with -v, and once per second the number of records
+ * read, lost to overruns and the average handoff latency.
+ *
+ * With --index, NAME is the pose index written with --shm-index or
+ * --workers, and the latest record of every source is printed once per
+ * second with the worker owning it.
+ *
+ * Usage: pose-ring-consumer [-v] [--from-start] [--index] NAME
+ */
+
+#include "pose_ring.hpp"
+#include "pose_index.hpp"
+
+#include <glib.h>
+#include <stdio.h>
+
+static gboolean verbose = FALSE;
+static gboolean from_start = FALSE;
+static gint poll_us = 200;
+static gboolean read_index = FALSE;
+
+static GOptionEntry option_entries[] = {
+    {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+     "Print every record", NULL},
+    {"from-start", 0, 0, G_OPTION_ARG_NONE, &from_start,
+     "Start with the oldest record still in the ring", NULL},
+    {"poll-us", 'p', 0, G_OPTION_ARG_INT, &poll_us,
+     "Sleep between polls of an empty ring, in us (default 200)", "US"},
+    {"index", 'i', 0, G_OPTION_ARG_NONE, &read_index,
+     "NAME is a pose index, print the latest record of each source", NULL},
+    {NULL}};
+
+static void
+print_record(const PoseRecord &record)
+{
+  g_print("#%" G_GUINT64_FORMAT " stream %u frame %" G_GINT64_FORMAT " pts %" G_GUINT64_FORMAT
+          " %ux%u %u person(s)%s\n",
+          record.sequence, record.stream_id, record.frame_num, record.pts,
+          record.width, record.height, record.num_people,
+          (record.flags & POSE_RECORD_PREDICTED) ? " predicted" :
+          (record.flags & POSE_RECORD_NO_SKELETONS) ? " no skeletons" : "");
+
+  for (guint n = 0; n < record.num_persons; n++)
+  {
+    const PosePerson &person = record.persons[n];
+    g_print("  id %" G_GUINT64_FORMAT ":", person.track_id);
+    for (int c = 0; c < POSE_RING_NUM_KEYPOINTS; c++)
+    {
+      const PoseKeypoint &kp = person.keypoints[c];
+      if (kp.x < 0.0f)
+        g_print(" -");
+      else
+        g_print(" (%.0f,%.0f)", kp.x * record.width, kp.y * record.height);
+    }
+    g_print("\n");
+  }
+}
+
+static int
+print_index(const gchar *name)
+{
+  PoseIndex *index = pose_index_open(name, FALSE);
+  if (!index)
+    return -1;
+
+  guint num_sources = index->header->num_sources;
+  PoseIndexEntry entry;
+  g_print("Reading %s, %u sources\n", name, num_sources);
+
+  for (;;)
+  {
+    for (guint s = 0; s < num_sources; s++)
+    {
+      gboolean has_record = pose_index_read(index, s, &entry);
+      g_print("source %u: worker %u pid %d, %u restart(s), %" G_GUINT64_FORMAT " records", s,
+              entry.worker, entry.pid, entry.num_restarts, entry.num_records);
+      if (!has_record)
+      {
+        g_print("\n");
+        continue;
+      }
+      g_print(", age %.1f ms\n", (g_get_real_time() - entry.record.timestamp_us) / 1000.0);
+      if (verbose)
+        print_record(entry.record);
+    }
+    g_usleep(G_USEC_PER_SEC);
+  }
+
+  pose_index_close(index);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  GError *error = NULL;
+  GOptionContext *context = g_option_context_new("NAME");
+  g_option_context_add_main_entries(context, option_entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error) || argc != 2)
+  {
+    g_printerr("%s\n", error ? error->message : "Usage: pose-ring-consumer [OPTION...] NAME");
+    g_clear_error(&error);
+    g_option_context_free(context);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (read_index)
+    return print_index(argv[1]);
+
+  PoseRing *ring = pose_ring_open(argv[1], from_start);
+  if (!ring)
+    return -1;
+
+  g_print("Reading %s, %u slots\n", argv[1], ring->header->num_slots);
+
+  PoseRecord record;
+  guint64 num_read = 0, num_lost = 0;
+  gint64 total_latency_us = 0;
+  gint64 last_report = g_get_monotonic_time();
+
+  for (;;)
+  {
+    if (pose_ring_read(ring, &record) == POSE_RING_OK)
+    {
+      total_latency_us += g_get_real_time() - record.timestamp_us;
+      num_read++;
+      if (verbose)
+        print_record(record);
+    }
+    else
+    {
+      g_usleep(poll_us);
+    }
+
+    gint64 now = g_get_monotonic_time();
+    if (now - last_report >= G_USEC_PER_SEC)
+    {
+      g_print("%" G_GUINT64_FORMAT " records/s, %" G_GUINT64_FORMAT " lost, latency %.1f us\n",
+              num_read, ring->num_lost - num_lost,
+              num_read > 0 ? (double)total_latency_us / num_read : 0.0);
+      num_lost = ring->num_lost;
+      num_read = 0;
+      total_latency_us = 0;
+      last_report = now;
+    }
+  }
+
+  pose_ring_close(ring);
+  return 0;
+}
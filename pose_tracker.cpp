@@ -0,0 +1,180 @@
+#include "pose_tracker.hpp"
+
+#include <vector>
+#include <cmath>
+
+/* Mean distance between the keypoints a track and an object have in common */
+static float
+pose_distance(const TrackedPose &track, Vec1D<int> &object, Vec3D<float> &normalized_peaks,
+              gint64 frame_num)
+{
+  float dt = (float)(frame_num - track.last_frame);
+  float sum = 0.0f;
+  int num = 0;
+
+  for (unsigned int c = 0; c < object.size(); c++)
+  {
+    if (object[c] < 0 || !track.valid[c])
+      continue;
+    auto &peak = normalized_peaks[c][object[c]];
+    float dx = peak[1] - (track.x[c] + track.vx[c] * dt);
+    float dy = peak[0] - (track.y[c] + track.vy[c] * dt);
+    sum += sqrtf(dx * dx + dy * dy);
+    num++;
+  }
+  return num > 0 ? sum / num : INFINITY;
+}
+
+void PoseTracker::update(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, gint64 frame_num,
+                         Vec1D<guint64> &ids)
+{
+  int nrows = tracks.size();
+  int ncols = objects.size();
+  Vec1D<int> track_for_object(ncols, -1);
+  Vec1D<int> matched(nrows, 0);
+
+  if (nrows > 0 && ncols > 0)
+  {
+    /* Solve the track to object matching with the Munkres algorithm */
+    Vec2D<float> distance(nrows, Vec1D<float>(ncols));
+    Vec2D<float> cost_graph(nrows, Vec1D<float>(ncols));
+    for (int i = 0; i < nrows; i++)
+    {
+      for (int j = 0; j < ncols; j++)
+      {
+        distance[i][j] = pose_distance(tracks[i], objects[j], normalized_peaks, frame_num);
+        cost_graph[i][j] = std::isinf(distance[i][j]) ? 1e3f : distance[i][j];
+      }
+    }
+
+    PairGraph star_graph(nrows, ncols);
+    munkres_algorithm(cost_graph, star_graph, nrows, ncols);
+
+    for (int i = 0; i < nrows; i++)
+    {
+      if (!star_graph.isRowSet(i))
+        continue;
+      int j = star_graph.colForRow(i);
+      if (distance[i][j] <= TRACKER_MATCH_DISTANCE)
+      {
+        track_for_object[j] = i;
+        matched[i] = 1;
+      }
+    }
+  }
+
+  /* Update the matched tracks and start new ones */
+  ids.assign(ncols, 0);
+  for (int j = 0; j < ncols; j++)
+  {
+    Vec1D<int> &object = objects[j];
+    int C = object.size();
+    int i = track_for_object[j];
+
+    if (i < 0)
+    {
+      TrackedPose track;
+      track.id = next_id++;
+      track.x.assign(C, 0.0f);
+      track.y.assign(C, 0.0f);
+      track.vx.assign(C, 0.0f);
+      track.vy.assign(C, 0.0f);
+      track.valid.assign(C, 0);
+      track.last_frame = frame_num;
+      track.age = 0;
+      track.misses = 0;
+      tracks.push_back(track);
+      matched.push_back(1);
+      i = tracks.size() - 1;
+    }
+
+    TrackedPose &track = tracks[i];
+    float dt = (float)(frame_num - track.last_frame);
+    for (int c = 0; c < C; c++)
+    {
+      if (object[c] < 0)
+      {
+        track.valid[c] = 0;
+        continue;
+      }
+      auto &peak = normalized_peaks[c][object[c]];
+      if (track.valid[c] && dt > 0 && track.age == 1)
+      {
+        /* Second measurement, nothing to smooth yet */
+        track.vx[c] = (peak[1] - track.x[c]) / dt;
+        track.vy[c] = (peak[0] - track.y[c]) / dt;
+      }
+      else if (track.valid[c] && dt > 0)
+      {
+        float vx = (peak[1] - track.x[c]) / dt;
+        float vy = (peak[0] - track.y[c]) / dt;
+        track.vx[c] = TRACKER_VELOCITY_ALPHA * vx + (1.0f - TRACKER_VELOCITY_ALPHA) * track.vx[c];
+        track.vy[c] = TRACKER_VELOCITY_ALPHA * vy + (1.0f - TRACKER_VELOCITY_ALPHA) * track.vy[c];
+      }
+      else
+      {
+        track.vx[c] = 0.0f;
+        track.vy[c] = 0.0f;
+      }
+      track.x[c] = peak[1];
+      track.y[c] = peak[0];
+      track.valid[c] = 1;
+    }
+    track.last_frame = frame_num;
+    track.age++;
+    track.misses = 0;
+    ids[j] = track.id;
+  }
+
+  /* Age the tracks that were not seen and drop the lost ones */
+  int n = 0;
+  for (unsigned int i = 0; i < tracks.size(); i++)
+  {
+    if (!matched[i])
+    {
+      tracks[i].misses++;
+    }
+    if (tracks[i].misses <= TRACKER_MAX_MISSES)
+    {
+      if (n != (int)i)
+        tracks[n] = tracks[i];
+      n++;
+    }
+  }
+  tracks.resize(n);
+}
+
+void PoseTracker::predict(gint64 frame_num, Vec2D<int> &objects, Vec3D<float> &normalized_peaks,
+                          Vec1D<guint64> &ids) const
+{
+  int N = 0;
+  int C = tracks.empty() ? 0 : tracks[0].x.size();
+
+  objects.clear();
+  ids.clear();
+  normalized_peaks.assign(C, Vec2D<float>(tracks.size(), Vec1D<float>(2, 0.0f)));
+
+  for (auto &track : tracks)
+  {
+    float dt = (float)(frame_num - track.last_frame);
+    if (track.misses > 0 || dt < 0 || dt > TRACKER_MAX_PREDICTION)
+      continue;
+
+    Vec1D<int> object(C, -1);
+    for (int c = 0; c < C; c++)
+    {
+      if (!track.valid[c])
+        continue;
+      float x = track.x[c] + track.vx[c] * dt;
+      float y = track.y[c] + track.vy[c] * dt;
+      if (x < 0.0f || x >= 1.0f || y < 0.0f || y >= 1.0f)
+        continue;
+      normalized_peaks[c][N][0] = y;
+      normalized_peaks[c][N][1] = x;
+      object[c] = N;
+    }
+    objects.push_back(object);
+    ids.push_back(track.id);
+    N++;
+  }
+}
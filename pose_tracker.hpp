@@ -0,0 +1,63 @@
+#pragma once
+
+#include "post_process.hpp"
+
+/* Keyframes a track may go unmatched before it is dropped */
+#define TRACKER_MAX_MISSES 3
+
+/* Maximum mean keypoint distance, in normalized coordinates, to match a track */
+#define TRACKER_MATCH_DISTANCE 0.08f
+
+/* Weight of the newest measurement in the keypoint velocities */
+#define TRACKER_VELOCITY_ALPHA 0.5f
+
+/* Frames over which a track is still propagated after its last keyframe */
+#define TRACKER_MAX_PREDICTION 30
+
+struct TrackedPose
+{
+  guint64 id;
+  Vec1D<float> x;
+  Vec1D<float> y;
+  Vec1D<float> vx;
+  Vec1D<float> vy;
+  Vec1D<int> valid;
+  gint64 last_frame;
+  int age;
+  int misses;
+};
+
+/**
+ * Assigns stable ids to the skeletons found by 'connect_parts' and
+ * propagates them with a constant velocity model on frames without inference.
+ */
+class PoseTracker
+{
+public:
+  PoseTracker() : next_id(1)
+  {
+  }
+
+  /**
+   * Matches the skeletons of a keyframe to the current tracks.
+   * 'ids' receives the track id of each object.
+   */
+  void update(Vec2D<int> &objects, Vec3D<float> &normalized_peaks, gint64 frame_num,
+              Vec1D<guint64> &ids);
+
+  /**
+   * Predicts the tracked skeletons at 'frame_num', in the same layout as
+   * the output of 'parse_objects_from_tensor_meta'.
+   */
+  void predict(gint64 frame_num, Vec2D<int> &objects, Vec3D<float> &normalized_peaks,
+               Vec1D<guint64> &ids) const;
+
+  inline int numTracks() const
+  {
+    return tracks.size();
+  }
+
+private:
+  Vec1D<TrackedPose> tracks;
+  guint64 next_id;
+};
@@ -16,10 +16,13 @@
 //#include "nvbufsurface.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <array>
 #include <queue>
 #include <cmath>
+#include <algorithm>
+#include <tuple>
 
 /*
 #define EPS 1e-6
@@ -35,96 +38,462 @@ using Vec3D = std::vector<Vec2D<T>>;
 
 static const int M = 2;
 
-/*
-static Vec2D<int> topology{
-    {0, 1, 15, 13},
-    {2, 3, 13, 11},
-    {4, 5, 16, 14},
-    {6, 7, 14, 12},
-    {8, 9, 11, 12},
-    {10, 11, 5, 7},
-    {12, 13, 6, 8},
-    {14, 15, 7, 9},
-    {16, 17, 8, 10},
-    {18, 19, 1, 2},
-    {20, 21, 0, 1},
-    {22, 23, 0, 2},
-    {24, 25, 1, 3},
-    {26, 27, 2, 4},
-    {28, 29, 3, 5},
-    {30, 31, 4, 6},
-    {32, 33, 17, 0},
-    {34, 35, 17, 5},
-    {36, 37, 17, 6},
-    {38, 39, 17, 11},
-    {40, 41, 17, 12}};
-*/
+/* Resizes 'buffer' to a x b x c elements equal to 'value'. The vectors it
+   already holds are overwritten in place and keep their capacity. */
+template <class T>
+static void
+reset_buffer(Vec3D<T> &buffer, size_t a, size_t b, size_t c, T value)
+{
+  buffer.resize(a);
+  for (auto &buffer_a : buffer)
+  {
+    buffer_a.resize(b);
+    for (auto &buffer_ab : buffer_a)
+      buffer_ab.assign(c, value);
+  }
+}
 
-/* Method to find peaks in the output tensor. 'window_size' represents how many pixels we are considering at once to find a maximum value, or a ‘peak’. 
-   Once we find a peak, we mark it using the ‘is_peak’ boolean in the inner loop and assign this maximum value to the center pixel of our window. 
-   This is then repeated until we cover the entire frame. */
-void find_peaks(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, void *cmap_data,
-                NvDsInferDims &cmap_dims, float threshold, int window_size, int max_count)
+template <class T>
+static void
+reset_buffer(Vec2D<T> &buffer, size_t a, size_t b, T value)
 {
-  int w = window_size / 2;
-  int width = cmap_dims.d[2];
-  int height = cmap_dims.d[1];
+  buffer.resize(a);
+  for (auto &buffer_a : buffer)
+    buffer_a.assign(b, value);
+}
 
-  counts_out.assign(cmap_dims.d[0], 0);
-  peaks_out.assign(cmap_dims.d[0], Vec2D<int>(max_count, Vec1D<int>(M,
-                                                                    0)));
+/* Part affinity field channel pairs and the body parts they link, {paf_i, paf_j, cmap_a, cmap_b},
+   for the 18 keypoints of the TRTPose human model */
+Vec2D<int>
+default_topology()
+{
+  return Vec2D<int>{
+      {0, 1, 15, 13},
+      {2, 3, 13, 11},
+      {4, 5, 16, 14},
+      {6, 7, 14, 12},
+      {8, 9, 11, 12},
+      {10, 11, 5, 7},
+      {12, 13, 6, 8},
+      {14, 15, 7, 9},
+      {16, 17, 8, 10},
+      {18, 19, 1, 2},
+      {20, 21, 0, 1},
+      {22, 23, 0, 2},
+      {24, 25, 1, 3},
+      {26, 27, 2, 4},
+      {28, 29, 3, 5},
+      {30, 31, 4, 6},
+      {32, 33, 17, 0},
+      {34, 35, 17, 5},
+      {36, 37, 17, 6},
+      {38, 39, 17, 11},
+      {40, 41, 17, 12}};
+}
+
+/* Scans one channel of the confidence map for peaks. When 'active' is given, only the
+   pixels of the tiles it marks are considered as candidates. */
+template <class T>
+static int
+find_peaks_channel(Vec2D<int> &peaks_c, const T *cmap_data_c, float scale, int width, int height,
+                   int stride_h, int stride_w, float threshold, int w, int max_count,
+                   const uint8_t *active, int tiles_w, const ExclusionMask *mask)
+{
+  int count = 0;
 
-  for (unsigned int c = 0; c < cmap_dims.d[0]; c++)
+  for (int i = 0; i < height && count < max_count; i++)
   {
-    int count = 0;
-    float *cmap_data_c = (float *)cmap_data + c * width * height;
+    const uint8_t *active_row = active ? active + (i / SEARCH_TILE_SIZE) * tiles_w : NULL;
+
+    if (active_row && memchr(active_row, 1, tiles_w) == NULL)
+    {
+      // Jump to the last row of the skipped tile row
+      i = (i / SEARCH_TILE_SIZE + 1) * SEARCH_TILE_SIZE - 1;
+      continue;
+    }
 
-    for (int i = 0; i < height && count < max_count; i++)
+    for (int j = 0; j < width && count < max_count; j++)
     {
-      for (int j = 0; j < width && count < max_count; j++)
+      if (active_row && !active_row[j / SEARCH_TILE_SIZE])
       {
-        float value = cmap_data_c[i * width + j];
+        // Jump to the last column of the skipped tile
+        j = (j / SEARCH_TILE_SIZE + 1) * SEARCH_TILE_SIZE - 1;
+        continue;
+      }
 
-        if (value < threshold)
-          continue;
+      float value = load_value(cmap_data_c, i * stride_h + j * stride_w, scale);
+
+      if (value < threshold || (mask && mask->pixelExcluded(i, j)))
+        continue;
 
-        int ii_min = i - w;
-        int jj_min = j - w;
-        int ii_max = i + w + 1;
-        int jj_max = j + w + 1;
+      int ii_min = i - w;
+      int jj_min = j - w;
+      int ii_max = i + w + 1;
+      int jj_max = j + w + 1;
 
-        if (ii_min < 0)
-          ii_min = 0;
-        if (ii_max > height)
-          ii_max = height;
-        if (jj_min < 0)
-          jj_min = 0;
-        if (jj_max > width)
-          jj_max = width;
+      if (ii_min < 0)
+        ii_min = 0;
+      if (ii_max > height)
+        ii_max = height;
+      if (jj_min < 0)
+        jj_min = 0;
+      if (jj_max > width)
+        jj_max = width;
+
+      bool is_peak = true;
+      for (int ii = ii_min; ii < ii_max; ii++)
+      {
+        for (int jj = jj_min; jj < jj_max; jj++)
+        {
+          if (load_value(cmap_data_c, ii * stride_h + jj * stride_w, scale) > value)
+          {
+            is_peak = false;
+          }
+        }
+      }
+
+      if (is_peak)
+      {
+        peaks_c[count][0] = i;
+        peaks_c[count][1] = j;
+        count++;
+      }
+    }
+  }
+
+  return count;
+}
+
+/* Peak search for channel-interleaved (HWC) confidence maps. All channels of a pixel
+   are adjacent in memory, so they are tested together while the row is in cache, instead
+   of striding through the tensor once per channel. The peaks of each channel come out
+   in the same raster order as with 'find_peaks_channel'. 'active', when given, holds
+   one flag per tile and channel. */
+template <class T>
+static void
+find_peaks_interleaved(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, const TensorView &cmap,
+                       float threshold, int w, int max_count, const uint8_t *active, int tiles_w,
+                       const ExclusionMask *mask)
+{
+  const T *data = (const T *)cmap.data;
+  int C = cmap.channels;
+  int width = cmap.width;
+  int height = cmap.height;
+  int num_full = 0;
+
+  for (int i = 0; i < height && num_full < C; i++)
+  {
+    int ii_min = std::max(i - w, 0);
+    int ii_max = std::min(i + w + 1, height);
+
+    for (int j = 0; j < width && num_full < C; j++)
+    {
+      const uint8_t *active_tile = active ? active + ((i / SEARCH_TILE_SIZE) * tiles_w + j / SEARCH_TILE_SIZE) * C : NULL;
+      const T *pixel = data + i * cmap.stride_h + j * cmap.stride_w;
+      int jj_min = std::max(j - w, 0);
+      int jj_max = std::min(j + w + 1, width);
+
+      if (mask && mask->pixelExcluded(i, j))
+        continue;
+
+      for (int c = 0; c < C; c++)
+      {
+        if (counts_out[c] >= max_count || (active_tile && !active_tile[c]))
+          continue;
+
+        float value = load_value(pixel, c, cmap.scale);
+        if (value < threshold)
+          continue;
 
         bool is_peak = true;
-        for (int ii = ii_min; ii < ii_max; ii++)
+        for (int ii = ii_min; ii < ii_max && is_peak; ii++)
         {
           for (int jj = jj_min; jj < jj_max; jj++)
           {
-            if (cmap_data_c[ii * width + jj] > value)
+            if (load_value(data, ii * cmap.stride_h + jj * cmap.stride_w + c, cmap.scale) > value)
             {
               is_peak = false;
+              break;
             }
           }
         }
 
         if (is_peak)
         {
+          int &count = counts_out[c];
           peaks_out[c][count][0] = i;
           peaks_out[c][count][1] = j;
           count++;
+          if (count == max_count)
+            num_full++;
         }
       }
     }
+  }
+}
+
+/* Max-pools all channels of an interleaved confidence map to the tile grid in one pass
+   and clears the tile and channel flags whose maximum is below 'threshold'. */
+template <class T>
+static void
+coarse_active_tiles_interleaved(Vec1D<uint8_t> &active, Vec1D<float> &cell_max, const TensorView &cmap,
+                                float threshold, int tiles_w, int tiles_h)
+{
+  const T *data = (const T *)cmap.data;
+  int C = cmap.channels;
+
+  cell_max.assign(tiles_w * tiles_h * C, -INFINITY);
+
+  for (int i = 0; i < cmap.height; i++)
+  {
+    for (int j = 0; j < cmap.width; j++)
+    {
+      int t = (i / SEARCH_TILE_SIZE) * tiles_w + j / SEARCH_TILE_SIZE;
+      float *cell = &cell_max[t * C];
+      const T *pixel = data + i * cmap.stride_h + j * cmap.stride_w;
+      for (int c = 0; c < C; c++)
+      {
+        /* Tiles already skipped are not read, they stay below the threshold */
+        if (active[t * C + c])
+          cell[c] = std::max(cell[c], load_value(pixel, c, cmap.scale));
+      }
+    }
+  }
+
+  for (int t = 0; t < tiles_w * tiles_h * C; t++)
+  {
+    if (cell_max[t] < threshold)
+    {
+      active[t] = 0;
+    }
+  }
+}
+
+/* Max-pools one channel of the confidence map to the tile grid and clears the tiles
+   whose maximum is below 'threshold', as none of their pixels can be a peak. */
+template <class T>
+static void
+coarse_active_tiles(Vec1D<uint8_t> &active, Vec1D<float> &cell_max, const T *cmap_data_c, float scale,
+                    int width, int height, int stride_h, int stride_w, float threshold,
+                    int tiles_w, int tiles_h)
+{
+  cell_max.assign(tiles_w * tiles_h, -INFINITY);
+
+  for (int i = 0; i < height; i++)
+  {
+    float *cell_max_row = &cell_max[(i / SEARCH_TILE_SIZE) * tiles_w];
+    const uint8_t *active_row = &active[(i / SEARCH_TILE_SIZE) * tiles_w];
+    const T *row = cmap_data_c + i * stride_h;
+
+    for (int tj = 0; tj < tiles_w; tj++)
+    {
+      /* Tiles already skipped are not read, they stay below the threshold */
+      if (!active_row[tj])
+        continue;
+
+      int j_min = tj * SEARCH_TILE_SIZE;
+      int j_max = std::min(j_min + SEARCH_TILE_SIZE, width);
+      float m = cell_max_row[tj];
+      for (int j = j_min; j < j_max; j++)
+      {
+        m = std::max(m, load_value(row, j * stride_w, scale));
+      }
+      cell_max_row[tj] = m;
+    }
+  }
+
+  for (int t = 0; t < tiles_w * tiles_h; t++)
+  {
+    if (cell_max[t] < threshold)
+    {
+      active[t] = 0;
+    }
+  }
+}
+
+/* Method to find peaks in the output tensor. 'window_size' represents how many pixels we are considering at once to find a maximum value, or a ‘peak’. 
+   Once we find a peak, we mark it using the ‘is_peak’ boolean in the inner loop and assign this maximum value to the center pixel of our window. 
+   This is then repeated until we cover the entire frame.
+   When 'region' is given, only the pixels of its active tiles are considered as peak candidates.
+   The tiles fully excluded by 'mask' are never read, nor are peaks kept on its other excluded pixels.
+   With 'coarse_to_fine', each channel is first max-pooled to the tile grid and the exact search
+   only runs in the tiles reaching 'threshold'. The result is the same as the full scan. */
+void find_peaks(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, void *cmap_data,
+                NvDsInferDims &cmap_dims, float threshold, int window_size, int max_count,
+                const SearchRegion *region, bool coarse_to_fine)
+{
+  find_peaks(counts_out, peaks_out, make_tensor_view(cmap_data, cmap_dims), threshold, window_size,
+             max_count, region, coarse_to_fine);
+}
+
+/* Searches channels [c_begin, c_end) into buffers sized by 'find_peaks'. Interleaved maps
+   are searched in a single pass, so they take the whole channel range only. */
+template <class T>
+static void
+find_peaks_typed(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, const TensorView &cmap,
+                 float threshold, int window_size, int max_count,
+                 const SearchRegion *region, bool coarse_to_fine, const ExclusionMask *mask,
+                 int c_begin, int c_end)
+{
+  int w = window_size / 2;
+  int width = cmap.width;
+  int height = cmap.height;
+  int tiles_w = (width + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+  int tiles_h = (height + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+  Vec1D<uint8_t> active;
+  Vec1D<float> cell_max;
+
+  for (int c = c_begin; c < c_end; c++)
+    counts_out[c] = 0;
+
+  if (cmap.interleaved())
+  {
+    const uint8_t *active_tiles = NULL;
+    int C = cmap.channels;
+
+    if (region || coarse_to_fine || mask)
+    {
+      active.assign(tiles_w * tiles_h * C, 1);
+      for (int t = 0; t < tiles_w * tiles_h; t++)
+      {
+        if ((region && region->tile(t / tiles_w, t % tiles_w) == SEARCH_TILE_SKIP) ||
+            (mask && mask->tileExcluded(t / tiles_w, t % tiles_w)))
+          std::fill(active.begin() + t * C, active.begin() + (t + 1) * C, 0);
+      }
+      if (coarse_to_fine)
+      {
+        coarse_active_tiles_interleaved<T>(active, cell_max, cmap, threshold, tiles_w, tiles_h);
+      }
+      active_tiles = active.data();
+    }
+
+    find_peaks_interleaved<T>(counts_out, peaks_out, cmap, threshold, w, max_count, active_tiles, tiles_w, mask);
+    return;
+  }
+
+  for (int c = c_begin; c < c_end; c++)
+  {
+    const T *cmap_data_c = (const T *)cmap.data + c * cmap.stride_c;
+    const uint8_t *active_c = NULL;
+
+    if (region || coarse_to_fine || mask)
+    {
+      active.assign(tiles_w * tiles_h, 1);
+      for (int ti = 0; ti < tiles_h; ti++)
+      {
+        for (int tj = 0; tj < tiles_w; tj++)
+          active[ti * tiles_w + tj] = (!region || region->tile(ti, tj) != SEARCH_TILE_SKIP) &&
+                                      (!mask || !mask->tileExcluded(ti, tj));
+      }
+      if (coarse_to_fine)
+      {
+        coarse_active_tiles(active, cell_max, cmap_data_c, cmap.scale, width, height,
+                            cmap.stride_h, cmap.stride_w, threshold, tiles_w, tiles_h);
+      }
+      active_c = active.data();
+    }
+
+    counts_out[c] = find_peaks_channel(peaks_out[c], cmap_data_c, cmap.scale, width, height,
+                                       cmap.stride_h, cmap.stride_w, threshold, w, max_count,
+                                       active_c, tiles_w, mask);
+  }
+}
+
+void find_peaks(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, const TensorView &cmap,
+                float threshold, int window_size, int max_count,
+                const SearchRegion *region, bool coarse_to_fine, const ExclusionMask *mask)
+{
+  counts_out.assign(cmap.channels, 0);
+  reset_buffer(peaks_out, cmap.channels, max_count, M, 0);
+
+  DISPATCH_TENSOR_TYPE(cmap, find_peaks_typed, counts_out, peaks_out, cmap, threshold, window_size,
+                       max_count, region, coarse_to_fine, mask, 0, cmap.channels);
+}
 
-    counts_out[c] = count;
+/* Returns the confidence map value at each peak found in 'find_peaks' */
+template <class T>
+static void
+peak_scores_typed(Vec2D<float> &scores, Vec1D<int> &counts, Vec3D<int> &peaks, const TensorView &cmap,
+                  int c_begin, int c_end)
+{
+  for (int c = c_begin; c < c_end; c++)
+  {
+    const T *cmap_data_c = (const T *)cmap.data + c * cmap.stride_c;
+    for (int p = 0; p < counts[c]; p++)
+    {
+      scores[c][p] = load_value(cmap_data_c, peaks[c][p][0] * cmap.stride_h + peaks[c][p][1] * cmap.stride_w,
+                                cmap.scale);
+    }
+  }
+}
+
+void peak_scores(Vec2D<float> &scores, Vec1D<int> &counts, Vec3D<int> &peaks, const TensorView &cmap)
+{
+  reset_buffer(scores, counts.size(), peaks.empty() ? 0 : peaks[0].size(), 0.0f);
+
+  DISPATCH_TENSOR_TYPE(cmap, peak_scores_typed, scores, counts, peaks, cmap, 0, cmap.channels);
+}
+
+Vec2D<float>
+peak_scores(Vec1D<int> &counts, Vec3D<int> &peaks, const TensorView &cmap)
+{
+  Vec2D<float> scores;
+
+  peak_scores(scores, counts, peaks, cmap);
+  return scores;
+}
+
+/* Returns how many of the peaks found in 'find_peaks' lie in tiles of the given state */
+int count_peaks_in_region(Vec1D<int> &counts, Vec3D<int> &peaks,
+                          const SearchRegion &region, uint8_t state)
+{
+  int num = 0;
+  for (unsigned int c = 0; c < counts.size(); c++)
+  {
+    for (int p = 0; p < counts[c]; p++)
+    {
+      if (region.pixel(peaks[c][p][0], peaks[c][p][1]) == state)
+      {
+        num++;
+      }
+    }
   }
+  return num;
+}
+
+/* Builds the region to search on the next frame from the objects of the current one.
+   The bounding box of each object, dilated by 'margin' heatmap pixels, is tracked, and
+   a band of 'margin' pixels along the edges is kept as entry region for new objects. */
+void build_search_region(SearchRegion &region, Vec2D<int> &objects, Vec3D<float> &normalized_peaks,
+                         NvDsInferDims &cmap_dims, int margin)
+{
+  int width = cmap_dims.d[2];
+  int height = cmap_dims.d[1];
+
+  region.reset(width, height, SEARCH_TILE_SKIP);
+
+  for (auto &object : objects)
+  {
+    int i_min = height, i_max = -1;
+    int j_min = width, j_max = -1;
+    for (unsigned int c = 0; c < object.size(); c++)
+    {
+      if (object[c] < 0)
+        continue;
+      auto &peak = normalized_peaks[c][object[c]];
+      int i = (int)(peak[0] * height);
+      int j = (int)(peak[1] * width);
+      i_min = std::min(i_min, i);
+      i_max = std::max(i_max, i);
+      j_min = std::min(j_min, j);
+      j_max = std::max(j_max, j);
+    }
+    if (i_max < 0)
+      continue;
+    region.addRect(i_min - margin, j_min - margin, i_max + margin, j_max + margin, SEARCH_TILE_TRACKED);
+  }
+
+  region.addBorder(margin, SEARCH_TILE_ENTRY);
 }
 
 /* Normalize the peaks found in 'find_peaks' and apply non-maximal suppression*/
@@ -133,19 +502,24 @@ refine_peaks(Vec1D<int> &counts,
              Vec3D<int> &peaks, void *cmap_data, NvDsInferDims &cmap_dims,
              int window_size)
 {
-  int w = window_size / 2;
-  int width = cmap_dims.d[2];
-  int height = cmap_dims.d[1];
+  return refine_peaks(counts, peaks, make_tensor_view(cmap_data, cmap_dims), window_size);
+}
 
-  Vec3D<float> refined_peaks(peaks.size(), Vec2D<float>(peaks[0].size(),
-                                                        Vec1D<float>(peaks[0][0].size(), 0)));
+template <class T>
+static void
+refine_peaks_typed(Vec3D<float> &refined_peaks, Vec1D<int> &counts,
+                   Vec3D<int> &peaks, const TensorView &cmap, int window_size, int c_begin, int c_end)
+{
+  int w = window_size / 2;
+  int width = cmap.width;
+  int height = cmap.height;
 
-  for (unsigned int c = 0; c < cmap_dims.d[0]; c++)
+  for (int c = c_begin; c < c_end; c++)
   {
     int count = counts[c];
     auto &refined_peaks_a_bc = refined_peaks[c];
     auto &peaks_a_bc = peaks[c];
-    float *cmap_data_c = (float *)cmap_data + c * width * height;
+    const T *cmap_data_c = (const T *)cmap.data + c * cmap.stride_c;
 
     for (int p = 0; p < count; p++)
     {
@@ -174,7 +548,7 @@ refine_peaks(Vec1D<int> &counts,
           else if (jj >= width)
             jj_idx = width - (jj - width) - 2;
 
-          float weight = cmap_data_c[ii_idx * width + jj_idx];
+          float weight = load_value(cmap_data_c, ii_idx * cmap.stride_h + jj_idx * cmap.stride_w, cmap.scale);
           refined_peak[0] += weight * ii;
           refined_peak[1] += weight * jj;
           weight_sum += weight;
@@ -189,10 +563,239 @@ refine_peaks(Vec1D<int> &counts,
       refined_peak[1] /= width;
     }
   }
+}
+
+/* Peaks of a channel refined together by the quadratic fit */
+#define QUADRATIC_REFINE_CHUNK 32
+
+/* Offset of the vertex of the parabola through three samples one pixel apart, within half a pixel.
+   A profile without a maximum goes half a pixel toward its higher side. Only min and max, no
+   branches, so the loop over a chunk of peaks vectorizes. */
+static inline float
+quadratic_vertex(float before, float at, float after)
+{
+  float curvature = std::min(before - 2.0f * at + after, -1e-6f);
+  float offset = 0.5f * (before - after) / curvature;
+
+  return std::min(std::max(offset, -0.5f), 0.5f);
+}
+
+/* Least-squares fit of a + b*y + c*x + d*y^2 + e*x^2 to the 3x3 pixels around each
+   peak. The y terms only depend on the row sums and the x terms on the column sums,
+   so the vertex is that of a parabola through each. The pixels are gathered first,
+   then the vertices of a chunk of peaks are computed in one pass over flat arrays. */
+template <class T>
+static void
+refine_peaks_quadratic_typed(Vec3D<float> &refined_peaks, Vec1D<int> &counts,
+                             Vec3D<int> &peaks, const TensorView &cmap, int c_begin, int c_end)
+{
+  int width = cmap.width;
+  int height = cmap.height;
+  /* Zeroed so the entries past the last peak of a chunk hold finite values */
+  float rows[3][QUADRATIC_REFINE_CHUNK] = {};
+  float cols[3][QUADRATIC_REFINE_CHUNK] = {};
+  float offset_i[QUADRATIC_REFINE_CHUNK];
+  float offset_j[QUADRATIC_REFINE_CHUNK];
+
+  for (int c = c_begin; c < c_end; c++)
+  {
+    int count = counts[c];
+    auto &refined_peaks_c = refined_peaks[c];
+    auto &peaks_c = peaks[c];
+    const T *cmap_data_c = (const T *)cmap.data + c * cmap.stride_c;
 
+    for (int p0 = 0; p0 < count; p0 += QUADRATIC_REFINE_CHUNK)
+    {
+      int n = std::min(count - p0, QUADRATIC_REFINE_CHUNK);
+
+      for (int p = 0; p < n; p++)
+      {
+        int i = peaks_c[p0 + p][0];
+        int j = peaks_c[p0 + p][1];
+        /* Reflected at the borders, as the centroid does */
+        int ii[3] = {i > 0 ? i - 1 : 1, i, i < height - 1 ? i + 1 : height - 2};
+        int jj[3] = {j > 0 ? j - 1 : 1, j, j < width - 1 ? j + 1 : width - 2};
+
+        for (int a = 0; a < 3; a++)
+        {
+          rows[a][p] = 0.0f;
+          cols[a][p] = 0.0f;
+        }
+        for (int a = 0; a < 3; a++)
+        {
+          for (int b = 0; b < 3; b++)
+          {
+            float value = load_value(cmap_data_c, ii[a] * cmap.stride_h + jj[b] * cmap.stride_w, cmap.scale);
+            rows[a][p] += value;
+            cols[b][p] += value;
+          }
+        }
+      }
+
+      /* Over the whole chunk, a fixed trip count the compiler vectorizes at -O2 */
+      for (int p = 0; p < QUADRATIC_REFINE_CHUNK; p++)
+      {
+        offset_i[p] = quadratic_vertex(rows[0][p], rows[1][p], rows[2][p]);
+        offset_j[p] = quadratic_vertex(cols[0][p], cols[1][p], cols[2][p]);
+      }
+
+      for (int p = 0; p < n; p++)
+      {
+        auto &refined_peak = refined_peaks_c[p0 + p];
+        auto &peak = peaks_c[p0 + p];
+        refined_peak[0] = (peak[0] + offset_i[p] + 0.5f) / height;
+        refined_peak[1] = (peak[1] + offset_j[p] + 0.5f) / width;
+      }
+    }
+  }
+}
+
+/* Refines the peaks of channels [c_begin, c_end) of 'refined_peaks', which must be zeroed */
+static void
+refine_peaks_range(Vec3D<float> &refined_peaks, Vec1D<int> &counts, Vec3D<int> &peaks,
+                   const TensorView &cmap, int window_size, RefineMode mode, int c_begin, int c_end)
+{
+  if (mode == REFINE_QUADRATIC)
+    DISPATCH_TENSOR_TYPE(cmap, refine_peaks_quadratic_typed, refined_peaks, counts, peaks, cmap,
+                         c_begin, c_end);
+  else
+    DISPATCH_TENSOR_TYPE(cmap, refine_peaks_typed, refined_peaks, counts, peaks, cmap, window_size,
+                         c_begin, c_end);
+}
+
+void refine_peaks(Vec3D<float> &refined_peaks, Vec1D<int> &counts,
+                  Vec3D<int> &peaks, const TensorView &cmap, int window_size, RefineMode mode)
+{
+  reset_buffer(refined_peaks, peaks.size(), peaks[0].size(), peaks[0][0].size(), 0.0f);
+
+  refine_peaks_range(refined_peaks, counts, peaks, cmap, window_size, mode, 0, cmap.channels);
+}
+
+Vec3D<float>
+refine_peaks(Vec1D<int> &counts,
+             Vec3D<int> &peaks, const TensorView &cmap, int window_size, RefineMode mode)
+{
+  Vec3D<float> refined_peaks;
+
+  refine_peaks(refined_peaks, counts, peaks, cmap, window_size, mode);
   return refined_peaks;
 }
 
+/* The upper quartile of the per-part counts: a few occluded parts do not lower it, and a
+   part with spurious peaks does not raise it like the maximum would */
+int estimate_person_count(const Vec1D<int> &counts)
+{
+  int C = counts.size();
+  int rank = 3 * C / 4;
+  int estimate = 0;
+
+  /* Element 'rank' of the sorted counts, selected in place as there are only a few parts */
+  for (int a = 0; a < C; a++)
+  {
+    int below = 0;
+    int equal = 0;
+    for (int b = 0; b < C; b++)
+    {
+      below += counts[b] < counts[a];
+      equal += counts[b] == counts[a];
+    }
+    if (below <= rank && rank < below + equal)
+    {
+      estimate = counts[a];
+      break;
+    }
+  }
+  return estimate;
+}
+
+/* Values of a dense row tested per vectorized chunk of the presence test */
+#define PRESENCE_CHUNK 16
+
+/* Whether a value of the row reaching 'threshold' is on a pixel outside of 'mask' */
+template <class T>
+static bool
+row_present(const T *row, const TensorView &cmap, int i, float threshold, const ExclusionMask *mask)
+{
+  int C = cmap.interleaved() ? cmap.channels : 1;
+
+  for (int j = 0; j < cmap.width; j++)
+  {
+    if (mask && mask->pixelExcluded(i, j))
+      continue;
+    for (int c = 0; c < C; c++)
+    {
+      if (load_value(row, j * cmap.stride_w + c, cmap.scale) >= threshold)
+        return true;
+    }
+  }
+  return false;
+}
+
+/* Scans the map in memory order, a row at a time, and stops at the first row reaching
+   'threshold'. The test of a row is a branch-free reduction, the mask is only read after it. */
+template <class T>
+static void
+detect_presence_typed(bool *present, const TensorView &cmap, float threshold, const ExclusionMask *mask)
+{
+  const T *data = (const T *)cmap.data;
+  int num_maps = cmap.interleaved() ? 1 : cmap.channels;
+  int row_length = cmap.interleaved() ? cmap.width * cmap.channels : cmap.width;
+  int stride = cmap.interleaved() ? 1 : cmap.stride_w;
+
+  *present = false;
+  for (int c = 0; c < num_maps; c++)
+  {
+    for (int i = 0; i < cmap.height; i++)
+    {
+      const T *row = data + c * cmap.stride_c + i * cmap.stride_h;
+      int reached = 0;
+
+      /* Dense rows are tested in fixed-size chunks the compiler vectorizes */
+      int j = 0;
+      if (stride == 1)
+        for (; j + PRESENCE_CHUNK <= row_length; j += PRESENCE_CHUNK)
+          for (int k = 0; k < PRESENCE_CHUNK; k++)
+            reached |= load_value(row, j + k, cmap.scale) >= threshold;
+      for (; j < row_length; j++)
+        reached |= load_value(row, j * stride, cmap.scale) >= threshold;
+      if (reached && (!mask || row_present(row, cmap, i, threshold, mask)))
+      {
+        *present = true;
+        return;
+      }
+    }
+  }
+}
+
+bool detect_presence(const TensorView &cmap, float threshold, const ExclusionMask *mask)
+{
+  bool present = false;
+
+  DISPATCH_TENSOR_TYPE(cmap, detect_presence_typed, &present, cmap, threshold, mask);
+  return present;
+}
+
+bool output_mode_parse(const char *name, OutputMode *mode)
+{
+  for (int m = OUTPUT_SKELETONS; m <= OUTPUT_PRESENCE; m++)
+  {
+    if (strcmp(name, output_mode_name((OutputMode)m)) == 0)
+    {
+      *mode = (OutputMode)m;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *
+output_mode_name(OutputMode mode)
+{
+  static const char *names[] = {"skeletons", "keypoints", "count", "presence"};
+
+  return names[mode];
+}
+
 /* Create a bipartite graph to assign detected body-parts to a unique person in the frame. This method also takes care of finding the line integral to assign scores
    to these points */
 Vec3D<float>
@@ -200,21 +803,28 @@ paf_score_graph(void *paf_data, NvDsInferDims &paf_dims,
                 Vec2D<int> &topology, Vec1D<int> &counts,
                 Vec3D<float> &peaks, int num_integral_samples)
 {
-  int K = topology.size();
-  int H = paf_dims.d[1];
-  int W = paf_dims.d[2];
-  int max_count = peaks[0].size();
-  Vec3D<float> score_graph(K, Vec2D<float>(max_count, Vec1D<float>(max_count, 0)));
+  return paf_score_graph(make_tensor_view(paf_data, paf_dims), topology, counts, peaks,
+                         num_integral_samples);
+}
 
-  for (int k = 0; k < K; k++)
+template <class T>
+static void
+paf_score_graph_typed(Vec3D<float> &score_graph, const TensorView &paf,
+                      Vec2D<int> &topology, Vec1D<int> &counts,
+                      Vec3D<float> &peaks, int num_integral_samples, int k_begin, int k_end)
+{
+  int H = paf.height;
+  int W = paf.width;
+
+  for (int k = k_begin; k < k_end; k++)
   {
     auto &score_graph_nk = score_graph[k];
     auto &paf_i_idx = topology[k][0];
     auto &paf_j_idx = topology[k][1];
     auto &cmap_a_idx = topology[k][2];
     auto &cmap_b_idx = topology[k][3];
-    float *paf_i = (float *)paf_data + paf_i_idx * H * W;
-    float *paf_j = (float *)paf_data + paf_j_idx * H * W;
+    const T *paf_i = (const T *)paf.data + paf_i_idx * paf.stride_c;
+    const T *paf_j = (const T *)paf.data + paf_j_idx * paf.stride_c;
 
     auto &counts_a = counts[cmap_a_idx];
     auto &counts_b = counts[cmap_b_idx];
@@ -259,16 +869,17 @@ paf_score_graph(void *paf_data, NvDsInferDims &paf_dims,
           // Edge cases for if the point is out of bounds, just skip them
           if (pt_i_int < 0)
             continue;
-          if (pt_i_int > H)
+          if (pt_i_int >= H)
             continue;
           if (pt_j_int < 0)
             continue;
-          if (pt_j_int > W)
+          if (pt_j_int >= W)
             continue;
 
           // Vector at integral point
-          float pt_paf_i = paf_i[pt_i_int * W + pt_j_int];
-          float pt_paf_j = paf_j[pt_i_int * W + pt_j_int];
+          int pt_offset = pt_i_int * paf.stride_h + pt_j_int * paf.stride_w;
+          float pt_paf_i = load_value(paf_i, pt_offset, paf.scale);
+          float pt_paf_j = load_value(paf_j, pt_offset, paf.scale);
 
           // Dot Product Normalized A->B with PAF Vector
           float dot = pt_paf_i * uab_i + pt_paf_j * uab_j;
@@ -283,6 +894,28 @@ paf_score_graph(void *paf_data, NvDsInferDims &paf_dims,
       }
     }
   }
+}
+
+void paf_score_graph(Vec3D<float> &score_graph, const TensorView &paf,
+                     Vec2D<int> &topology, Vec1D<int> &counts,
+                     Vec3D<float> &peaks, int num_integral_samples)
+{
+  int K = topology.size();
+  int max_count = peaks[0].size();
+
+  reset_buffer(score_graph, K, max_count, max_count, 0.0f);
+  DISPATCH_TENSOR_TYPE(paf, paf_score_graph_typed, score_graph, paf, topology, counts, peaks,
+                       num_integral_samples, 0, K);
+}
+
+Vec3D<float>
+paf_score_graph(const TensorView &paf,
+                Vec2D<int> &topology, Vec1D<int> &counts,
+                Vec3D<float> &peaks, int num_integral_samples)
+{
+  Vec3D<float> score_graph;
+
+  paf_score_graph(score_graph, paf, topology, counts, peaks, num_integral_samples);
   return score_graph;
 }
 
@@ -290,61 +923,290 @@ paf_score_graph(void *paf_data, NvDsInferDims &paf_dims,
  This method takes care of solving the graph assignment problem using Munkres algorithm. Munkres algorithm is defind in 'munkres_algorithm.cpp'
  */
 
-Vec3D<int>
-assignment(Vec3D<float> &score_graph,
-           Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count)
+/* Negates the scores of limb k, Munkres minimizes the cost */
+static void
+negate_scores(Vec2D<float> &cost_graph_nk, Vec2D<float> &score_graph_nk)
 {
-  int K = topology.size();
-  Vec3D<int> connections(K, Vec2D<int>(M, Vec1D<int>(max_count, -1)));
+  cost_graph_nk.resize(score_graph_nk.size());
+  for (size_t i = 0; i < score_graph_nk.size(); i++)
+  {
+    cost_graph_nk[i].resize(score_graph_nk[i].size());
+    for (size_t j = 0; j < score_graph_nk[i].size(); j++)
+      cost_graph_nk[i][j] = -score_graph_nk[i][j];
+  }
+}
 
-  Vec3D<float> cost_graph = score_graph;
-  for (Vec2D<float> &cg_iter1 : cost_graph)
-    for (Vec1D<float> &cg_iter2 : cg_iter1)
-      for (float &cg_iter3 : cg_iter2)
-        cg_iter3 = -cg_iter3;
-  auto &cost_graph_out_a = cost_graph;
+/* Keeps the pairs of 'star_graph' scoring above the threshold as the connections of limb k */
+static void
+set_connections(Vec2D<int> &connections_nk, PairGraph &star_graph, Vec2D<float> &score_graph_nk,
+                int nrows, int ncols, float score_threshold)
+{
+  for (int i = 0; i < nrows; i++)
+  {
+    for (int j = 0; j < ncols; j++)
+    {
+      if (star_graph.isPair(i, j) && score_graph_nk[i][j] > score_threshold)
+      {
+        connections_nk[0][i] = j;
+        connections_nk[1][j] = i;
+      }
+    }
+  }
+}
+
+/* Solves the assignment of limb k. 'connections' and the outer dimension of 'cost_graph' are
+   sized by the caller, so different limbs can be solved concurrently. */
+static void
+assignment_limb(int k, Vec3D<int> &connections, Vec3D<float> &cost_graph, Vec3D<float> &score_graph,
+                Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold)
+{
+  auto &cost_graph_out_a_nk = cost_graph[k];
+  auto &score_graph_a_nk = score_graph[k];
+
+  negate_scores(cost_graph_out_a_nk, score_graph_a_nk);
+
+  int cmap_a_idx = topology[k][2];
+  int cmap_b_idx = topology[k][3];
+  int nrows = counts[cmap_a_idx];
+  int ncols = counts[cmap_b_idx];
+  auto star_graph = PairGraph(nrows, ncols);
+  munkres_algorithm(cost_graph_out_a_nk, star_graph, nrows, ncols);
+  set_connections(connections[k], star_graph, score_graph_a_nk, nrows, ncols, score_threshold);
+}
+
+void assignment(Vec3D<int> &connections, Vec3D<float> &cost_graph, Vec3D<float> &score_graph,
+                Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count)
+{
+  int K = topology.size();
+  reset_buffer(connections, K, M, max_count, -1);
+  cost_graph.resize(score_graph.size());
 
   for (int k = 0; k < K; k++)
+    assignment_limb(k, connections, cost_graph, score_graph, topology, counts, score_threshold);
+}
+
+void warm_start_map_peaks(AssignmentState &state, int num_limbs, Vec1D<int> &counts, Vec3D<float> &peaks)
+{
+  int C = counts.size();
+  const float max_dist2 = WARM_START_MAX_SHIFT * WARM_START_MAX_SHIFT;
+  Vec1D<float> best_dist2;
+
+  if (!state.valid || (int)state.counts.size() != C)
   {
-    int cmap_a_idx = topology[k][2];
-    int cmap_b_idx = topology[k][3];
-    int nrows = counts[cmap_a_idx];
-    int ncols = counts[cmap_b_idx];
-    auto star_graph = PairGraph(nrows, ncols);
-    auto &cost_graph_out_a_nk = cost_graph_out_a[k];
-    munkres_algorithm(cost_graph_out_a_nk, star_graph, nrows, ncols);
+    state.counts.assign(C, 0);
+    state.matches.clear();
+    state.potentials_a.clear();
+    state.potentials_b.clear();
+  }
+  state.matches.resize(num_limbs);
+  state.potentials_a.resize(num_limbs);
+  state.potentials_b.resize(num_limbs);
+  state.prev_of.resize(C);
+  state.next_of.resize(C);
 
-    auto &connections_a_nk = connections[k];
-    auto &score_graph_a_nk = score_graph[k];
+  for (int c = 0; c < C; c++)
+  {
+    int num_prev = state.counts[c];
+    auto &prev_of = state.prev_of[c];
+    auto &next_of = state.next_of[c];
 
-    for (int i = 0; i < nrows; i++)
+    prev_of.assign(counts[c], -1);
+    next_of.assign(num_prev, -1);
+    best_dist2.assign(num_prev, INFINITY);
+
+    /* Each peak takes its nearest predecessor, which keeps the closest of the peaks taking it */
+    for (int p = 0; p < counts[c]; p++)
     {
-      for (int j = 0; j < ncols; j++)
+      int nearest = -1;
+      float nearest_dist2 = max_dist2;
+      for (int q = 0; q < num_prev; q++)
       {
-        if (star_graph.isPair(i, j) && score_graph_a_nk[i][j] > score_threshold)
+        float di = peaks[c][p][0] - state.peaks[c][q][0];
+        float dj = peaks[c][p][1] - state.peaks[c][q][1];
+        float dist2 = di * di + dj * dj;
+        if (dist2 < nearest_dist2)
         {
-          connections_a_nk[0][i] = j;
-          connections_a_nk[1][j] = i;
+          nearest_dist2 = dist2;
+          nearest = q;
         }
       }
+      if (nearest < 0 || nearest_dist2 >= best_dist2[nearest])
+        continue;
+      if (next_of[nearest] >= 0)
+        prev_of[next_of[nearest]] = -1;
+      next_of[nearest] = p;
+      prev_of[p] = nearest;
+      best_dist2[nearest] = nearest_dist2;
+    }
+  }
+}
+
+/* Warm-started assignment of limb k, after 'warm_start_map_peaks'. Only touches the entries of limb k. */
+static void
+warm_start_assignment_limb(int k, Vec3D<int> &connections, Vec3D<float> &cost_graph, Vec3D<float> &score_graph,
+                           Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold,
+                           AssignmentState &state)
+{
+  int cmap_a_idx = topology[k][2];
+  int cmap_b_idx = topology[k][3];
+  int nrows = counts[cmap_a_idx];
+  int ncols = counts[cmap_b_idx];
+  auto &prev_of_a = state.prev_of[cmap_a_idx];
+  auto &prev_of_b = state.prev_of[cmap_b_idx];
+  auto &next_of_b = state.next_of[cmap_b_idx];
+  auto &matches = state.matches[k];
+  Vec1D<float> row_potentials(nrows, 0.0f), col_potentials(ncols, 0.0f);
+  Vec1D<int> seed(nrows, -1);
+
+  negate_scores(cost_graph[k], score_graph[k]);
+
+  /* The previous solution, carried over to the current peaks */
+  for (int i = 0; i < nrows; i++)
+  {
+    int q = prev_of_a[i];
+    if (q < 0 || q >= (int)matches.size())
+      continue;
+    row_potentials[i] = state.potentials_a[k][q];
+    if (matches[q] >= 0)
+      seed[i] = next_of_b[matches[q]];
+  }
+  for (int j = 0; j < ncols; j++)
+  {
+    int q = prev_of_b[j];
+    if (q >= 0 && q < (int)state.potentials_b[k].size())
+      col_potentials[j] = state.potentials_b[k][q];
+  }
+
+  PairGraph star_graph(nrows, ncols);
+  int num_augmentations = munkres_warm_start(cost_graph[k], star_graph, nrows, ncols,
+                                             row_potentials, col_potentials, seed);
+  set_connections(connections[k], star_graph, score_graph[k], nrows, ncols, score_threshold);
+
+  matches.assign(nrows, -1);
+  for (int i = 0; i < nrows; i++)
+  {
+    if (star_graph.isRowSet(i))
+      matches[i] = star_graph.colForRow(i);
+  }
+  state.potentials_a[k] = row_potentials;
+  state.potentials_b[k] = col_potentials;
+
+  __atomic_fetch_add(&state.num_rows, (guint64)std::min(nrows, ncols), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&state.num_augmentations, (guint64)num_augmentations, __ATOMIC_RELAXED);
+}
+
+/* Keeps the peaks of the frame for the mapping of the next one */
+static void
+warm_start_save_peaks(AssignmentState &state, Vec1D<int> &counts, Vec3D<float> &peaks)
+{
+  state.counts = counts;
+  state.peaks = peaks;
+  state.valid = true;
+}
+
+void warm_start_assignment(Vec3D<int> &connections, Vec3D<float> &cost_graph, Vec3D<float> &score_graph,
+                           Vec2D<int> &topology, Vec1D<int> &counts, Vec3D<float> &peaks,
+                           float score_threshold, int max_count, AssignmentState &state)
+{
+  int K = topology.size();
+
+  reset_buffer(connections, K, M, max_count, -1);
+  cost_graph.resize(score_graph.size());
+  warm_start_map_peaks(state, K, counts, peaks);
+
+  for (int k = 0; k < K; k++)
+    warm_start_assignment_limb(k, connections, cost_graph, score_graph, topology, counts, score_threshold, state);
+  warm_start_save_peaks(state, counts, peaks);
+}
+
+Vec3D<int>
+assignment(Vec3D<float> &score_graph,
+           Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count)
+{
+  Vec3D<int> connections;
+  Vec3D<float> cost_graph;
+
+  assignment(connections, cost_graph, score_graph, topology, counts, score_threshold, max_count);
+  return connections;
+}
+
+/* Cheaper alternative to 'assignment'. Candidate links are visited in order of
+   decreasing score and accepted while both end points are still free. The result
+   is not guaranteed to be optimal but needs no Munkres iterations. */
+/* Greedy assignment of limb k, 'candidates' is scratch space */
+static void
+greedy_assignment_limb(int k, Vec3D<int> &connections, Vec3D<float> &score_graph,
+                       Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold,
+                       Vec1D<std::tuple<float, int, int>> &candidates)
+{
+  int nrows = counts[topology[k][2]];
+  int ncols = counts[topology[k][3]];
+  auto &score_graph_a_nk = score_graph[k];
+  auto &connections_a_nk = connections[k];
+
+  candidates.clear();
+  for (int i = 0; i < nrows; i++)
+  {
+    for (int j = 0; j < ncols; j++)
+    {
+      if (score_graph_a_nk[i][j] > score_threshold)
+      {
+        candidates.emplace_back(score_graph_a_nk[i][j], i, j);
+      }
     }
   }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const std::tuple<float, int, int> &a, const std::tuple<float, int, int> &b) {
+              return std::get<0>(a) > std::get<0>(b);
+            });
+
+  for (auto &candidate : candidates)
+  {
+    int i = std::get<1>(candidate);
+    int j = std::get<2>(candidate);
+    if (connections_a_nk[0][i] < 0 && connections_a_nk[1][j] < 0)
+    {
+      connections_a_nk[0][i] = j;
+      connections_a_nk[1][j] = i;
+    }
+  }
+}
+
+void greedy_assignment(Vec3D<int> &connections, Vec3D<float> &score_graph,
+                       Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count)
+{
+  int K = topology.size();
+  Vec1D<std::tuple<float, int, int>> candidates;
+
+  reset_buffer(connections, K, M, max_count, -1);
+
+  for (int k = 0; k < K; k++)
+    greedy_assignment_limb(k, connections, score_graph, topology, counts, score_threshold, candidates);
+}
+
+Vec3D<int>
+greedy_assignment(Vec3D<float> &score_graph,
+                  Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count)
+{
+  Vec3D<int> connections;
+
+  greedy_assignment(connections, score_graph, topology, counts, score_threshold, max_count);
   return connections;
 }
 
 /* This method takes care of connecting all the body parts detected to each other 
    after finding the relationships between them in the 'assignment' method */
-Vec2D<int>
-connect_parts(
-    Vec3D<int> &connections, Vec2D<int> &topology, Vec1D<int> &counts,
-    int max_count)
+void connect_parts(Vec2D<int> &objects, Vec2D<int> &visited,
+                   Vec3D<int> &connections, Vec2D<int> &topology, Vec1D<int> &counts,
+                   int max_count)
 {
   int K = topology.size();
   int C = counts.size();
+  /* Indexed by peak, the capacity of a part may exceed the number of objects */
+  int max_peaks = C > 0 ? *std::max_element(counts.begin(), counts.end()) : 0;
 
-  Vec2D<int> visited(C, Vec1D<int>(max_count, 0));
-
-  Vec2D<int> objects(max_count, Vec1D<int>(C, -1));
+  reset_buffer(visited, C, max_peaks, 0);
+  objects.reserve(max_count);
 
   int num_objects = 0;
   for (int c = 0; c < C; c++)
@@ -367,6 +1229,10 @@ connect_parts(
       bool new_object = false;
       q.push({c, i});
 
+      if ((int)objects.size() <= num_objects)
+        objects.emplace_back();
+      objects[num_objects].assign(C, -1);
+
       while (!q.empty())
       {
         auto node = q.front();
@@ -416,5 +1282,458 @@ connect_parts(
   }
 
   objects.resize(num_objects);
+}
+
+Vec2D<int>
+connect_parts(
+    Vec3D<int> &connections, Vec2D<int> &topology, Vec1D<int> &counts,
+    int max_count)
+{
+  Vec2D<int> objects;
+  Vec2D<int> visited;
+
+  connect_parts(objects, visited, connections, topology, counts, max_count);
   return objects;
-}
\ No newline at end of file
+}
+
+PoseBatchFrame &
+PoseBatch::add(const TensorView &cmap, const TensorView &paf, const PostProcessParams &params,
+               const SearchRegion *region, AssignmentState *assignment_state, const ExclusionMask *mask)
+{
+  if ((int)frames_.size() <= num_frames_)
+    frames_.emplace_back();
+
+  PoseBatchFrame &frame = frames_[num_frames_++];
+  frame.cmap = cmap;
+  frame.paf = paf;
+  frame.params = params;
+  frame.region = region;
+  frame.assignment_state = assignment_state;
+  frame.mask = mask;
+  frame.result.objects.clear();
+  frame.result.ids.clear();
+  frame.result.predicted = false;
+  frame.result.mode = params.output_mode;
+  frame.result.count = 0;
+  frame.timings = PostProcessTimings();
+  frame.counters = PerfStageCounts();
+  frame.full_scan = true;
+  frame.warm_start = false;
+  return frame;
+}
+
+/* Decides whether a frame is assigned with the warm start. Below WARM_START_MIN_PEAKS
+   candidates, the state of the stream is dropped and the next large frame starts from scratch. */
+static void
+select_warm_start(PoseBatchFrame &frame)
+{
+  frame.warm_start = false;
+  if (!frame.assignment_state || frame.params.greedy_assignment)
+    return;
+
+  if (*std::max_element(frame.counts.begin(), frame.counts.end()) >= WARM_START_MIN_PEAKS)
+    frame.warm_start = true;
+  else
+    frame.assignment_state->valid = false;
+}
+
+/* Adds the run time of a task to a stage timing of its frame */
+static void
+add_task_time(gint64 *timing, gint64 t0)
+{
+  __atomic_fetch_add(timing, g_get_monotonic_time() - t0, __ATOMIC_RELAXED);
+}
+
+/* Reads the hardware counters of the calling thread before a stage, when profiling */
+static inline void
+profile_start(bool profiling, PerfCounts *start)
+{
+  if (profiling)
+    perf_counters_read(start);
+}
+
+/* Adds the events of the calling thread since 'profile_start' to the counts of a stage */
+static inline void
+profile_stop(bool profiling, PerfCounts *total, const PerfCounts *start)
+{
+  if (profiling)
+    perf_counts_add_since(total, start);
+}
+
+/* Whether the output layers of 'frame' can be post-processed with 'topology' */
+static bool
+frame_supported(const PoseBatchFrame &frame, const Vec2D<int> &topology)
+{
+  if (frame.cmap.type == INT32 || frame.paf.type == INT32)
+  {
+    g_printerr("INT32 output layers are not supported\n");
+    return false;
+  }
+  for (const Vec1D<int> &limb : topology)
+  {
+    if (limb[0] >= frame.paf.channels || limb[1] >= frame.paf.channels || limb[2] >= frame.cmap.channels ||
+        limb[3] >= frame.cmap.channels)
+    {
+      g_printerr("The topology does not fit the %d cmap and %d paf channels\n", frame.cmap.channels,
+                 frame.paf.channels);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Whether 'frame' goes through the stages leading to the result of 'mode' */
+static inline bool
+runs_stages(const PoseBatchFrame &frame, OutputMode mode)
+{
+  return frame.supported && frame.params.output_mode <= mode;
+}
+
+/* The presence mode only scans the confidence map, until the first value above the threshold */
+static void
+detect_frame_presence(PoseBatchFrame &frame, bool profiling)
+{
+  PerfCounts c0;
+  profile_start(profiling, &c0);
+  gint64 t0 = g_get_monotonic_time();
+
+  frame.counts.assign(frame.cmap.channels, 0);
+  frame.result.count = detect_presence(frame.cmap, frame.params.threshold, frame.mask) ? 1 : 0;
+  frame.timings.find_peaks = g_get_monotonic_time() - t0;
+  profile_stop(profiling, &frame.counters.stages[PERF_STAGE_FIND_PEAKS], &c0);
+}
+
+/* Sets the people count of the frame and drops the peaks the mode does not report */
+static void
+finish_result(PoseBatchFrame &frame)
+{
+  PoseResult &result = frame.result;
+
+  if (!frame.supported)
+  {
+    result.counts.clear();
+    return;
+  }
+
+  result.counts.assign(frame.counts.begin(), frame.counts.end());
+  if (frame.params.output_mode == OUTPUT_SKELETONS)
+    result.count = result.objects.size();
+  else if (frame.params.output_mode != OUTPUT_PRESENCE)
+    result.count = estimate_person_count(frame.counts);
+  if (frame.params.output_mode >= OUTPUT_COUNT)
+  {
+    result.peaks.clear();
+    result.scores.clear();
+  }
+}
+
+void PoseBatch::runTasks(Vec2D<int> &topology, TaskScheduler *scheduler)
+{
+  int K = topology.size();
+
+  /* The buffers are sized here, the tasks only write inside them */
+  tasks_.clear();
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    int C = frame.cmap.channels;
+
+    frame.supported = frame_supported(frame, topology);
+    if (!frame.supported)
+    {
+      frame.result.peaks.clear();
+      frame.result.scores.clear();
+      continue;
+    }
+    if (frame.params.output_mode == OUTPUT_PRESENCE)
+    {
+      detect_frame_presence(frame, profiling_);
+      continue;
+    }
+
+    frame.counts.assign(C, 0);
+    reset_buffer(frame.peaks, C, frame.params.max_num_parts, M, 0);
+    frame.full_scan = (frame.region == NULL);
+
+    /* An interleaved map is searched in one pass over all its channels */
+    if (frame.cmap.interleaved())
+      tasks_.push_back(FrameTask{f, -1});
+    else
+      for (int c = 0; c < C; c++)
+        tasks_.push_back(FrameTask{f, c});
+  }
+
+  /* Finding peaks within a given window, in the search region first */
+  auto find_peaks_task = [&](int t) {
+    PerfCounts c0;
+    profile_start(profiling_, &c0);
+    gint64 t0 = g_get_monotonic_time();
+    PoseBatchFrame &frame = frames_[tasks_[t].frame];
+    const PostProcessParams &params = frame.params;
+    int c_begin = tasks_[t].part < 0 ? 0 : tasks_[t].part;
+    int c_end = tasks_[t].part < 0 ? frame.cmap.channels : c_begin + 1;
+    const SearchRegion *region = frame.full_scan ? NULL : frame.region;
+
+    DISPATCH_TENSOR_TYPE(frame.cmap, find_peaks_typed, frame.counts, frame.peaks, frame.cmap, params.threshold,
+                         params.window_size, params.max_num_parts, region, params.coarse_to_fine, frame.mask,
+                         c_begin, c_end);
+    add_task_time(&frame.timings.find_peaks, t0);
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_FIND_PEAKS], &c0);
+  };
+  scheduler->parallelFor(tasks_.size(), find_peaks_task);
+
+  /* A peak in the entry band of the search region triggers a full scan of the frame */
+  int num_searched = tasks_.size();
+  for (int t = 0; t < num_searched; t++)
+  {
+    PoseBatchFrame &frame = frames_[tasks_[t].frame];
+    if (frame.full_scan || (t > 0 && tasks_[t - 1].frame == tasks_[t].frame))
+      continue;
+    if (count_peaks_in_region(frame.counts, frame.peaks, *frame.region, SEARCH_TILE_ENTRY) > 0)
+      frame.full_scan = true;
+    else
+      continue;
+    for (int r = t; r < num_searched && tasks_[r].frame == tasks_[t].frame; r++)
+      tasks_.push_back(tasks_[r]);
+  }
+  tasks_.erase(tasks_.begin(), tasks_.begin() + num_searched);
+  scheduler->parallelFor(tasks_.size(), find_peaks_task);
+
+  /* Sub-pixel refinement and peak scores, per channel */
+  tasks_.clear();
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    if (!runs_stages(frame, OUTPUT_KEYPOINTS))
+      continue;
+
+    reset_buffer(frame.result.peaks, frame.peaks.size(), frame.peaks[0].size(), M, 0.0f);
+    reset_buffer(frame.result.scores, frame.peaks.size(), frame.peaks[0].size(), 0.0f);
+    for (int c = 0; c < frame.cmap.channels; c++)
+      tasks_.push_back(FrameTask{f, c});
+  }
+  scheduler->parallelFor(tasks_.size(), [&](int t) {
+    PerfCounts c0;
+    profile_start(profiling_, &c0);
+    gint64 t0 = g_get_monotonic_time();
+    PoseBatchFrame &frame = frames_[tasks_[t].frame];
+    int c = tasks_[t].part;
+
+    refine_peaks_range(frame.result.peaks, frame.counts, frame.peaks, frame.cmap, frame.params.window_size,
+                       frame.params.refine_mode, c, c + 1);
+    DISPATCH_TENSOR_TYPE(frame.cmap, peak_scores_typed, frame.result.scores, frame.counts, frame.peaks,
+                         frame.cmap, c, c + 1);
+    add_task_time(&frame.timings.refine_peaks, t0);
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_REFINE_PEAKS], &c0);
+  });
+
+  /* Bipartite graph of the candidate limbs, per limb */
+  tasks_.clear();
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    if (!runs_stages(frame, OUTPUT_SKELETONS))
+      continue;
+
+    int max_count = frame.peaks[0].size();
+    reset_buffer(frame.score_graph, K, max_count, max_count, 0.0f);
+    reset_buffer(frame.connections, K, M, frame.params.max_num_parts, -1);
+    frame.cost_graph.resize(K);
+    select_warm_start(frame);
+    if (frame.warm_start)
+      warm_start_map_peaks(*frame.assignment_state, K, frame.counts, frame.result.peaks);
+    for (int k = 0; k < K; k++)
+      tasks_.push_back(FrameTask{f, k});
+  }
+  scheduler->parallelFor(tasks_.size(), [&](int t) {
+    PerfCounts c0;
+    profile_start(profiling_, &c0);
+    gint64 t0 = g_get_monotonic_time();
+    PoseBatchFrame &frame = frames_[tasks_[t].frame];
+    int k = tasks_[t].part;
+
+    DISPATCH_TENSOR_TYPE(frame.paf, paf_score_graph_typed, frame.score_graph, frame.paf, topology, frame.counts,
+                         frame.result.peaks, frame.params.num_integral_samples, k, k + 1);
+    add_task_time(&frame.timings.paf_score_graph, t0);
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_PAF_SCORE_GRAPH], &c0);
+  });
+
+  /* Limb assignment, per limb */
+  scheduler->parallelFor(tasks_.size(), [&](int t) {
+    PerfCounts c0;
+    profile_start(profiling_, &c0);
+    gint64 t0 = g_get_monotonic_time();
+    PoseBatchFrame &frame = frames_[tasks_[t].frame];
+    const PostProcessParams &params = frame.params;
+    int k = tasks_[t].part;
+
+    if (params.greedy_assignment)
+    {
+      Vec1D<std::tuple<float, int, int>> candidates;
+      greedy_assignment_limb(k, frame.connections, frame.score_graph, topology, frame.counts,
+                             params.link_threshold, candidates);
+    }
+    else if (frame.warm_start)
+    {
+      warm_start_assignment_limb(k, frame.connections, frame.cost_graph, frame.score_graph, topology,
+                                 frame.counts, params.link_threshold, *frame.assignment_state);
+    }
+    else
+    {
+      assignment_limb(k, frame.connections, frame.cost_graph, frame.score_graph, topology, frame.counts,
+                      params.link_threshold);
+    }
+    add_task_time(&frame.timings.assignment, t0);
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_ASSIGNMENT], &c0);
+  });
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    if (runs_stages(frame, OUTPUT_SKELETONS) && frame.warm_start)
+      warm_start_save_peaks(*frame.assignment_state, frame.counts, frame.result.peaks);
+  }
+
+  /* Connecting all the body parts and forming the skeletons, per frame */
+  scheduler->parallelFor(num_frames_, [&](int f) {
+    PerfCounts c0;
+    profile_start(profiling_, &c0);
+    gint64 t0 = g_get_monotonic_time();
+    PoseBatchFrame &frame = frames_[f];
+    if (!runs_stages(frame, OUTPUT_SKELETONS))
+      return;
+
+    connect_parts(frame.result.objects, frame.visited, frame.connections, topology, frame.counts,
+                  frame.params.max_num_objects);
+    add_task_time(&frame.timings.connect_parts, t0);
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_CONNECT_PARTS], &c0);
+  });
+
+  for (int f = 0; f < num_frames_; f++)
+    finish_result(frames_[f]);
+}
+
+void PoseBatch::run(Vec2D<int> &topology, TaskScheduler *scheduler)
+{
+  gint64 t0, t1;
+  PerfCounts c0;
+
+  if (scheduler && scheduler->numThreads() > 0)
+  {
+    runTasks(topology, scheduler);
+    return;
+  }
+
+  /* Finding peaks within a given window. A peak in the entry band of the
+     search region triggers a full scan of the frame. */
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    const PostProcessParams &params = frame.params;
+
+    frame.supported = frame_supported(frame, topology);
+    if (!frame.supported)
+    {
+      frame.result.peaks.clear();
+      frame.result.scores.clear();
+      continue;
+    }
+    if (params.output_mode == OUTPUT_PRESENCE)
+    {
+      detect_frame_presence(frame, profiling_);
+      continue;
+    }
+
+    profile_start(profiling_, &c0);
+    t0 = g_get_monotonic_time();
+    find_peaks(frame.counts, frame.peaks, frame.cmap, params.threshold, params.window_size,
+               params.max_num_parts, frame.region, params.coarse_to_fine, frame.mask);
+    frame.full_scan = (frame.region == NULL);
+    if (frame.region && count_peaks_in_region(frame.counts, frame.peaks, *frame.region, SEARCH_TILE_ENTRY) > 0)
+    {
+      find_peaks(frame.counts, frame.peaks, frame.cmap, params.threshold, params.window_size,
+                 params.max_num_parts, NULL, params.coarse_to_fine, frame.mask);
+      frame.full_scan = true;
+    }
+    t1 = g_get_monotonic_time();
+    frame.timings.find_peaks = t1 - t0;
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_FIND_PEAKS], &c0);
+  }
+
+  /* Sub-pixel refinement and peak scores */
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    if (!runs_stages(frame, OUTPUT_KEYPOINTS))
+      continue;
+
+    profile_start(profiling_, &c0);
+    t0 = g_get_monotonic_time();
+    refine_peaks(frame.result.peaks, frame.counts, frame.peaks, frame.cmap, frame.params.window_size,
+                 frame.params.refine_mode);
+    peak_scores(frame.result.scores, frame.counts, frame.peaks, frame.cmap);
+    t1 = g_get_monotonic_time();
+    frame.timings.refine_peaks = t1 - t0;
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_REFINE_PEAKS], &c0);
+  }
+
+  /* Bipartite graph of the candidate limbs, scored with the part affinity fields */
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    if (!runs_stages(frame, OUTPUT_SKELETONS))
+      continue;
+
+    profile_start(profiling_, &c0);
+    t0 = g_get_monotonic_time();
+    paf_score_graph(frame.score_graph, frame.paf, topology, frame.counts, frame.result.peaks,
+                    frame.params.num_integral_samples);
+    t1 = g_get_monotonic_time();
+    frame.timings.paf_score_graph = t1 - t0;
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_PAF_SCORE_GRAPH], &c0);
+  }
+
+  /* Limb assignment */
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    const PostProcessParams &params = frame.params;
+    if (!runs_stages(frame, OUTPUT_SKELETONS))
+      continue;
+
+    profile_start(profiling_, &c0);
+    t0 = g_get_monotonic_time();
+    select_warm_start(frame);
+    if (params.greedy_assignment)
+      greedy_assignment(frame.connections, frame.score_graph, topology, frame.counts,
+                        params.link_threshold, params.max_num_parts);
+    else if (frame.warm_start)
+      warm_start_assignment(frame.connections, frame.cost_graph, frame.score_graph, topology, frame.counts,
+                            frame.result.peaks, params.link_threshold, params.max_num_parts,
+                            *frame.assignment_state);
+    else
+      assignment(frame.connections, frame.cost_graph, frame.score_graph, topology, frame.counts,
+                 params.link_threshold, params.max_num_parts);
+    t1 = g_get_monotonic_time();
+    frame.timings.assignment = t1 - t0;
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_ASSIGNMENT], &c0);
+  }
+
+  /* Connecting all the body parts and forming the skeletons */
+  for (int f = 0; f < num_frames_; f++)
+  {
+    PoseBatchFrame &frame = frames_[f];
+    if (!runs_stages(frame, OUTPUT_SKELETONS))
+      continue;
+
+    profile_start(profiling_, &c0);
+    t0 = g_get_monotonic_time();
+    connect_parts(frame.result.objects, frame.visited, frame.connections, topology, frame.counts,
+                  frame.params.max_num_objects);
+    t1 = g_get_monotonic_time();
+    frame.timings.connect_parts = t1 - t0;
+    profile_stop(profiling_, &frame.counters.stages[PERF_STAGE_CONNECT_PARTS], &c0);
+  }
+
+  for (int f = 0; f < num_frames_; f++)
+    finish_result(frames_[f]);
+}
@@ -1,5 +1,12 @@
+#pragma once
+
 #include "pair_graph.hpp"
 #include "cover_table.hpp"
+#include "search_region.hpp"
+#include "exclusion_mask.hpp"
+#include "tensor_view.hpp"
+#include "task_scheduler.hpp"
+#include "perf_counters.hpp"
 //#include "munkres_algorithm.cpp"
 #include "munkres_algorithm.hpp"
 
@@ -27,24 +34,307 @@ using Vec2D = std::vector<Vec1D<T>>;
 template <class T>
 using Vec3D = std::vector<Vec2D<T>>;
 
+/* Sub-pixel refinement of the peaks */
+enum RefineMode
+{
+  /* Weighted centroid of the window_size x window_size neighbourhood */
+  REFINE_CENTROID,
+  /* Vertex of a separable quadratic fitted to the 3x3 neighbourhood */
+  REFINE_QUADRATIC,
+};
+
+/* How far the post-processing chain goes, each mode skipping the stages after its result */
+enum OutputMode
+{
+  /* Peaks grouped into skeletons, the whole chain */
+  OUTPUT_SKELETONS,
+  /* Refined peaks and their scores, without the part affinity fields and the grouping */
+  OUTPUT_KEYPOINTS,
+  /* Number of people estimated from the peak counts, without the refinement */
+  OUTPUT_COUNT,
+  /* Whether the confidence maps reach the threshold anywhere, without the peak search */
+  OUTPUT_PRESENCE,
+};
+
+/* "skeletons", "keypoints", "count" or "presence", returns false for another name */
+bool output_mode_parse(const char *name, OutputMode *mode);
+
+const char *
+output_mode_name(OutputMode mode);
+
+/* Tunable parameters of the post-processing chain */
+struct PostProcessParams
+{
+  float threshold;
+  int window_size;
+  int max_num_parts;
+  int num_integral_samples;
+  float link_threshold;
+  int max_num_objects;
+  bool greedy_assignment;
+  bool coarse_to_fine;
+  RefineMode refine_mode;
+  OutputMode output_mode;
+};
+
+/* Skeletons found in one frame */
+struct PoseResult
+{
+  /* objects[n][c] is the index in peaks[c] of body part c of person n, or -1 */
+  Vec2D<int> objects;
+  /* Normalized {y, x} position of each peak, the first counts[c] of peaks[c] are set.
+     Empty in the count and presence modes. */
+  Vec3D<float> peaks;
+  Vec1D<int> counts;
+  /* Confidence map value of each peak, empty when the skeletons were predicted */
+  Vec2D<float> scores;
+  /* Track id of each person, empty when tracking is off */
+  Vec1D<guint64> ids;
+  bool predicted;
+  /* Output mode of the stream, only the skeleton mode fills 'objects' */
+  OutputMode mode;
+  /* People in the frame: the skeletons, an estimate from the peak counts, or 1 when anyone is present */
+  int count;
+};
+
+/* Time spent in each post-processing stage of one frame, in microseconds */
+struct PostProcessTimings
+{
+  gint64 find_peaks;
+  gint64 refine_peaks;
+  gint64 paf_score_graph;
+  gint64 assignment;
+  gint64 connect_parts;
+
+  gint64 total() const
+  {
+    return find_peaks + refine_peaks + paf_score_graph + assignment + connect_parts;
+  }
+};
+
+Vec2D<int>
+default_topology();
+
 void find_peaks(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, void *cmap_data,
-                NvDsInferDims &cmap_dims, float threshold, int window_size, int max_count);
+                NvDsInferDims &cmap_dims, float threshold, int window_size, int max_count,
+                const SearchRegion *region = NULL, bool coarse_to_fine = false);
+
+void find_peaks(Vec1D<int> &counts_out, Vec3D<int> &peaks_out, const TensorView &cmap,
+                float threshold, int window_size, int max_count,
+                const SearchRegion *region = NULL, bool coarse_to_fine = false,
+                const ExclusionMask *mask = NULL);
+
+Vec2D<float>
+peak_scores(Vec1D<int> &counts, Vec3D<int> &peaks, const TensorView &cmap);
+
+void peak_scores(Vec2D<float> &scores, Vec1D<int> &counts, Vec3D<int> &peaks, const TensorView &cmap);
+
+int count_peaks_in_region(Vec1D<int> &counts, Vec3D<int> &peaks,
+                          const SearchRegion &region, uint8_t state);
+
+void build_search_region(SearchRegion &region, Vec2D<int> &objects, Vec3D<float> &normalized_peaks,
+                         NvDsInferDims &cmap_dims, int margin);
 
 Vec3D<float>
 refine_peaks(Vec1D<int> &counts,
              Vec3D<int> &peaks, void *cmap_data, NvDsInferDims &cmap_dims,
              int window_size);
 
+Vec3D<float>
+refine_peaks(Vec1D<int> &counts,
+             Vec3D<int> &peaks, const TensorView &cmap, int window_size,
+             RefineMode mode = REFINE_CENTROID);
+
+/* 'window_size' only applies to REFINE_CENTROID, the quadratic fit always reads 3x3 pixels */
+void refine_peaks(Vec3D<float> &refined_peaks, Vec1D<int> &counts,
+                  Vec3D<int> &peaks, const TensorView &cmap, int window_size,
+                  RefineMode mode = REFINE_CENTROID);
+
+/* Number of people suggested by the peaks of each part, robust to a few occluded or spurious parts */
+int estimate_person_count(const Vec1D<int> &counts);
+
+/* Whether some value of 'cmap' outside of 'mask' reaches 'threshold' */
+bool detect_presence(const TensorView &cmap, float threshold, const ExclusionMask *mask = NULL);
+
 Vec3D<float>
 paf_score_graph(void *paf_data, NvDsInferDims &paf_dims,
                 Vec2D<int> &topology, Vec1D<int> &counts,
                 Vec3D<float> &peaks, int num_integral_samples);
 
+Vec3D<float>
+paf_score_graph(const TensorView &paf,
+                Vec2D<int> &topology, Vec1D<int> &counts,
+                Vec3D<float> &peaks, int num_integral_samples);
+
+void paf_score_graph(Vec3D<float> &score_graph, const TensorView &paf,
+                     Vec2D<int> &topology, Vec1D<int> &counts,
+                     Vec3D<float> &peaks, int num_integral_samples);
+
 Vec3D<int>
 assignment(Vec3D<float> &score_graph,
            Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count);
 
+/* 'cost_graph' is scratch space for the negated scores */
+void assignment(Vec3D<int> &connections, Vec3D<float> &cost_graph, Vec3D<float> &score_graph,
+                Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count);
+
+/* Largest normalized distance a peak may move between two frames and still inherit the assignment of its predecessor */
+#define WARM_START_MAX_SHIFT 0.05f
+
+/* Candidates of the busiest body part below which PoseBatch solves a frame with Munkres, which is faster on small scenes */
+#define WARM_START_MIN_PEAKS 12
+
+/* Solution of the previous frame of a stream, to warm-start its next assignment */
+struct AssignmentState
+{
+  /* Normalized peaks of the previous frame */
+  Vec1D<int> counts;
+  Vec3D<float> peaks;
+  /* Per limb, indexed by the previous peaks: the matched peak b of each peak a, and the dual potentials */
+  Vec2D<int> matches;
+  Vec2D<float> potentials_a;
+  Vec2D<float> potentials_b;
+  /* Per channel, the previous peak of each current peak and the reverse, -1 when none is close enough */
+  Vec2D<int> prev_of;
+  Vec2D<int> next_of;
+  bool valid;
+
+  /* Rows of the solved limbs and the augmenting paths they needed */
+  guint64 num_rows;
+  guint64 num_augmentations;
+
+  AssignmentState() : valid(false), num_rows(0), num_augmentations(0) {}
+};
+
+/* Matches the peaks of the current frame with those of the previous one, before 'warm_start_assignment' */
+void warm_start_map_peaks(AssignmentState &state, int num_limbs, Vec1D<int> &counts, Vec3D<float> &peaks);
+
+/**
+ * 'assignment' seeded with the matching and the dual potentials of the
+ * previous frame of the stream, carried over to the nearest peaks. The
+ * matchings have the same optimal cost as 'assignment' and may only differ
+ * between equally good ones. 'state' is updated for the next frame.
+ */
+void warm_start_assignment(Vec3D<int> &connections, Vec3D<float> &cost_graph, Vec3D<float> &score_graph,
+                           Vec2D<int> &topology, Vec1D<int> &counts, Vec3D<float> &peaks,
+                           float score_threshold, int max_count, AssignmentState &state);
+
+Vec3D<int>
+greedy_assignment(Vec3D<float> &score_graph,
+                  Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count);
+
+void greedy_assignment(Vec3D<int> &connections, Vec3D<float> &score_graph,
+                       Vec2D<int> &topology, Vec1D<int> &counts, float score_threshold, int max_count);
+
 Vec2D<int>
 connect_parts(
     Vec3D<int> &connections, Vec2D<int> &topology, Vec1D<int> &counts,
     int max_count);
+
+/* 'visited' is scratch space */
+void connect_parts(Vec2D<int> &objects, Vec2D<int> &visited,
+                   Vec3D<int> &connections, Vec2D<int> &topology, Vec1D<int> &counts,
+                   int max_count);
+
+/* One frame of a PoseBatch: its tensors and parameters, its results and its scratch buffers */
+struct PoseBatchFrame
+{
+  TensorView cmap;
+  TensorView paf;
+  PostProcessParams params;
+  /* Peak search region, NULL for the full heatmap */
+  const SearchRegion *region;
+  /* State of the stream for the warm-started assignment, NULL to solve every limb from scratch */
+  AssignmentState *assignment_state;
+  /* Pixels of the camera where no peak is searched, NULL for none. It must fit the heatmaps. */
+  const ExclusionMask *mask;
+
+  PoseResult result;
+  PostProcessTimings timings;
+  /* Hardware events of each stage, when the batch is profiled */
+  PerfStageCounts counters;
+  /* FALSE when only 'region' was searched */
+  bool full_scan;
+  /* Whether the limbs are assigned with the warm start, decided once the peaks are known */
+  bool warm_start;
+  /* FALSE when the layers are in a data type the post-processing cannot read */
+  bool supported;
+
+  /* Intermediate results of the stages, kept with their capacity from batch to batch */
+  Vec1D<int> counts;
+  Vec3D<int> peaks;
+  Vec3D<float> score_graph;
+  Vec3D<float> cost_graph;
+  Vec3D<int> connections;
+  Vec2D<int> visited;
+};
+
+/**
+ * Post-processing of all the frames of an nvinfer batch in one call. Each
+ * stage runs over every frame of the batch before the next stage starts,
+ * so the code and the topology of a stage stay in cache. The frames and
+ * all their buffers are recycled from batch to batch: once the batch size
+ * and the number of people settle, a batch allocates no memory.
+ *
+ * With a TaskScheduler, each stage is split into tasks: one per frame and
+ * channel for the peaks, one per frame and limb for the scoring and the
+ * assignment, one per frame for connecting the parts. The timings of a
+ * frame are then the summed run time of its tasks.
+ *
+ * A frame skips the stages its output mode does not need, so streams that
+ * only count people pay for the peak search alone.
+ */
+class PoseBatch
+{
+public:
+  PoseBatch() : num_frames_(0), profiling_(false) {}
+
+  /* Starts a new batch */
+  void clear()
+  {
+    num_frames_ = 0;
+  }
+
+  /* Appends a frame to the batch, the results of 'run' are in the returned frame */
+  PoseBatchFrame &add(const TensorView &cmap, const TensorView &paf, const PostProcessParams &params,
+                      const SearchRegion *region = NULL, AssignmentState *assignment_state = NULL,
+                      const ExclusionMask *mask = NULL);
+
+  int size() const
+  {
+    return num_frames_;
+  }
+
+  PoseBatchFrame &operator[](int i)
+  {
+    return frames_[i];
+  }
+
+  /**
+   * Reads the hardware counters of the thread running each stage of a
+   * frame, or each task, into the 'counters' of the frame. It costs two
+   * system calls per stage or task, which the timings partly include.
+   */
+  void setProfiling(bool profiling)
+  {
+    profiling_ = profiling;
+  }
+
+  /* Runs the post-processing chain on all the frames of the batch, on the threads of 'scheduler' when given */
+  void run(Vec2D<int> &topology, TaskScheduler *scheduler = NULL);
+
+private:
+  /* Frame and channel, or frame and limb, of a task */
+  struct FrameTask
+  {
+    int frame;
+    int part;
+  };
+
+  void runTasks(Vec2D<int> &topology, TaskScheduler *scheduler);
+
+  Vec1D<PoseBatchFrame> frames_;
+  int num_frames_;
+  bool profiling_;
+  Vec1D<FrameTask> tasks_;
+};
@@ -0,0 +1,482 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Benchmark of the post-processing stages on synthetic confidence maps and
+ * part affinity fields, without DeepStream or a GPU.
+ *
+ * Usage: post-process-bench [PEOPLE] [ITERATIONS] [HEIGHT] [WIDTH] [THREADS]
+ */
+
+#include "peak_capacity.hpp"
+#include "post_process.hpp"
+#include "synthetic_tensors.hpp"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+struct BenchResult
+{
+  Vec1D<int> counts;
+  Vec3D<float> refined_peaks;
+  Vec2D<int> objects;
+};
+
+/* Runs the whole chain once on a frame, one call per stage as the application used to */
+static void
+run_chain(const TensorView &cmap, const TensorView &paf, Vec2D<int> &topology,
+          const PostProcessParams &params, BenchResult &result, PostProcessTimings &total)
+{
+  Vec3D<int> peaks;
+
+  gint64 t0 = g_get_monotonic_time();
+  find_peaks(result.counts, peaks, cmap, params.threshold, params.window_size, params.max_num_parts,
+             NULL, params.coarse_to_fine);
+  gint64 t1 = g_get_monotonic_time();
+  result.refined_peaks = refine_peaks(result.counts, peaks, cmap, params.window_size, params.refine_mode);
+  gint64 t2 = g_get_monotonic_time();
+  Vec3D<float> score_graph = paf_score_graph(paf, topology, result.counts, result.refined_peaks,
+                                             params.num_integral_samples);
+  gint64 t3 = g_get_monotonic_time();
+  Vec3D<int> connections = params.greedy_assignment
+                               ? greedy_assignment(score_graph, topology, result.counts, params.link_threshold, params.max_num_parts)
+                               : assignment(score_graph, topology, result.counts, params.link_threshold, params.max_num_parts);
+  gint64 t4 = g_get_monotonic_time();
+  result.objects = connect_parts(connections, topology, result.counts, params.max_num_objects);
+  gint64 t5 = g_get_monotonic_time();
+
+  total.find_peaks += t1 - t0;
+  total.refine_peaks += t2 - t1;
+  total.paf_score_graph += t3 - t2;
+  total.assignment += t4 - t3;
+  total.connect_parts += t5 - t4;
+}
+
+static void
+print_timings(const gchar *name, const PostProcessTimings &total, int num_frames, size_t num_people)
+{
+  g_print("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %8zu\n", name,
+          (double)total.find_peaks / num_frames, (double)total.refine_peaks / num_frames,
+          (double)total.paf_score_graph / num_frames, (double)total.assignment / num_frames,
+          (double)total.connect_parts / num_frames, (double)total.total() / num_frames,
+          num_people);
+}
+
+static void
+add_timings(PostProcessTimings &total, const PostProcessTimings &timings)
+{
+  total.find_peaks += timings.find_peaks;
+  total.refine_peaks += timings.refine_peaks;
+  total.paf_score_graph += timings.paf_score_graph;
+  total.assignment += timings.assignment;
+  total.connect_parts += timings.connect_parts;
+}
+
+/* Runs the whole chain 'iterations' times and prints the average time of each stage */
+static void
+bench_stages(const gchar *name, const TensorView &cmap, const TensorView &paf,
+             Vec2D<int> &topology, const PostProcessParams &params, int iterations,
+             BenchResult &result)
+{
+  PostProcessTimings total = {};
+
+  for (int n = 0; n < iterations; n++)
+    run_chain(cmap, paf, topology, params, result, total);
+  print_timings(name, total, iterations, result.objects.size());
+}
+
+/* Same as 'bench_stages' on several frames per iteration, processed one after the other */
+static void
+bench_serial(const gchar *name, Vec1D<TensorView> &cmaps, Vec1D<TensorView> &pafs,
+             Vec2D<int> &topology, const PostProcessParams &params, int iterations,
+             Vec1D<BenchResult> &results)
+{
+  PostProcessTimings total = {};
+  int num_frames = cmaps.size();
+  size_t num_people = 0;
+
+  results.resize(num_frames);
+  for (int n = 0; n < iterations; n++)
+  {
+    for (int f = 0; f < num_frames; f++)
+      run_chain(cmaps[f], pafs[f], topology, params, results[f], total);
+  }
+  for (auto &result : results)
+    num_people += result.objects.size();
+  print_timings(name, total, iterations * num_frames, num_people);
+}
+
+/* Frames of one stream through one PoseBatch per frame, 'iterations' times, with the exclusion mask 'mask' and
+   the candidates per part adapted by 'capacity' from 'params.max_num_parts' as in the application. The people
+   column is the count of the last frame, which stays in 'batch'. */
+static void
+bench_pose_batch(const gchar *name, const Vec1D<TensorView> &cmaps, const Vec1D<TensorView> &pafs,
+                 Vec2D<int> &topology, PostProcessParams params, int iterations, PoseBatch &batch,
+                 const ExclusionMask *mask = NULL, PeakCapacity *capacity = NULL)
+{
+  PostProcessTimings total = {};
+  int num_frames = cmaps.size();
+
+  for (int n = 0; n < iterations; n++)
+  {
+    for (int f = 0; f < num_frames; f++)
+    {
+      if (capacity)
+        params.max_num_parts = capacity->get();
+      batch.clear();
+      batch.add(cmaps[f], pafs[f], params, NULL, NULL, mask);
+      batch.run(topology);
+      if (capacity)
+        capacity->update(batch[0].counts);
+      add_timings(total, batch[0].timings);
+    }
+  }
+  print_timings(name, total, iterations * num_frames, batch[0].result.count);
+}
+
+/* Same as 'bench_stages' through a profiled PoseBatch, prints the hardware events of each stage per frame */
+static void
+bench_counters(const gchar *name, const TensorView &cmap, const TensorView &paf, Vec2D<int> &topology,
+               const PostProcessParams &params, int iterations)
+{
+  PerfStageCounts total = PerfStageCounts();
+  PoseBatch batch;
+
+  batch.setProfiling(true);
+  for (int n = 0; n < iterations; n++)
+  {
+    batch.clear();
+    batch.add(cmap, paf, params);
+    batch.run(topology);
+    perf_stage_counts_add(&total, &batch[0].counters);
+  }
+  g_print("%s\n", name);
+  perf_stage_counts_print("  ", &total, iterations);
+}
+
+/* Same frames through one PoseBatch per iteration. With a scheduler, the
+   stage columns are the summed task times and the wall time is printed apart. */
+static void
+bench_batch(const gchar *name, Vec1D<TensorView> &cmaps, Vec1D<TensorView> &pafs,
+            Vec2D<int> &topology, const PostProcessParams &params, int iterations,
+            Vec1D<BenchResult> &results, TaskScheduler *scheduler = NULL)
+{
+  PostProcessTimings total = {};
+  PoseBatch batch;
+  int num_frames = cmaps.size();
+  size_t num_people = 0;
+  gint64 wall_us = 0;
+
+  for (int n = 0; n < iterations; n++)
+  {
+    gint64 t0 = g_get_monotonic_time();
+    batch.clear();
+    for (int f = 0; f < num_frames; f++)
+      batch.add(cmaps[f], pafs[f], params);
+    batch.run(topology, scheduler);
+    wall_us += g_get_monotonic_time() - t0;
+
+    for (int f = 0; f < num_frames; f++)
+      add_timings(total, batch[f].timings);
+  }
+
+  results.resize(num_frames);
+  for (int f = 0; f < num_frames; f++)
+  {
+    results[f].counts = batch[f].counts;
+    results[f].refined_peaks = batch[f].result.peaks;
+    results[f].objects = batch[f].result.objects;
+    num_people += results[f].objects.size();
+  }
+  print_timings(name, total, iterations * num_frames, num_people);
+  g_print("%-24s %10.1f us wall time per frame\n", "", (double)wall_us / (iterations * num_frames));
+}
+
+/* One stream walking through 'cmaps', one PoseBatch per frame, with a warm-started assignment when 'state' is given */
+static void
+bench_sequence(const gchar *name, Vec1D<TensorView> &cmaps, Vec1D<TensorView> &pafs,
+               Vec2D<int> &topology, const PostProcessParams &params, int iterations,
+               Vec1D<BenchResult> &results, AssignmentState *state)
+{
+  PostProcessTimings total = {};
+  PoseBatch batch;
+  int num_frames = cmaps.size();
+  size_t num_people = 0;
+
+  results.resize(num_frames);
+  for (int n = 0; n < iterations; n++)
+  {
+    for (int f = 0; f < num_frames; f++)
+    {
+      batch.clear();
+      batch.add(cmaps[f], pafs[f], params, NULL, state);
+      batch.run(topology);
+      add_timings(total, batch[0].timings);
+
+      results[f].counts = batch[0].counts;
+      results[f].refined_peaks = batch[0].result.peaks;
+      results[f].objects = batch[0].result.objects;
+    }
+  }
+  for (auto &result : results)
+    num_people += result.objects.size();
+  print_timings(name, total, iterations * num_frames, num_people);
+}
+
+static void
+print_header(const gchar *title)
+{
+  g_print("\n%s (average us per frame)\n", title);
+  g_print("%-24s %10s %10s %10s %10s %10s %10s %8s\n", "variant",
+          "peaks", "refine", "score", "assign", "connect", "total", "people");
+}
+
+/* Mean distance in heatmap pixels between the refined peaks and the nearest rendered keypoint of their part */
+static double
+refine_error(const BenchResult &result, Vec3D<float> &poses, int height, int width)
+{
+  double sum = 0.0;
+  int num_peaks = 0;
+
+  for (size_t c = 0; c < result.counts.size(); c++)
+  {
+    for (int p = 0; p < result.counts[c]; p++)
+    {
+      float best = G_MAXFLOAT;
+      for (auto &pose : poses)
+      {
+        float dy = (result.refined_peaks[c][p][0] - pose[c][0]) * height;
+        float dx = (result.refined_peaks[c][p][1] - pose[c][1]) * width;
+        best = std::min(best, dy * dy + dx * dx);
+      }
+      sum += sqrtf(best);
+      num_peaks++;
+    }
+  }
+  return num_peaks ? sum / num_peaks : 0.0;
+}
+
+static gboolean
+same_result(const BenchResult &a, const BenchResult &b)
+{
+  return a.counts == b.counts && a.refined_peaks == b.refined_peaks && a.objects == b.objects;
+}
+
+int main(int argc, char *argv[])
+{
+  int num_people = argc > 1 ? atoi(argv[1]) : 8;
+  int iterations = argc > 2 ? atoi(argv[2]) : 200;
+  int height = argc > 3 ? atoi(argv[3]) : 56;
+  int width = argc > 4 ? atoi(argv[4]) : 56;
+  int num_threads = argc > 5 ? atoi(argv[5]) : 4;
+  Vec2D<int> topology = default_topology();
+  Vec3D<float> poses;
+  Vec1D<float> cmap_chw, paf_chw, cmap_hwc, paf_hwc;
+  NvDsInferDims cmap_dims = {3, {NUM_BODY_PARTS, (unsigned int)height, (unsigned int)width}, 0};
+  NvDsInferDims paf_dims = {3, {NUM_PAF_CHANNELS, (unsigned int)height, (unsigned int)width}, 0};
+  NvDsInferDims cmap_hwc_dims = {3, {(unsigned int)height, (unsigned int)width, NUM_BODY_PARTS}, 0};
+  NvDsInferDims paf_hwc_dims = {3, {(unsigned int)height, (unsigned int)width, NUM_PAF_CHANNELS}, 0};
+  PostProcessParams params = {0.1f, 5, 2 * num_people, 7, 0.1f, 100, false, false, REFINE_CENTROID,
+                               OUTPUT_SKELETONS};
+  BenchResult reference, result;
+
+  g_print("%d people, %dx%d heatmaps, %d iterations\n", num_people, width, height, iterations);
+
+  random_poses(poses, num_people, 1234);
+  render_cmap(cmap_chw, poses, height, width, 1.5f);
+  render_paf(paf_chw, poses, topology, height, width);
+  chw_to_hwc(cmap_hwc, cmap_chw, NUM_BODY_PARTS, height, width);
+  chw_to_hwc(paf_hwc, paf_chw, NUM_PAF_CHANNELS, height, width);
+
+  TensorView cmap = make_tensor_view(cmap_chw.data(), cmap_dims);
+  TensorView paf = make_tensor_view(paf_chw.data(), paf_dims);
+  TensorView cmap_interleaved = make_tensor_view(cmap_hwc.data(), cmap_hwc_dims, TENSOR_LAYOUT_HWC);
+  TensorView paf_interleaved = make_tensor_view(paf_hwc.data(), paf_hwc_dims, TENSOR_LAYOUT_HWC);
+
+  /* Tensor layouts */
+  print_header("Tensor layouts");
+  bench_stages("CHW", cmap, paf, topology, params, iterations, reference);
+  bench_stages("HWC", cmap_interleaved, paf_interleaved, topology, params, iterations, result);
+  if (!same_result(reference, result))
+    g_print("HWC result differs from CHW\n");
+
+  /* Peak search variants */
+  print_header("Peak search");
+  params.coarse_to_fine = true;
+  bench_stages("CHW coarse-to-fine", cmap, paf, topology, params, iterations, result);
+  if (!same_result(reference, result))
+    g_print("coarse-to-fine result differs from the full scan\n");
+  bench_stages("HWC coarse-to-fine", cmap_interleaved, paf_interleaved, topology, params, iterations, result);
+  if (!same_result(reference, result))
+    g_print("HWC coarse-to-fine result differs from the full scan\n");
+  params.coarse_to_fine = false;
+
+  /* Sub-pixel refinement, timed and compared with the rendered keypoints */
+  print_header("Peak refinement");
+  bench_stages("centroid 5x5", cmap, paf, topology, params, iterations, result);
+  g_print("%-24s %.3f px mean error\n", "", refine_error(result, poses, height, width));
+  params.refine_mode = REFINE_QUADRATIC;
+  bench_stages("quadratic 3x3", cmap, paf, topology, params, iterations, result);
+  g_print("%-24s %.3f px mean error\n", "", refine_error(result, poses, height, width));
+  params.refine_mode = REFINE_CENTROID;
+
+  /* Static masks over the top rows of the heatmap, as walls or sky would be */
+  Vec1D<TensorView> single_cmaps(1, cmap), single_pafs(1, paf);
+  PoseBatch batch;
+  gboolean on_excluded = FALSE;
+
+  print_header("Exclusion masks");
+  for (int percent = 0; percent <= 75; percent += 25)
+  {
+    Vec1D<uint8_t> excluded(height * width, 0);
+    ExclusionMask mask;
+    gchar *name = g_strdup_printf("%d%% excluded", percent);
+
+    std::fill(excluded.begin(), excluded.begin() + height * percent / 100 * width, 1);
+    mask.set(width, height, excluded.data());
+    bench_pose_batch(name, single_cmaps, single_pafs, topology, params, iterations, batch, &mask);
+    for (size_t c = 0; c < batch[0].counts.size(); c++)
+      for (int p = 0; p < batch[0].counts[c]; p++)
+        on_excluded |= mask.pixelExcluded(batch[0].peaks[c][p][0], batch[0].peaks[c][p][1]);
+    g_free(name);
+  }
+  if (on_excluded)
+    g_print("peaks found on excluded pixels\n");
+
+  /* Output modes, each stopping the chain earlier. An empty frame is the worst case of the presence test. */
+  print_header("Output modes");
+  for (int m = OUTPUT_SKELETONS; m <= OUTPUT_PRESENCE; m++)
+  {
+    params.output_mode = (OutputMode)m;
+    bench_pose_batch(output_mode_name(params.output_mode), single_cmaps, single_pafs, topology, params, iterations,
+                     batch);
+  }
+  Vec1D<float> empty_cmap(cmap_chw.size(), 0.0f);
+  Vec1D<TensorView> empty_cmaps(1, make_tensor_view(empty_cmap.data(), cmap_dims));
+  bench_pose_batch("presence, empty frame", empty_cmaps, single_pafs, topology, params, iterations, batch);
+  params.output_mode = OUTPUT_SKELETONS;
+
+  /* Hardware events of each stage, to tell the memory-bound stages from the branch-bound ones */
+  g_print("\nHardware counters (average per frame)\n");
+  if (perf_counters_available())
+  {
+    bench_counters("CHW", cmap, paf, topology, params, iterations);
+    bench_counters("HWC", cmap_interleaved, paf_interleaved, topology, params, iterations);
+    params.coarse_to_fine = true;
+    bench_counters("CHW coarse-to-fine", cmap, paf, topology, params, iterations);
+    params.coarse_to_fine = false;
+    params.refine_mode = REFINE_QUADRATIC;
+    bench_counters("CHW quadratic 3x3", cmap, paf, topology, params, iterations);
+    params.refine_mode = REFINE_CENTROID;
+    params.greedy_assignment = true;
+    bench_counters("CHW greedy assignment", cmap, paf, topology, params, iterations);
+    params.greedy_assignment = false;
+  }
+
+  /* Several streams per nvinfer batch, each with its own people */
+  const int batch_size = 8;
+  Vec1D<Vec1D<float>> batch_cmaps(batch_size), batch_pafs(batch_size);
+  Vec1D<TensorView> cmaps, pafs;
+  Vec1D<BenchResult> serial_results, batch_results, task_results;
+  for (int f = 0; f < batch_size; f++)
+  {
+    random_poses(poses, num_people, 1234 + f);
+    render_cmap(batch_cmaps[f], poses, height, width, 1.5f);
+    render_paf(batch_pafs[f], poses, topology, height, width);
+    cmaps.push_back(make_tensor_view(batch_cmaps[f].data(), cmap_dims));
+    pafs.push_back(make_tensor_view(batch_pafs[f].data(), paf_dims));
+  }
+  print_header("Batches of 8 frames");
+  bench_serial("one frame per call", cmaps, pafs, topology, params, iterations, serial_results);
+  bench_batch("PoseBatch", cmaps, pafs, topology, params, iterations, batch_results);
+  for (int f = 0; f < batch_size; f++)
+  {
+    if (!same_result(serial_results[f], batch_results[f]))
+      g_print("batch result of frame %d differs from the serial one\n", f);
+  }
+
+  /* A walking sequence of one stream, each limb solved from scratch or from the previous frame */
+  const int sequence_length = 32;
+  Vec3D<float> base;
+  Vec1D<Vec1D<float>> sequence_cmaps(sequence_length), sequence_pafs(sequence_length);
+  Vec1D<TensorView> sequence_cmap_views, sequence_paf_views;
+  Vec1D<BenchResult> cold_results, warm_results;
+  AssignmentState state;
+
+  random_poses(base, num_people, 1234);
+  for (int f = 0; f < sequence_length; f++)
+  {
+    float shift = 0.03f * sinf(2.0f * (float)M_PI * f / sequence_length);
+    poses = base;
+    for (auto &pose : poses)
+      for (auto &keypoint : pose)
+        keypoint[1] += shift;
+    render_cmap(sequence_cmaps[f], poses, height, width, 1.5f);
+    render_paf(sequence_pafs[f], poses, topology, height, width);
+    sequence_cmap_views.push_back(make_tensor_view(sequence_cmaps[f].data(), cmap_dims));
+    sequence_paf_views.push_back(make_tensor_view(sequence_pafs[f].data(), paf_dims));
+  }
+  print_header("Walking sequence of 32 frames");
+  bench_sequence("Munkres", sequence_cmap_views, sequence_paf_views, topology, params, iterations, cold_results, NULL);
+  bench_sequence("warm-started", sequence_cmap_views, sequence_paf_views, topology, params, iterations, warm_results,
+                 &state);
+  g_print("%-24s %.2f augmenting paths per row\n", "",
+          state.num_rows ? (double)state.num_augmentations / state.num_rows : 0.0);
+  for (int f = 0; f < sequence_length; f++)
+  {
+    if (!same_result(cold_results[f], warm_results[f]))
+      g_print("warm-started result of frame %d differs from Munkres\n", f);
+  }
+
+  /* A crowd passing a quiet camera: the capacity grows from 2 for the crowd, shrinks back over the
+     quiet frames and grows again. 'max_num_objects' stays below the grown capacity. */
+  Vec1D<float> single_cmap, single_paf;
+  Vec1D<TensorView> crowd_cmaps(20, cmap), crowd_pafs(20, paf);
+  PostProcessParams crowd_params = params;
+  PeakCapacity capacity;
+
+  random_poses(poses, 1, 4321);
+  render_cmap(single_cmap, poses, height, width, 1.5f);
+  render_paf(single_paf, poses, topology, height, width);
+  crowd_cmaps.insert(crowd_cmaps.end(), 2 * PEAK_CAPACITY_WINDOW_FRAMES, make_tensor_view(single_cmap.data(), cmap_dims));
+  crowd_pafs.insert(crowd_pafs.end(), 2 * PEAK_CAPACITY_WINDOW_FRAMES, make_tensor_view(single_paf.data(), paf_dims));
+  crowd_cmaps.insert(crowd_cmaps.end(), 20, cmap);
+  crowd_pafs.insert(crowd_pafs.end(), 20, paf);
+  crowd_params.max_num_parts = 2;
+  crowd_params.max_num_objects = std::max(2, num_people / 2);
+  capacity.reset(crowd_params.max_num_parts, 32);
+  print_header("Candidates per body part");
+  bench_pose_batch("crowd, quiet, crowd", crowd_cmaps, crowd_pafs, topology, crowd_params, 1, batch, NULL, &capacity);
+  g_print("%-24s capacity %d, %" G_GUINT64_FORMAT " saturated frames, %" G_GUINT64_FORMAT " grows, %" G_GUINT64_FORMAT
+          " shrinks\n",
+          "", capacity.get(), capacity.num_saturated, capacity.num_grows, capacity.num_shrinks);
+
+  /* Same batches split into tasks over a shared scheduler */
+  if (num_threads > 0)
+  {
+    TaskScheduler scheduler(num_threads);
+    std::vector<TaskThreadStats> stats;
+    gchar *name = g_strdup_printf("PoseBatch, %d threads", num_threads);
+
+    bench_batch(name, cmaps, pafs, topology, params, iterations, task_results, &scheduler);
+    for (int f = 0; f < batch_size; f++)
+    {
+      if (!same_result(serial_results[f], task_results[f]))
+        g_print("task result of frame %d differs from the serial one\n", f);
+    }
+
+    scheduler.getStats(stats);
+    for (size_t t = 0; t < stats.size(); t++)
+    {
+      g_print("%-24s %" G_GUINT64_FORMAT " tasks, %" G_GUINT64_FORMAT " steals, %.1f ms idle\n",
+              t + 1 < stats.size() ? "  worker" : "  callers", stats[t].num_tasks, stats[t].num_steals,
+              stats[t].idle_us / 1000.0);
+    }
+    g_free(name);
+  }
+
+  return 0;
+}
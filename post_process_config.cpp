@@ -0,0 +1,334 @@
+#include "post_process_config.hpp"
+
+#include <json-glib/json-glib.h>
+#include <stdlib.h>
+
+/* Delay between the last change of the file and the reload */
+#define CONFIG_RELOAD_DELAY_MS 200
+
+void
+post_process_config_init(PostProcessConfig *config, const PostProcessParams &defaults, const Vec2D<int> &topology)
+{
+  config->params = defaults;
+  config->stream_params.clear();
+  config->topology = topology;
+}
+
+/* Sets '*found' when 'object' has the member 'name', and returns FALSE when it is not a number */
+static gboolean
+read_number(JsonObject *object, const gchar *name, double *value, gboolean *found)
+{
+  *found = json_object_has_member(object, name);
+  if (!*found)
+    return TRUE;
+
+  JsonNode *node = json_object_get_member(object, name);
+  GType type = JSON_NODE_HOLDS_VALUE(node) ? json_node_get_value_type(node) : G_TYPE_INVALID;
+  if (type != G_TYPE_DOUBLE && type != G_TYPE_INT64)
+    return FALSE;
+  *value = json_node_get_double(node);
+  return TRUE;
+}
+
+/* Reads an integer member that must be between 'min' and 'max' into 'value', when present */
+static gboolean
+read_int(JsonObject *object, const gchar *name, int min, int max, int *value)
+{
+  double number = 0.0;
+  gboolean found;
+  gboolean ok = read_number(object, name, &number, &found);
+
+  if (!found)
+    return TRUE;
+  if (!ok || number < min || number > max || number != (int)number)
+  {
+    g_printerr("\"%s\" must be an integer from %d to %d\n", name, min, max);
+    return FALSE;
+  }
+  *value = (int)number;
+  return TRUE;
+}
+
+static gboolean
+read_float(JsonObject *object, const gchar *name, float *value)
+{
+  double number = 0.0;
+  gboolean found;
+  gboolean ok = read_number(object, name, &number, &found);
+
+  if (!found)
+    return TRUE;
+  if (!ok || number < 0.0)
+  {
+    g_printerr("\"%s\" must be a non-negative number\n", name);
+    return FALSE;
+  }
+  *value = (float)number;
+  return TRUE;
+}
+
+static gboolean
+read_bool(JsonObject *object, const gchar *name, bool *value)
+{
+  if (!json_object_has_member(object, name))
+    return TRUE;
+
+  JsonNode *node = json_object_get_member(object, name);
+  if (!JSON_NODE_HOLDS_VALUE(node) || json_node_get_value_type(node) != G_TYPE_BOOLEAN)
+  {
+    g_printerr("\"%s\" must be true or false\n", name);
+    return FALSE;
+  }
+  *value = json_node_get_boolean(node);
+  return TRUE;
+}
+
+static gboolean
+read_refine_mode(JsonObject *object, const gchar *name, RefineMode *mode)
+{
+  if (!json_object_has_member(object, name))
+    return TRUE;
+
+  JsonNode *node = json_object_get_member(object, name);
+  const gchar *value = JSON_NODE_HOLDS_VALUE(node) && json_node_get_value_type(node) == G_TYPE_STRING
+                           ? json_node_get_string(node)
+                           : "";
+  if (g_strcmp0(value, "centroid") == 0)
+    *mode = REFINE_CENTROID;
+  else if (g_strcmp0(value, "quadratic") == 0)
+    *mode = REFINE_QUADRATIC;
+  else
+  {
+    g_printerr("\"%s\" must be \"centroid\" or \"quadratic\"\n", name);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+read_output_mode(JsonObject *object, const gchar *name, OutputMode *mode)
+{
+  if (!json_object_has_member(object, name))
+    return TRUE;
+
+  JsonNode *node = json_object_get_member(object, name);
+  const gchar *value = JSON_NODE_HOLDS_VALUE(node) && json_node_get_value_type(node) == G_TYPE_STRING
+                           ? json_node_get_string(node)
+                           : "";
+  if (!output_mode_parse(value, mode))
+  {
+    g_printerr("\"%s\" must be \"skeletons\", \"keypoints\", \"count\" or \"presence\"\n", name);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Overrides the members of 'params' present in 'object' */
+static gboolean
+read_params(JsonObject *object, PostProcessParams *params)
+{
+  if (!(read_float(object, "threshold", &params->threshold) &&
+        read_int(object, "window_size", 1, CONFIG_MAX_WINDOW_SIZE, &params->window_size) &&
+        read_int(object, "max_num_parts", 1, CONFIG_MAX_NUM_PARTS, &params->max_num_parts) &&
+        read_int(object, "num_integral_samples", 1, CONFIG_MAX_INTEGRAL_SAMPLES, &params->num_integral_samples) &&
+        read_float(object, "link_threshold", &params->link_threshold) &&
+        read_int(object, "max_num_objects", 1, CONFIG_MAX_NUM_OBJECTS, &params->max_num_objects) &&
+        read_bool(object, "greedy_assignment", &params->greedy_assignment) &&
+        read_bool(object, "coarse_to_fine", &params->coarse_to_fine) &&
+        read_refine_mode(object, "refine", &params->refine_mode) &&
+        read_output_mode(object, "output", &params->output_mode)))
+    return FALSE;
+
+  /* Every candidate of a body part may start a person */
+  if (params->max_num_objects < params->max_num_parts)
+  {
+    g_printerr("\"max_num_objects\" (%d) must be at least \"max_num_parts\" (%d)\n", params->max_num_objects,
+               params->max_num_parts);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+read_topology(JsonNode *node, Vec2D<int> *topology)
+{
+  JsonArray *limbs = JSON_NODE_HOLDS_ARRAY(node) ? json_node_get_array(node) : NULL;
+
+  if (!limbs || json_array_get_length(limbs) == 0)
+  {
+    g_printerr("\"topology\" must be a non-empty array of limbs\n");
+    return FALSE;
+  }
+
+  topology->clear();
+  for (guint k = 0; k < json_array_get_length(limbs); k++)
+  {
+    JsonNode *limb_node = json_array_get_element(limbs, k);
+    JsonArray *limb = JSON_NODE_HOLDS_ARRAY(limb_node) ? json_node_get_array(limb_node) : NULL;
+
+    if (!limb || json_array_get_length(limb) != 4)
+    {
+      g_printerr("limb %u of \"topology\" must be [paf_i, paf_j, cmap_a, cmap_b]\n", k);
+      return FALSE;
+    }
+    topology->emplace_back(4);
+    for (guint i = 0; i < 4; i++)
+    {
+      JsonNode *index = json_array_get_element(limb, i);
+      if (!JSON_NODE_HOLDS_VALUE(index) || json_node_get_value_type(index) != G_TYPE_INT64 ||
+          json_node_get_int(index) < 0)
+      {
+        g_printerr("limb %u of \"topology\" must hold channel indices\n", k);
+        return FALSE;
+      }
+      (*topology)[k][i] = json_node_get_int(index);
+    }
+  }
+  return TRUE;
+}
+
+gboolean
+post_process_config_load(PostProcessConfig *config, const gchar *path, const PostProcessParams &defaults,
+                         const Vec2D<int> &topology)
+{
+  JsonParser *parser = json_parser_new();
+  GError *error = NULL;
+  PostProcessConfig loaded;
+  gboolean ok = TRUE;
+
+  post_process_config_init(&loaded, defaults, topology);
+
+  if (!json_parser_load_from_file(parser, path, &error))
+  {
+    g_printerr("Failed to read the configuration %s: %s\n", path, error->message);
+    g_error_free(error);
+    g_object_unref(parser);
+    return FALSE;
+  }
+
+  JsonNode *root = json_parser_get_root(parser);
+  JsonObject *object = root && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+  if (!object)
+  {
+    g_printerr("The configuration %s must be a JSON object\n", path);
+    g_object_unref(parser);
+    return FALSE;
+  }
+
+  if (json_object_has_member(object, "params"))
+  {
+    JsonNode *node = json_object_get_member(object, "params");
+    ok = JSON_NODE_HOLDS_OBJECT(node) && read_params(json_node_get_object(node), &loaded.params);
+  }
+
+  if (ok && json_object_has_member(object, "streams"))
+  {
+    JsonNode *node = json_object_get_member(object, "streams");
+    JsonObject *streams = JSON_NODE_HOLDS_OBJECT(node) ? json_node_get_object(node) : NULL;
+    GList *names = streams ? json_object_get_members(streams) : NULL;
+
+    ok = streams != NULL;
+    for (GList *l = names; l != NULL && ok; l = l->next)
+    {
+      const gchar *name = (const gchar *)l->data;
+      gchar *end;
+      guint64 source_id = g_ascii_strtoull(name, &end, 10);
+      JsonNode *stream = json_object_get_member(streams, name);
+
+      if (end == name || *end != '\0' || source_id > G_MAXUINT || !JSON_NODE_HOLDS_OBJECT(stream))
+      {
+        g_printerr("\"streams\" must map source ids to parameters, not \"%s\"\n", name);
+        ok = FALSE;
+        break;
+      }
+      PostProcessParams params = loaded.params;
+      ok = read_params(json_node_get_object(stream), &params);
+      loaded.stream_params[(guint)source_id] = params;
+    }
+    g_list_free(names);
+  }
+
+  if (ok && json_object_has_member(object, "topology"))
+    ok = read_topology(json_object_get_member(object, "topology"), &loaded.topology);
+
+  g_object_unref(parser);
+  if (!ok)
+  {
+    g_printerr("Invalid configuration %s\n", path);
+    return FALSE;
+  }
+
+  *config = loaded;
+  return TRUE;
+}
+
+static gboolean
+on_reload_timeout(gpointer data)
+{
+  ConfigWatcher *watcher = (ConfigWatcher *)data;
+
+  watcher->timeout_id = 0;
+  watcher->callback(watcher->path, watcher->data);
+  return FALSE;
+}
+
+static void
+on_file_changed(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event,
+                gpointer data)
+{
+  ConfigWatcher *watcher = (ConfigWatcher *)data;
+
+  switch (event)
+  {
+  case G_FILE_MONITOR_EVENT_CHANGED:
+  case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+  case G_FILE_MONITOR_EVENT_CREATED:
+  case G_FILE_MONITOR_EVENT_MOVED_IN:
+  case G_FILE_MONITOR_EVENT_RENAMED:
+    /* Restart the delay, the reload follows the last write */
+    if (watcher->timeout_id)
+      g_source_remove(watcher->timeout_id);
+    watcher->timeout_id = g_timeout_add(CONFIG_RELOAD_DELAY_MS, on_reload_timeout, watcher);
+    break;
+  default:
+    break;
+  }
+}
+
+ConfigWatcher *
+config_watcher_new(const gchar *path, ConfigChangedFunc callback, gpointer data)
+{
+  GFile *file = g_file_new_for_path(path);
+  GError *error = NULL;
+  GFileMonitor *monitor = g_file_monitor_file(file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+
+  g_object_unref(file);
+  if (!monitor)
+  {
+    g_printerr("Failed to watch %s: %s\n", path, error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  ConfigWatcher *watcher = g_new0(ConfigWatcher, 1);
+  watcher->path = g_strdup(path);
+  watcher->monitor = monitor;
+  watcher->callback = callback;
+  watcher->data = data;
+  g_signal_connect(monitor, "changed", G_CALLBACK(on_file_changed), watcher);
+  return watcher;
+}
+
+void
+config_watcher_free(ConfigWatcher *watcher)
+{
+  if (!watcher)
+    return;
+
+  if (watcher->timeout_id)
+    g_source_remove(watcher->timeout_id);
+  g_file_monitor_cancel(watcher->monitor);
+  g_object_unref(watcher->monitor);
+  g_free(watcher->path);
+  g_free(watcher);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <map>
+
+/* Largest accepted values, far above any sensible setting, so a typo cannot exhaust the memory */
+#define CONFIG_MAX_WINDOW_SIZE 31
+#define CONFIG_MAX_NUM_PARTS 256
+#define CONFIG_MAX_NUM_OBJECTS 1024
+#define CONFIG_MAX_INTEGRAL_SAMPLES 100
+
+/*
+ * Post-processing parameters and topology read from a JSON file:
+ *
+ *   {
+ *     "params": {"threshold": 0.1, "window_size": 5, "max_num_parts": 2},
+ *     "streams": {"3": {"threshold": 0.15, "num_integral_samples": 5}},
+ *     "topology": [[0, 1, 15, 13], [2, 3, 13, 11], ...]
+ *   }
+ *
+ * "params" overrides the built-in defaults for all streams and each entry
+ * of "streams" overrides them again for one source id. Every member is
+ * optional. The members of a parameter set are the fields of
+ * PostProcessParams, with "refine" set to "centroid" or "quadratic" for
+ * 'refine_mode' and "output" set to "skeletons", "keypoints", "count" or
+ * "presence" for 'output_mode'. The topology, {paf_i, paf_j, cmap_a, cmap_b} per
+ * limb, is shared by all streams as they share the model.
+ */
+struct PostProcessConfig
+{
+  PostProcessParams params;
+  std::map<guint, PostProcessParams> stream_params;
+  Vec2D<int> topology;
+
+  const PostProcessParams &streamParams(guint source_id) const
+  {
+    auto it = stream_params.find(source_id);
+    return it != stream_params.end() ? it->second : params;
+  }
+};
+
+/* Configuration without a file: 'defaults' for all streams and 'topology' */
+void post_process_config_init(PostProcessConfig *config, const PostProcessParams &defaults,
+                              const Vec2D<int> &topology);
+
+/**
+ * Reads 'path' into 'config', on top of 'defaults' and 'topology' for the
+ * members the file leaves out. Prints the error and leaves 'config'
+ * untouched when the file cannot be read or holds an invalid value.
+ */
+gboolean post_process_config_load(PostProcessConfig *config, const gchar *path,
+                                  const PostProcessParams &defaults, const Vec2D<int> &topology);
+
+/* Called from the main loop once the watched file has been written */
+typedef void (*ConfigChangedFunc)(const gchar *path, gpointer data);
+
+struct ConfigWatcher
+{
+  gchar *path;
+  GFileMonitor *monitor;
+  /* Pending reload, editors write a file in several steps */
+  guint timeout_id;
+  ConfigChangedFunc callback;
+  gpointer data;
+};
+
+/* Watches 'path', including its replacement by a rename. Returns NULL when it cannot be watched. */
+ConfigWatcher *config_watcher_new(const gchar *path, ConfigChangedFunc callback, gpointer data);
+
+void config_watcher_free(ConfigWatcher *watcher);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+/* Width and height in heatmap pixels of one tile of a SearchRegion */
+#define SEARCH_TILE_SIZE 4
+
+/* Tile states */
+#define SEARCH_TILE_SKIP 0
+#define SEARCH_TILE_TRACKED 1
+#define SEARCH_TILE_ENTRY 2
+
+/**
+ * Set of heatmap tiles that find_peaks has to scan. Tiles are either
+ * skipped, around a tracked object, or part of the entry region where new
+ * objects are expected to show up first.
+ */
+class SearchRegion
+{
+public:
+  SearchRegion() : width(0), height(0), tiles_w(0), tiles_h(0)
+  {
+  }
+
+  /**
+   * Resizes the region to a width x height heatmap and sets all tiles to 'state'
+   */
+  void reset(int width, int height, uint8_t state)
+  {
+    this->width = width;
+    this->height = height;
+    this->tiles_w = (width + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+    this->tiles_h = (height + SEARCH_TILE_SIZE - 1) / SEARCH_TILE_SIZE;
+    this->tiles.assign(tiles_w * tiles_h, state);
+  }
+
+  /**
+   * Marks all tiles overlapping the pixel rectangle [i0, i1] x [j0, j1]
+   */
+  void addRect(int i0, int j0, int i1, int j1, uint8_t state)
+  {
+    int ti0 = clamp(i0, height) / SEARCH_TILE_SIZE;
+    int ti1 = clamp(i1, height) / SEARCH_TILE_SIZE;
+    int tj0 = clamp(j0, width) / SEARCH_TILE_SIZE;
+    int tj1 = clamp(j1, width) / SEARCH_TILE_SIZE;
+    for (int ti = ti0; ti <= ti1; ti++)
+    {
+      for (int tj = tj0; tj <= tj1; tj++)
+      {
+        uint8_t &tile = tiles[ti * tiles_w + tj];
+        if (tile == SEARCH_TILE_SKIP)
+        {
+          tile = state;
+        }
+      }
+    }
+  }
+
+  /**
+   * Marks a band of 'border' pixels along the edges of the heatmap
+   */
+  void addBorder(int border, uint8_t state)
+  {
+    addRect(0, 0, border - 1, width - 1, state);
+    addRect(height - border, 0, height - 1, width - 1, state);
+    addRect(0, 0, height - 1, border - 1, state);
+    addRect(0, width - border, height - 1, width - 1, state);
+  }
+
+  inline uint8_t tile(int ti, int tj) const
+  {
+    return tiles[ti * tiles_w + tj];
+  }
+
+  inline uint8_t pixel(int i, int j) const
+  {
+    return tile(i / SEARCH_TILE_SIZE, j / SEARCH_TILE_SIZE);
+  }
+
+  /**
+   * Returns the number of tiles that are not skipped
+   */
+  int numActive() const
+  {
+    int count = 0;
+    for (uint8_t tile : tiles)
+    {
+      if (tile != SEARCH_TILE_SKIP)
+      {
+        count++;
+      }
+    }
+    return count;
+  }
+
+  int width;
+  int height;
+  int tiles_w;
+  int tiles_h;
+
+private:
+  static inline int clamp(int v, int size)
+  {
+    return v < 0 ? 0 : (v >= size ? size - 1 : v);
+  }
+
+  std::vector<uint8_t> tiles;
+};
@@ -0,0 +1,132 @@
+#include "synthetic_tensors.hpp"
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+/* Keypoints of an upright person, {y, x} relative to a box of height 1 centered on x = 0 */
+static const float skeleton_template[NUM_BODY_PARTS][2] = {
+    {0.08f, 0.00f},  /* nose */
+    {0.06f, 0.03f},  /* left eye */
+    {0.06f, -0.03f}, /* right eye */
+    {0.08f, 0.06f},  /* left ear */
+    {0.08f, -0.06f}, /* right ear */
+    {0.20f, 0.15f},  /* left shoulder */
+    {0.20f, -0.15f}, /* right shoulder */
+    {0.35f, 0.20f},  /* left elbow */
+    {0.35f, -0.20f}, /* right elbow */
+    {0.48f, 0.22f},  /* left wrist */
+    {0.48f, -0.22f}, /* right wrist */
+    {0.52f, 0.10f},  /* left hip */
+    {0.52f, -0.10f}, /* right hip */
+    {0.72f, 0.11f},  /* left knee */
+    {0.72f, -0.11f}, /* right knee */
+    {0.93f, 0.12f},  /* left ankle */
+    {0.93f, -0.12f}, /* right ankle */
+    {0.18f, 0.00f},  /* neck */
+};
+
+void random_poses(Vec3D<float> &poses, int num_people, unsigned int seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> size_dist(0.3f, 0.6f);
+  std::uniform_real_distribution<float> unit_dist(0.0f, 1.0f);
+  std::uniform_real_distribution<float> jitter_dist(-0.02f, 0.02f);
+
+  poses.assign(num_people, Vec2D<float>(NUM_BODY_PARTS, Vec1D<float>(2, 0.0f)));
+
+  for (int n = 0; n < num_people; n++)
+  {
+    float size = size_dist(rng);
+    float top = unit_dist(rng) * (0.95f - size) + 0.02f;
+    float center = unit_dist(rng) * (0.9f - size * 0.5f) + 0.05f + size * 0.25f;
+
+    for (int c = 0; c < NUM_BODY_PARTS; c++)
+    {
+      poses[n][c][0] = top + (skeleton_template[c][0] + jitter_dist(rng)) * size;
+      poses[n][c][1] = center + (skeleton_template[c][1] + jitter_dist(rng)) * size;
+    }
+  }
+}
+
+void render_cmap(Vec1D<float> &cmap, Vec3D<float> &poses, int height, int width, float sigma)
+{
+  int r = (int)ceilf(3.0f * sigma);
+
+  cmap.assign(NUM_BODY_PARTS * height * width, 0.0f);
+
+  for (auto &pose : poses)
+  {
+    for (int c = 0; c < NUM_BODY_PARTS; c++)
+    {
+      float *cmap_c = &cmap[c * height * width];
+      float y = pose[c][0] * height - 0.5f;
+      float x = pose[c][1] * width - 0.5f;
+
+      for (int i = std::max(0, (int)y - r); i <= std::min(height - 1, (int)y + r); i++)
+      {
+        for (int j = std::max(0, (int)x - r); j <= std::min(width - 1, (int)x + r); j++)
+        {
+          float d2 = (i - y) * (i - y) + (j - x) * (j - x);
+          float value = expf(-d2 / (2.0f * sigma * sigma));
+          cmap_c[i * width + j] = std::max(cmap_c[i * width + j], value);
+        }
+      }
+    }
+  }
+}
+
+void render_paf(Vec1D<float> &paf, Vec3D<float> &poses, Vec2D<int> &topology,
+                int height, int width)
+{
+  paf.assign(NUM_PAF_CHANNELS * height * width, 0.0f);
+
+  for (auto &pose : poses)
+  {
+    for (auto &link : topology)
+    {
+      float *paf_i = &paf[link[0] * height * width];
+      float *paf_j = &paf[link[1] * height * width];
+      float ai = pose[link[2]][0] * height, aj = pose[link[2]][1] * width;
+      float bi = pose[link[3]][0] * height, bj = pose[link[3]][1] * width;
+      float len = sqrtf((bi - ai) * (bi - ai) + (bj - aj) * (bj - aj)) + EPS;
+      float ui = (bi - ai) / len, uj = (bj - aj) / len;
+
+      int i_min = std::max(0, (int)std::min(ai, bi) - 1);
+      int i_max = std::min(height - 1, (int)std::max(ai, bi) + 1);
+      int j_min = std::max(0, (int)std::min(aj, bj) - 1);
+      int j_max = std::min(width - 1, (int)std::max(aj, bj) + 1);
+
+      for (int i = i_min; i <= i_max; i++)
+      {
+        for (int j = j_min; j <= j_max; j++)
+        {
+          /* Distance of the pixel to the limb segment */
+          float pi = i + 0.5f - ai, pj = j + 0.5f - aj;
+          float along = pi * ui + pj * uj;
+          float across = fabsf(pi * uj - pj * ui);
+          if (along < 0.0f || along > len || across > 1.0f)
+            continue;
+          paf_i[i * width + j] = ui;
+          paf_j[i * width + j] = uj;
+        }
+      }
+    }
+  }
+}
+
+void chw_to_hwc(Vec1D<float> &dst, const Vec1D<float> &src, int channels, int height, int width)
+{
+  dst.resize(src.size());
+  for (int c = 0; c < channels; c++)
+  {
+    for (int i = 0; i < height; i++)
+    {
+      for (int j = 0; j < width; j++)
+      {
+        dst[(i * width + j) * channels + c] = src[(c * height + i) * width + j];
+      }
+    }
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "post_process.hpp"
+
+/* Number of keypoints of the TRTPose human model */
+#define NUM_BODY_PARTS 18
+
+/* Number of part affinity field channels of the TRTPose human model */
+#define NUM_PAF_CHANNELS 42
+
+/**
+ * Generates 'num_people' random skeletons. 'poses[n][c]' holds the {y, x}
+ * normalized position of keypoint c of person n.
+ */
+void random_poses(Vec3D<float> &poses, int num_people, unsigned int seed);
+
+/* Renders a CHW confidence map with a gaussian blob on each keypoint */
+void render_cmap(Vec1D<float> &cmap, Vec3D<float> &poses, int height, int width, float sigma);
+
+/* Renders CHW part affinity fields with unit vectors along each limb of 'topology' */
+void render_paf(Vec1D<float> &paf, Vec3D<float> &poses, Vec2D<int> &topology,
+                int height, int width);
+
+/* Copies a CHW tensor into HWC order */
+void chw_to_hwc(Vec1D<float> &dst, const Vec1D<float> &src, int channels, int height, int width);
@@ -0,0 +1,244 @@
+#include "task_scheduler.hpp"
+
+/* Argument of a worker thread */
+struct TaskWorkerStart
+{
+  TaskScheduler *scheduler;
+  int worker;
+};
+
+TaskScheduler::TaskScheduler(int num_threads, TaskThreadInit thread_init, gpointer thread_init_data)
+    : num_workers_(num_threads), thread_init_(thread_init), thread_init_data_(thread_init_data),
+      pending_(0), stop_(0), next_queue_(0)
+{
+  g_mutex_init(&sleep_lock_);
+  g_cond_init(&sleep_cond_);
+  g_mutex_init(&done_lock_);
+  g_cond_init(&done_cond_);
+
+  for (int i = 0; i <= num_threads; i++)
+  {
+    WorkerQueue *queue = new WorkerQueue();
+    g_mutex_init(&queue->lock);
+    queue->stats = TaskThreadStats();
+    queues_.push_back(queue);
+  }
+
+  for (int i = 0; i < num_threads; i++)
+  {
+    TaskWorkerStart *start = new TaskWorkerStart{this, i};
+    gchar *name = g_strdup_printf("post-process-%d", i);
+    threads_.push_back(g_thread_new(name, workerMain, start));
+    g_free(name);
+  }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  g_mutex_lock(&sleep_lock_);
+  g_atomic_int_set(&stop_, 1);
+  g_cond_broadcast(&sleep_cond_);
+  g_mutex_unlock(&sleep_lock_);
+
+  for (GThread *thread : threads_)
+    g_thread_join(thread);
+
+  for (WorkerQueue *queue : queues_)
+  {
+    g_mutex_clear(&queue->lock);
+    delete queue;
+  }
+  g_cond_clear(&done_cond_);
+  g_mutex_clear(&done_lock_);
+  g_cond_clear(&sleep_cond_);
+  g_mutex_clear(&sleep_lock_);
+}
+
+gpointer
+TaskScheduler::workerMain(gpointer data)
+{
+  TaskWorkerStart *start = (TaskWorkerStart *)data;
+  TaskScheduler *scheduler = start->scheduler;
+
+  if (scheduler->thread_init_)
+    scheduler->thread_init_(start->worker, scheduler->thread_init_data_);
+  scheduler->workerLoop(start->worker);
+  delete start;
+  return NULL;
+}
+
+/* Takes the newest task of the worker's own deque, the one whose data is most likely in cache */
+bool TaskScheduler::popTask(int worker, Task &task)
+{
+  WorkerQueue *queue = queues_[worker];
+  bool found = false;
+
+  g_mutex_lock(&queue->lock);
+  if (!queue->tasks.empty())
+  {
+    task = queue->tasks.back();
+    queue->tasks.pop_back();
+    found = true;
+  }
+  g_mutex_unlock(&queue->lock);
+
+  if (found)
+    g_atomic_int_add(&pending_, -1);
+  return found;
+}
+
+/* Takes the oldest task of another deque, starting after the thief's own */
+bool TaskScheduler::stealTask(int thief, Task &task)
+{
+  int num_workers = num_workers_;
+
+  for (int i = 1; i <= num_workers; i++)
+  {
+    WorkerQueue *queue = queues_[(thief + i) % (num_workers + 1)];
+    bool found = false;
+
+    if (queue == queues_[thief] || queue == queues_[num_workers])
+      continue;
+
+    g_mutex_lock(&queue->lock);
+    if (!queue->tasks.empty())
+    {
+      task = queue->tasks.front();
+      queue->tasks.pop_front();
+      found = true;
+    }
+    g_mutex_unlock(&queue->lock);
+
+    if (found)
+    {
+      g_atomic_int_add(&pending_, -1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Adds to a counter that 'getStats' may read at the same time */
+template <class T>
+static inline void
+add_stat(T &counter, T value)
+{
+  __atomic_add_fetch(&counter, value, __ATOMIC_RELAXED);
+}
+
+void TaskScheduler::runTask(const Task &task, TaskThreadStats &stats)
+{
+  (*task.job->fn)(task.index);
+  add_stat(stats.num_tasks, (guint64)1);
+
+  /* The job lives on the stack of its caller, which may return as soon as 'remaining' drops to 0 */
+  if (g_atomic_int_add(&task.job->remaining, -1) == 1)
+  {
+    g_mutex_lock(&done_lock_);
+    g_cond_broadcast(&done_cond_);
+    g_mutex_unlock(&done_lock_);
+  }
+}
+
+void TaskScheduler::workerLoop(int worker)
+{
+  WorkerQueue *queue = queues_[worker];
+  Task task;
+
+  while (!g_atomic_int_get(&stop_))
+  {
+    if (popTask(worker, task))
+    {
+      runTask(task, queue->stats);
+      continue;
+    }
+    if (stealTask(worker, task))
+    {
+      add_stat(queue->stats.num_steals, (guint64)1);
+      runTask(task, queue->stats);
+      continue;
+    }
+
+    /* Nothing left anywhere, sleep until the next parallelFor */
+    gint64 t0 = g_get_monotonic_time();
+    g_mutex_lock(&sleep_lock_);
+    while (!g_atomic_int_get(&stop_) && g_atomic_int_get(&pending_) == 0)
+      g_cond_wait(&sleep_cond_, &sleep_lock_);
+    g_mutex_unlock(&sleep_lock_);
+    add_stat(queue->stats.idle_us, g_get_monotonic_time() - t0);
+  }
+}
+
+void TaskScheduler::parallelFor(int n, const std::function<void(int)> &fn)
+{
+  int num_workers = num_workers_;
+  WorkerQueue *caller_queue = queues_[num_workers];
+  TaskThreadStats caller_stats = TaskThreadStats();
+  Job job;
+  Task task;
+
+  if (n <= 0)
+    return;
+  if (num_workers == 0)
+  {
+    for (int i = 0; i < n; i++)
+      fn(i);
+    return;
+  }
+
+  job.fn = &fn;
+  job.remaining = n;
+
+  /* Deal the tasks round-robin, consecutive indices to different workers */
+  int first = g_atomic_int_add(&next_queue_, 1) % num_workers;
+  for (int w = 0; w < num_workers; w++)
+  {
+    int worker = (first + w) % num_workers;
+    WorkerQueue *queue = queues_[worker];
+    g_mutex_lock(&queue->lock);
+    for (int i = w; i < n; i += num_workers)
+      queue->tasks.push_back(Task{&job, i});
+    g_mutex_unlock(&queue->lock);
+  }
+
+  g_mutex_lock(&sleep_lock_);
+  g_atomic_int_add(&pending_, n);
+  g_cond_broadcast(&sleep_cond_);
+  g_mutex_unlock(&sleep_lock_);
+
+  /* Help while there are tasks to take. Tasks of other callers may run here
+     too, their callers wait on them just the same. */
+  while (g_atomic_int_get(&job.remaining) > 0 && stealTask(num_workers, task))
+  {
+    caller_stats.num_steals++;
+    runTask(task, caller_stats);
+  }
+
+  /* The last tasks of the job are running on the workers, sleep until they returned */
+  if (g_atomic_int_get(&job.remaining) > 0)
+  {
+    gint64 t0 = g_get_monotonic_time();
+    g_mutex_lock(&done_lock_);
+    while (g_atomic_int_get(&job.remaining) > 0)
+      g_cond_wait(&done_cond_, &done_lock_);
+    g_mutex_unlock(&done_lock_);
+    caller_stats.idle_us += g_get_monotonic_time() - t0;
+  }
+
+  add_stat(caller_queue->stats.num_tasks, caller_stats.num_tasks);
+  add_stat(caller_queue->stats.num_steals, caller_stats.num_steals);
+  add_stat(caller_queue->stats.idle_us, caller_stats.idle_us);
+}
+
+void TaskScheduler::getStats(std::vector<TaskThreadStats> &stats)
+{
+  /* The counters are updated atomically without the lock, a copy may lag by a few tasks */
+  stats.resize(queues_.size());
+  for (size_t i = 0; i < queues_.size(); i++)
+  {
+    const TaskThreadStats &counters = queues_[i]->stats;
+    stats[i].num_tasks = __atomic_load_n(&counters.num_tasks, __ATOMIC_RELAXED);
+    stats[i].num_steals = __atomic_load_n(&counters.num_steals, __ATOMIC_RELAXED);
+    stats[i].idle_us = __atomic_load_n(&counters.idle_us, __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glib.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+/*
+ * Work-stealing scheduler for the post-processing tasks of all streams.
+ *
+ * Every worker thread owns a task deque. A worker takes its newest task
+ * first and, once its deque is empty, steals the oldest task of another
+ * deque. A caller of 'parallelFor' spreads its tasks over the deques, runs
+ * tasks itself while any is left to take and then sleeps until the last of
+ * its own returned, so several streams can share the workers without
+ * waiting for each other's batches.
+ */
+
+/* Counters of one thread, the last entry of 'TaskScheduler::getStats' is for the calling threads */
+struct TaskThreadStats
+{
+  guint64 num_tasks;
+  guint64 num_steals;
+  /* Time spent waiting for work, in us */
+  gint64 idle_us;
+};
+
+/* Called by each worker thread when it starts, before it runs any task */
+typedef void (*TaskThreadInit)(int worker, gpointer data);
+
+class TaskScheduler
+{
+public:
+  /* Starts 'num_threads' worker threads, which first call 'thread_init' when given */
+  explicit TaskScheduler(int num_threads, TaskThreadInit thread_init = NULL, gpointer thread_init_data = NULL);
+  ~TaskScheduler();
+
+  int numThreads() const
+  {
+    return num_workers_;
+  }
+
+  /* Calls 'fn(i)' for every i in [0, n) and returns once all the calls returned */
+  void parallelFor(int n, const std::function<void(int)> &fn);
+
+  /* Copies the counters of each worker and of the calling threads */
+  void getStats(std::vector<TaskThreadStats> &stats);
+
+private:
+  struct Job
+  {
+    const std::function<void(int)> *fn;
+    volatile gint remaining;
+  };
+
+  struct Task
+  {
+    Job *job;
+    int index;
+  };
+
+  struct WorkerQueue
+  {
+    GMutex lock;
+    std::deque<Task> tasks;
+    /* Updated atomically, not under 'lock' */
+    TaskThreadStats stats;
+  };
+
+  static gpointer workerMain(gpointer data);
+  void workerLoop(int worker);
+  bool popTask(int worker, Task &task);
+  bool stealTask(int thief, Task &task);
+  void runTask(const Task &task, TaskThreadStats &stats);
+
+  /* Set before the threads start, 'threads_' grows while they run */
+  const int num_workers_;
+  std::vector<GThread *> threads_;
+  TaskThreadInit thread_init_;
+  gpointer thread_init_data_;
+  /* One queue per worker, then the queue of the calling threads, which is never filled */
+  std::vector<WorkerQueue *> queues_;
+  /* Tasks pushed and not taken yet */
+  volatile gint pending_;
+  volatile gint stop_;
+  GMutex sleep_lock_;
+  GCond sleep_cond_;
+  /* Signaled when the last task of a job returns */
+  GMutex done_lock_;
+  GCond done_cond_;
+  /* Queue the next 'parallelFor' starts filling, to spread concurrent callers */
+  volatile gint next_queue_;
+};
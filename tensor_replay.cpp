@@ -0,0 +1,333 @@
+#include "tensor_replay.hpp"
+#include "synthetic_tensors.hpp"
+
+#include "gstnvdsmeta.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <cmath>
+
+static guint
+element_size(NvDsInferDataType type)
+{
+  switch (type)
+  {
+  case HALF:
+    return 2;
+  case INT8:
+    return 1;
+  default:
+    return 4;
+  }
+}
+
+static guint
+layer_bytes(const NvDsInferLayerInfo &layer)
+{
+  guint num_elements = 1;
+  for (unsigned int i = 0; i < layer.inferDims.numDims; i++)
+    num_elements *= layer.inferDims.d[i];
+  return num_elements * element_size(layer.dataType);
+}
+
+/* A frame queued for the writer thread */
+struct RecordedFrame
+{
+  TensorRecordFrame header;
+  Vec1D<guint8> data[TENSOR_REPLAY_NUM_LAYERS];
+};
+
+/* Pushed by 'tensor_record_close' to stop the writer thread */
+static RecordedFrame stop_marker;
+
+static gboolean
+write_recorded_frame(FILE *file, const RecordedFrame *frame)
+{
+  if (fwrite(&frame->header, sizeof(frame->header), 1, file) != 1)
+    return FALSE;
+  for (int i = 0; i < TENSOR_REPLAY_NUM_LAYERS; i++)
+  {
+    if (fwrite(frame->data[i].data(), 1, frame->data[i].size(), file) != frame->data[i].size())
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static gpointer
+record_thread(gpointer data)
+{
+  TensorRecorder *recorder = (TensorRecorder *)data;
+
+  for (;;)
+  {
+    RecordedFrame *frame = (RecordedFrame *)g_async_queue_pop(recorder->queue);
+    if (frame == &stop_marker)
+      break;
+    if (write_recorded_frame(recorder->file, frame))
+    {
+      g_atomic_int_inc(&recorder->num_written);
+      __atomic_add_fetch(&recorder->num_bytes, sizeof(frame->header) + frame->data[0].size() + frame->data[1].size(),
+                         __ATOMIC_RELAXED);
+    }
+    else
+      g_printerr("Tensor recording write failed: %s\n", strerror(errno));
+    delete frame;
+    g_atomic_int_add(&recorder->num_queued, -1);
+  }
+  return NULL;
+}
+
+TensorRecorder *
+tensor_record_open(const gchar *path)
+{
+  FILE *file = fopen(path, "ab");
+  if (!file)
+  {
+    g_printerr("Failed to open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  TensorRecorder *recorder = g_new0(TensorRecorder, 1);
+  recorder->file = file;
+  recorder->queue = g_async_queue_new();
+  recorder->thread = g_thread_new("tensor-record", record_thread, recorder);
+  return recorder;
+}
+
+gboolean
+tensor_record_frame(TensorRecorder *recorder, NvDsInferTensorMeta *tensor_meta, guint source_id,
+                    gint64 frame_num, guint width, guint height)
+{
+  if (tensor_meta->num_output_layers < TENSOR_REPLAY_NUM_LAYERS)
+    return FALSE;
+  if (g_atomic_int_get(&recorder->num_queued) >= TENSOR_RECORD_MAX_QUEUED)
+  {
+    g_atomic_int_inc(&recorder->num_dropped);
+    return FALSE;
+  }
+
+  RecordedFrame *frame = new RecordedFrame;
+  TensorRecordFrame &header = frame->header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TENSOR_RECORD_MAGIC;
+  header.source_id = source_id;
+  header.frame_num = frame_num;
+  header.width = width;
+  header.height = height;
+  for (int i = 0; i < TENSOR_REPLAY_NUM_LAYERS; i++)
+  {
+    NvDsInferLayerInfo &layer = tensor_meta->output_layers_info[i];
+    if (layer.inferDims.numDims != 3)
+    {
+      delete frame;
+      return FALSE;
+    }
+    header.layers[i].data_type = layer.dataType;
+    header.layers[i].num_dims = layer.inferDims.numDims;
+    memcpy(header.layers[i].dims, layer.inferDims.d, sizeof(header.layers[i].dims));
+    header.layers[i].num_bytes = layer_bytes(layer);
+
+    const guint8 *bytes = (const guint8 *)tensor_meta->out_buf_ptrs_host[i];
+    frame->data[i].assign(bytes, bytes + header.layers[i].num_bytes);
+  }
+
+  g_atomic_int_inc(&recorder->num_queued);
+  g_async_queue_push(recorder->queue, frame);
+  return TRUE;
+}
+
+void
+tensor_record_close(TensorRecorder *recorder)
+{
+  if (!recorder)
+    return;
+
+  g_async_queue_push(recorder->queue, &stop_marker);
+  g_thread_join(recorder->thread);
+  g_async_queue_unref(recorder->queue);
+  fclose(recorder->file);
+  g_free(recorder);
+}
+
+static void
+set_layer(NvDsInferLayerInfo &layer, NvDsInferDataType type, const guint32 dims[3])
+{
+  memset(&layer, 0, sizeof(layer));
+  layer.dataType = type;
+  layer.inferDims.numDims = 3;
+  layer.inferDims.numElements = dims[0] * dims[1] * dims[2];
+  for (int d = 0; d < 3; d++)
+    layer.inferDims.d[d] = dims[d];
+}
+
+gboolean
+tensor_replay_load(const gchar *path, Vec1D<ReplayFrame> &frames)
+{
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gsize length = 0;
+
+  if (!g_file_get_contents(path, &contents, &length, &error))
+  {
+    g_printerr("Failed to read the tensor recording %s: %s\n", path, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  gsize offset = 0;
+  while (offset + sizeof(TensorRecordFrame) <= length)
+  {
+    TensorRecordFrame header;
+    memcpy(&header, contents + offset, sizeof(header));
+    if (header.magic != TENSOR_RECORD_MAGIC)
+      break;
+    offset += sizeof(header);
+
+    ReplayFrame frame;
+    frame.source_id = header.source_id;
+    frame.width = header.width;
+    frame.height = header.height;
+    for (int i = 0; i < TENSOR_REPLAY_NUM_LAYERS; i++)
+    {
+      TensorRecordLayer &layer = header.layers[i];
+      set_layer(frame.layers[i], (NvDsInferDataType)layer.data_type, layer.dims);
+      if (layer.num_bytes != layer_bytes(frame.layers[i]) || offset + layer.num_bytes > length)
+      {
+        g_printerr("Truncated tensor recording %s\n", path);
+        g_free(contents);
+        return !frames.empty();
+      }
+      frame.data[i].assign(contents + offset, contents + offset + layer.num_bytes);
+      offset += layer.num_bytes;
+    }
+    frames.push_back(frame);
+  }
+
+  g_free(contents);
+  if (frames.empty())
+    g_printerr("%s is not a tensor recording\n", path);
+  return !frames.empty();
+}
+
+void
+tensor_replay_synthetic(int num_people, TensorLayout layout, guint width, guint height,
+                        Vec1D<ReplayFrame> &frames)
+{
+  const int H = TENSOR_REPLAY_SYNTHETIC_SIZE, W = TENSOR_REPLAY_SYNTHETIC_SIZE;
+  Vec2D<int> topology = default_topology();
+  Vec3D<float> base, poses;
+  Vec1D<float> cmap, paf, interleaved;
+
+  random_poses(base, num_people, 1234);
+  frames.resize(TENSOR_REPLAY_SYNTHETIC_FRAMES);
+  for (int f = 0; f < TENSOR_REPLAY_SYNTHETIC_FRAMES; f++)
+  {
+    /* Walk back and forth over a few heatmap pixels */
+    float shift = 0.05f * sinf(2.0f * (float)M_PI * f / TENSOR_REPLAY_SYNTHETIC_FRAMES);
+    poses = base;
+    for (auto &pose : poses)
+    {
+      for (auto &keypoint : pose)
+        keypoint[1] += shift;
+    }
+    render_cmap(cmap, poses, H, W, 1.5f);
+    render_paf(paf, poses, topology, H, W);
+
+    ReplayFrame &frame = frames[f];
+    frame.source_id = 0;
+    frame.width = width;
+    frame.height = height;
+    Vec1D<float> *layers[TENSOR_REPLAY_NUM_LAYERS] = {&cmap, &paf};
+    const guint32 channels[TENSOR_REPLAY_NUM_LAYERS] = {NUM_BODY_PARTS, NUM_PAF_CHANNELS};
+    for (int i = 0; i < TENSOR_REPLAY_NUM_LAYERS; i++)
+    {
+      Vec1D<float> *src = layers[i];
+      if (layout == TENSOR_LAYOUT_HWC)
+      {
+        const guint32 dims[3] = {(guint32)H, (guint32)W, channels[i]};
+        chw_to_hwc(interleaved, *src, channels[i], H, W);
+        src = &interleaved;
+        set_layer(frame.layers[i], FLOAT, dims);
+      }
+      else
+      {
+        const guint32 dims[3] = {channels[i], (guint32)H, (guint32)W};
+        set_layer(frame.layers[i], FLOAT, dims);
+      }
+      const guint8 *bytes = (const guint8 *)src->data();
+      frame.data[i].assign(bytes, bytes + src->size() * sizeof(float));
+    }
+  }
+}
+
+static gpointer
+copy_tensor_meta(gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *)data;
+  NvDsInferTensorMeta *src = (NvDsInferTensorMeta *)user_meta->user_meta_data;
+  NvDsInferTensorMeta *dst = (NvDsInferTensorMeta *)g_memdup(src, sizeof(NvDsInferTensorMeta));
+  dst->output_layers_info = (NvDsInferLayerInfo *)g_memdup(src->output_layers_info,
+                                                           src->num_output_layers * sizeof(NvDsInferLayerInfo));
+  dst->out_buf_ptrs_host = (void **)g_memdup(src->out_buf_ptrs_host, src->num_output_layers * sizeof(void *));
+  return dst;
+}
+
+static void
+release_tensor_meta(gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *)data;
+  NvDsInferTensorMeta *tensor_meta = (NvDsInferTensorMeta *)user_meta->user_meta_data;
+  g_free(tensor_meta->output_layers_info);
+  g_free(tensor_meta->out_buf_ptrs_host);
+  g_free(tensor_meta);
+  user_meta->user_meta_data = NULL;
+}
+
+GstBuffer *
+tensor_replay_buffer(ReplayFrame &frame, guint source_id, gint64 frame_num,
+                     GstClockTime pts, gint64 push_time)
+{
+  GstBuffer *buffer = gst_buffer_new();
+  GST_BUFFER_PTS(buffer) = pts;
+
+  /* What nvstreammux attaches */
+  NvDsBatchMeta *batch_meta = nvds_create_batch_meta(1);
+  NvDsMeta *meta = gst_buffer_add_nvds_meta(buffer, batch_meta, NULL,
+                                            nvds_batch_meta_copy_func, nvds_batch_meta_release_func);
+  meta->meta_type = NVDS_BATCH_GST_META;
+  batch_meta->base_meta.batch_meta = batch_meta;
+  batch_meta->base_meta.copy_func = nvds_batch_meta_copy_func;
+  batch_meta->base_meta.release_func = nvds_batch_meta_release_func;
+  batch_meta->max_frames_in_batch = 1;
+
+  NvDsFrameMeta *frame_meta = nvds_acquire_frame_meta_from_pool(batch_meta);
+  frame_meta->pad_index = source_id;
+  frame_meta->source_id = source_id;
+  frame_meta->batch_id = 0;
+  frame_meta->frame_num = frame_num;
+  frame_meta->buf_pts = pts;
+  frame_meta->source_frame_width = frame.width;
+  frame_meta->source_frame_height = frame.height;
+  frame_meta->num_surfaces_per_frame = 1;
+  frame_meta->misc_frame_info[0] = push_time;
+  nvds_add_frame_meta_to_batch(batch_meta, frame_meta);
+
+  /* What nvinfer attaches with output-tensor-meta=1 */
+  NvDsInferTensorMeta *tensor_meta = (NvDsInferTensorMeta *)g_malloc0(sizeof(NvDsInferTensorMeta));
+  tensor_meta->unique_id = 1;
+  tensor_meta->num_output_layers = TENSOR_REPLAY_NUM_LAYERS;
+  tensor_meta->output_layers_info = (NvDsInferLayerInfo *)g_memdup(frame.layers, sizeof(frame.layers));
+  tensor_meta->out_buf_ptrs_host = (void **)g_malloc0(TENSOR_REPLAY_NUM_LAYERS * sizeof(void *));
+  for (int i = 0; i < TENSOR_REPLAY_NUM_LAYERS; i++)
+    tensor_meta->out_buf_ptrs_host[i] = frame.data[i].data();
+
+  NvDsUserMeta *user_meta = nvds_acquire_user_meta_from_pool(batch_meta);
+  user_meta->user_meta_data = tensor_meta;
+  user_meta->base_meta.meta_type = NVDSINFER_TENSOR_OUTPUT_META;
+  user_meta->base_meta.copy_func = (NvDsMetaCopyFunc)copy_tensor_meta;
+  user_meta->base_meta.release_func = (NvDsMetaReleaseFunc)release_tensor_meta;
+  nvds_add_user_meta_to_frame(frame_meta, user_meta);
+
+  return buffer;
+}
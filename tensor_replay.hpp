@@ -0,0 +1,101 @@
+#pragma once
+
+#include "post_process.hpp"
+
+#include <gst/gst.h>
+#include <stdio.h>
+
+#include "gstnvdsinfer.h"
+
+/*
+ * Replay of cmap and paf tensors without nvinfer, to run the probes of the
+ * application on a machine without a GPU.
+ *
+ * Tensors come from a recording made with --record-tensors on a GPU, or
+ * are rendered from synthetic skeletons. Each replayed frame is a small
+ * GstBuffer carrying an NvDsBatchMeta with one frame meta and an
+ * NvDsInferTensorMeta, the metadata nvstreammux and nvinfer would attach.
+ */
+
+#define TENSOR_RECORD_MAGIC 0x524e5354u /* "TSNR" */
+
+/* Number of output layers of the pose model, cmap and paf */
+#define TENSOR_REPLAY_NUM_LAYERS 2
+
+/* Heatmap size of the synthetic tensors, the output size of the 224x224 model */
+#define TENSOR_REPLAY_SYNTHETIC_SIZE 56
+
+/* Number of distinct synthetic frames, the skeletons move a little between them */
+#define TENSOR_REPLAY_SYNTHETIC_FRAMES 64
+
+/* Recorded frames waiting for the writer thread above which new frames are dropped, 750 KB each for the 224x224 model in FP32 */
+#define TENSOR_RECORD_MAX_QUEUED 64
+
+/* On-disk description of one output layer */
+struct TensorRecordLayer
+{
+  guint32 data_type;
+  guint32 num_dims;
+  guint32 dims[3];
+  guint32 num_bytes;
+};
+
+/* On-disk frame header, followed by the bytes of each layer */
+struct TensorRecordFrame
+{
+  guint32 magic;
+  guint32 source_id;
+  gint64 frame_num;
+  guint32 width;
+  guint32 height;
+  TensorRecordLayer layers[TENSOR_REPLAY_NUM_LAYERS];
+};
+
+struct ReplayFrame
+{
+  guint source_id;
+  guint width;
+  guint height;
+  NvDsInferLayerInfo layers[TENSOR_REPLAY_NUM_LAYERS];
+  Vec1D<guint8> data[TENSOR_REPLAY_NUM_LAYERS];
+};
+
+/**
+ * Recording of the output layers. The streaming thread only copies the
+ * layers into a queue; a writer thread appends them to the file.
+ */
+struct TensorRecorder
+{
+  FILE *file;
+  GAsyncQueue *queue;
+  GThread *thread;
+  volatile gint num_queued;
+  volatile gint num_dropped;
+  volatile gint num_written;
+  guint64 num_bytes;
+};
+
+/* Opens 'path' for appending and starts the writer thread */
+TensorRecorder *tensor_record_open(const gchar *path);
+
+/* Queues a copy of the output layers of 'tensor_meta', returns FALSE when they were dropped */
+gboolean tensor_record_frame(TensorRecorder *recorder, NvDsInferTensorMeta *tensor_meta, guint source_id,
+                             gint64 frame_num, guint width, guint height);
+
+/* Writes the queued frames and closes the recording */
+void tensor_record_close(TensorRecorder *recorder);
+
+/* Loads all the frames of a recording */
+gboolean tensor_replay_load(const gchar *path, Vec1D<ReplayFrame> &frames);
+
+/* Renders FP32 tensors of 'num_people' walking skeletons in the given layout */
+void tensor_replay_synthetic(int num_people, TensorLayout layout, guint width, guint height,
+                             Vec1D<ReplayFrame> &frames);
+
+/**
+ * Returns a buffer with the batch meta of 'frame'. The tensor meta points
+ * into 'frame', which must outlive the buffer. 'push_time' is kept in
+ * misc_frame_info[0] of the frame meta to measure the latency.
+ */
+GstBuffer *tensor_replay_buffer(ReplayFrame &frame, guint source_id, gint64 frame_num,
+                                GstClockTime pts, gint64 push_time);
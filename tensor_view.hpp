@@ -0,0 +1,168 @@
+#pragma once
+
+#include "gstnvdsinfer.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Scale of INT8 output layers when none is configured, maps [-127, 127] to [-1, 1] */
+#define DEFAULT_INT8_SCALE (1.0f / 127.0f)
+
+/* Memory layouts of the output layers */
+typedef enum
+{
+  TENSOR_LAYOUT_CHW = 0,
+  TENSOR_LAYOUT_HWC = 1,
+} TensorLayout;
+
+/**
+ * Read-only view on an output layer of nvinfer, in the data type the
+ * engine produced. The post-processing reads the elements through
+ * 'load_value' so FP16 and INT8 layers need no conversion pass.
+ * Element (c, i, j) is at 'stride_c * c + stride_h * i + stride_w * j',
+ * which covers the CHW and HWC layouts. nvinfer copies the output layers
+ * to dense host buffers, so the strides follow from the dimensions.
+ */
+struct TensorView
+{
+  const void *data;
+  NvDsInferDataType type;
+  float scale;
+  int channels;
+  int height;
+  int width;
+  int stride_c;
+  int stride_h;
+  int stride_w;
+
+  inline bool interleaved() const
+  {
+    return stride_c == 1 && channels > 1;
+  }
+};
+
+/* Converts an IEEE 754 half precision value to float */
+static inline float
+half_to_float(uint16_t h)
+{
+#if defined(__aarch64__)
+  __fp16 v;
+  memcpy(&v, &h, sizeof(v));
+  return (float)v;
+#else
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+
+  if (exponent == 0x1f)
+  {
+    /* Inf or NaN */
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  }
+  else if (exponent != 0)
+  {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  else if (mantissa == 0)
+  {
+    bits = sign;
+  }
+  else
+  {
+    /* Subnormal half, normalize it */
+    exponent = 113;
+    while (!(mantissa & 0x400))
+    {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+#endif
+}
+
+template <class T>
+static inline float load_value(const T *data, int index, float scale);
+
+template <>
+inline float load_value<float>(const float *data, int index, float scale)
+{
+  return data[index];
+}
+
+template <>
+inline float load_value<uint16_t>(const uint16_t *data, int index, float scale)
+{
+  return half_to_float(data[index]);
+}
+
+template <>
+inline float load_value<int8_t>(const int8_t *data, int index, float scale)
+{
+  return data[index] * scale;
+}
+
+/* Returns a dense FP32 view of 'dims' in the given layout, CHW by default,
+   the layout the post-processing historically assumed */
+static inline TensorView
+make_tensor_view(void *data, NvDsInferDims &dims, TensorLayout layout = TENSOR_LAYOUT_CHW)
+{
+  TensorView view;
+  view.data = data;
+  view.type = FLOAT;
+  view.scale = 1.0f;
+  if (layout == TENSOR_LAYOUT_HWC)
+  {
+    view.height = dims.d[0];
+    view.width = dims.d[1];
+    view.channels = dims.d[2];
+    view.stride_c = 1;
+    view.stride_w = view.channels;
+    view.stride_h = view.width * view.channels;
+  }
+  else
+  {
+    view.channels = dims.d[0];
+    view.height = dims.d[1];
+    view.width = dims.d[2];
+    view.stride_c = view.height * view.width;
+    view.stride_h = view.width;
+    view.stride_w = 1;
+  }
+  return view;
+}
+
+/* Returns a view on output layer 'index' of the tensor meta, in its own data type */
+static inline TensorView
+make_tensor_view(NvDsInferTensorMeta *tensor_meta, int index, float int8_scale,
+                 TensorLayout layout = TENSOR_LAYOUT_CHW)
+{
+  NvDsInferLayerInfo &layer = tensor_meta->output_layers_info[index];
+  TensorView view = make_tensor_view(tensor_meta->out_buf_ptrs_host[index], layer.inferDims, layout);
+  view.type = layer.dataType;
+  view.scale = (layer.dataType == INT8) ? int8_scale : 1.0f;
+  return view;
+}
+
+/* Calls 'func<T>(...)' with T the element type of 'view' */
+#define DISPATCH_TENSOR_TYPE(view, func, ...)                                            \
+  do                                                                                     \
+  {                                                                                      \
+    switch ((view).type)                                                                 \
+    {                                                                                    \
+    case HALF:                                                                           \
+      func<uint16_t>(__VA_ARGS__);                                                       \
+      break;                                                                             \
+    case INT8:                                                                           \
+      func<int8_t>(__VA_ARGS__);                                                         \
+      break;                                                                             \
+    default:                                                                             \
+      func<float>(__VA_ARGS__);                                                          \
+      break;                                                                             \
+    }                                                                                    \
+  } while (0)
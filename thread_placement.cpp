@@ -0,0 +1,227 @@
+#include "thread_placement.hpp"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct SchedPolicyName
+{
+  const gchar *name;
+  int policy;
+};
+
+static const SchedPolicyName sched_policy_names[] = {
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+    {"fifo", SCHED_FIFO},
+    {"rr", SCHED_RR},
+};
+
+static gboolean
+is_realtime(int policy)
+{
+  return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static const gchar *
+sched_policy_name(int policy)
+{
+  for (const SchedPolicyName &entry : sched_policy_names)
+    if (entry.policy == policy)
+      return entry.name;
+  return "unknown";
+}
+
+static gboolean
+parse_cpu_list(ThreadPlacement *placement, const gchar *cpus)
+{
+  gchar **items = g_strsplit(cpus, ",", -1);
+  gboolean ok = TRUE;
+
+  for (gchar **item = items; *item != NULL && ok; item++)
+  {
+    gchar *end;
+    long first = strtol(*item, &end, 10);
+    long last = first;
+
+    if (end == *item)
+      ok = FALSE;
+    else if (*end == '-')
+    {
+      gchar *range_end = end + 1;
+      last = strtol(range_end, &end, 10);
+      if (end == range_end)
+        ok = FALSE;
+    }
+    if (!ok || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+    {
+      ok = FALSE;
+      break;
+    }
+
+    for (long cpu = first; cpu <= last && placement->num_cpus < CPU_SETSIZE; cpu++)
+      placement->cpus[placement->num_cpus++] = cpu;
+  }
+  g_strfreev(items);
+
+  if (!ok || placement->num_cpus == 0)
+  {
+    g_printerr("Invalid CPU list %s, expected CPUs and ranges such as 0,2-3\n", cpus);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+parse_sched(ThreadPlacement *placement, const gchar *sched)
+{
+  const gchar *colon = strchr(sched, ':');
+  gchar *name = colon ? g_strndup(sched, colon - sched) : g_strdup(sched);
+  gboolean found = FALSE;
+
+  for (const SchedPolicyName &entry : sched_policy_names)
+  {
+    if (g_ascii_strcasecmp(name, entry.name) == 0)
+    {
+      placement->policy = entry.policy;
+      found = TRUE;
+    }
+  }
+  g_free(name);
+  if (!found)
+  {
+    g_printerr("Unknown scheduling policy %s, expected other, batch, idle, fifo or rr\n", sched);
+    return FALSE;
+  }
+
+  /* Real-time policies need a priority, 1 unless given */
+  placement->priority = is_realtime(placement->policy) ? 1 : 0;
+  if (colon)
+  {
+    gchar *end;
+    placement->priority = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end != '\0')
+    {
+      g_printerr("Invalid scheduling priority in %s\n", sched);
+      return FALSE;
+    }
+  }
+
+  int min = is_realtime(placement->policy) ? sched_get_priority_min(placement->policy) : -20;
+  int max = is_realtime(placement->policy) ? sched_get_priority_max(placement->policy) : 19;
+  if (placement->priority < min || placement->priority > max)
+  {
+    g_printerr("Priority %d of %s out of range [%d, %d]\n", placement->priority, sched, min, max);
+    return FALSE;
+  }
+  placement->has_policy = TRUE;
+  return TRUE;
+}
+
+gboolean
+thread_placement_parse(ThreadPlacement *placement, const gchar *cpus, const gchar *sched)
+{
+  memset(placement, 0, sizeof(ThreadPlacement));
+
+  if (cpus && !parse_cpu_list(placement, cpus))
+    return FALSE;
+  if (sched && !parse_sched(placement, sched))
+    return FALSE;
+  return TRUE;
+}
+
+gboolean
+thread_placement_is_set(const ThreadPlacement *placement)
+{
+  return placement->num_cpus > 0 || placement->has_policy;
+}
+
+/* Appends the CPUs of 'set' to 'str' as a list of ranges */
+static void
+append_cpu_set(GString *str, const cpu_set_t *set)
+{
+  int first = -1;
+
+  for (int cpu = 0; cpu <= CPU_SETSIZE; cpu++)
+  {
+    gboolean in_set = cpu < CPU_SETSIZE && CPU_ISSET(cpu, set);
+    if (in_set && first < 0)
+      first = cpu;
+    else if (!in_set && first >= 0)
+    {
+      if (str->len > 0 && str->str[str->len - 1] != ' ')
+        g_string_append_c(str, ',');
+      if (cpu - 1 > first)
+        g_string_append_printf(str, "%d-%d", first, cpu - 1);
+      else
+        g_string_append_printf(str, "%d", first);
+      first = -1;
+    }
+  }
+}
+
+void
+thread_placement_apply(const ThreadPlacement *placement, const gchar *thread_name, int index)
+{
+  pthread_t thread = pthread_self();
+  pid_t tid = syscall(SYS_gettid);
+  cpu_set_t set;
+  int err;
+
+  if (placement->num_cpus > 0)
+  {
+    CPU_ZERO(&set);
+    if (index >= 0)
+      CPU_SET(placement->cpus[index % placement->num_cpus], &set);
+    else
+      for (int i = 0; i < placement->num_cpus; i++)
+        CPU_SET(placement->cpus[i], &set);
+
+    err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0)
+      g_printerr("%s: failed to set the CPU affinity: %s\n", thread_name, strerror(err));
+  }
+
+  if (placement->has_policy)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    if (is_realtime(placement->policy))
+      param.sched_priority = placement->priority;
+
+    err = pthread_setschedparam(thread, placement->policy, &param);
+    if (err != 0)
+      g_printerr("%s: failed to set the scheduling policy %s: %s\n", thread_name,
+                 sched_policy_name(placement->policy), strerror(err));
+    /* The nice value of a Linux thread is set on its tid */
+    else if (!is_realtime(placement->policy) && setpriority(PRIO_PROCESS, tid, placement->priority) < 0)
+      g_printerr("%s: failed to set the nice value %d: %s\n", thread_name, placement->priority,
+                 strerror(errno));
+  }
+
+  /* Report what the thread actually got */
+  GString *report = g_string_new(NULL);
+  struct sched_param param;
+  int policy;
+
+  g_string_append_printf(report, "%s (tid %d): cpus ", thread_name, (int)tid);
+  if (pthread_getaffinity_np(thread, sizeof(set), &set) == 0)
+    append_cpu_set(report, &set);
+  else
+    g_string_append(report, "?");
+  if (pthread_getschedparam(thread, &policy, &param) == 0)
+  {
+    if (is_realtime(policy))
+      g_string_append_printf(report, ", policy %s priority %d", sched_policy_name(policy), param.sched_priority);
+    else
+      g_string_append_printf(report, ", policy %s nice %d", sched_policy_name(policy),
+                             getpriority(PRIO_PROCESS, tid));
+  }
+  g_print("%s\n", report->str);
+  g_string_free(report, TRUE);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glib.h>
+#include <sched.h>
+
+/*
+ * CPU affinity and scheduling class of the threads that run the
+ * post-processing: the streaming thread of the nvinfer probe and the
+ * TaskScheduler threads. A placement is parsed from the command line and
+ * applied by each thread to itself, as the streaming thread only exists
+ * once the pipeline runs.
+ */
+
+struct ThreadPlacement
+{
+  /* CPUs the thread may run on, all of them when 'num_cpus' is 0 */
+  int num_cpus;
+  int cpus[CPU_SETSIZE];
+  /* SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR, unchanged when 'has_policy' is FALSE */
+  gboolean has_policy;
+  int policy;
+  /* Real-time priority for SCHED_FIFO and SCHED_RR, nice value otherwise */
+  int priority;
+};
+
+/**
+ * Parses 'cpus', a list of CPUs and ranges such as "2,3" or "4-7", and
+ * 'sched', POLICY[:PRIORITY] with POLICY one of other, batch, idle, fifo
+ * or rr. Either may be NULL to leave that setting alone. Prints the
+ * error and returns FALSE when one of them is invalid.
+ */
+gboolean thread_placement_parse(ThreadPlacement *placement, const gchar *cpus, const gchar *sched);
+
+/* TRUE when the placement changes anything */
+gboolean thread_placement_is_set(const ThreadPlacement *placement);
+
+/**
+ * Applies 'placement' to the calling thread and prints the affinity and
+ * scheduling class it ends up with. When 'index' is not negative, only
+ * CPU index % num_cpus of the list is used, to pin the threads of a pool
+ * one per CPU. Settings the system refuses are reported and skipped.
+ */
+void thread_placement_apply(const ThreadPlacement *placement, const gchar *thread_name, int index);
@@ -0,0 +1,191 @@
+#include "worker_supervisor.hpp"
+
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+void
+worker_source_range(guint worker, guint num_workers, guint num_sources, guint *first, guint *count)
+{
+  guint start = (guint64)worker * num_sources / num_workers;
+  guint end = (guint64)(worker + 1) * num_sources / num_workers;
+
+  *first = start;
+  *count = end - start;
+}
+
+/* Runs in the forked child before exec, a worker must not outlive the supervisor */
+static void
+worker_child_setup(gpointer data)
+{
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+}
+
+static void spawn_worker(WorkerProcess *worker);
+
+static gboolean
+all_workers_done(WorkerSupervisor *supervisor)
+{
+  for (guint w = 0; w < supervisor->num_workers; w++)
+  {
+    WorkerProcess &worker = supervisor->workers[w];
+    if (worker.running || worker.restart_source_id)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+on_restart_timeout(gpointer data)
+{
+  WorkerProcess *worker = (WorkerProcess *)data;
+
+  worker->restart_source_id = 0;
+  worker->num_restarts++;
+  spawn_worker(worker);
+  return FALSE;
+}
+
+static void
+on_worker_exit(GPid pid, gint status, gpointer data)
+{
+  WorkerProcess *worker = (WorkerProcess *)data;
+  WorkerSupervisor *supervisor = worker->supervisor;
+  guint first, count;
+
+  g_spawn_close_pid(pid);
+  worker->running = FALSE;
+  worker_source_range(worker->index, supervisor->num_workers, supervisor->num_sources, &first, &count);
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+  {
+    g_print("worker %u (pid %d) finished\n", worker->index, pid);
+    worker->finished = TRUE;
+  }
+  else
+  {
+    if (WIFSIGNALED(status))
+      g_printerr("worker %u (pid %d) killed by signal %d\n", worker->index, pid, WTERMSIG(status));
+    else
+      g_printerr("worker %u (pid %d) exited with status %d\n", worker->index, pid, WEXITSTATUS(status));
+
+    for (guint s = first; s < first + count; s++)
+      pose_index_recover(supervisor->index, s);
+
+    if (!supervisor->stopping)
+    {
+      if (g_get_monotonic_time() - worker->start_time > WORKER_STABLE_US)
+        worker->restart_delay_ms = WORKER_RESTART_DELAY_MS;
+      g_printerr("restarting worker %u in %u ms\n", worker->index, worker->restart_delay_ms);
+      worker->restart_source_id = g_timeout_add(worker->restart_delay_ms, on_restart_timeout, worker);
+      worker->restart_delay_ms = MIN(worker->restart_delay_ms * 2, WORKER_MAX_RESTART_DELAY_MS);
+    }
+  }
+
+  if (all_workers_done(supervisor))
+    g_main_loop_quit(supervisor->loop);
+}
+
+static void
+spawn_worker(WorkerProcess *worker)
+{
+  WorkerSupervisor *supervisor = worker->supervisor;
+  guint argc = g_strv_length(supervisor->argv);
+  gchar **argv = g_new0(gchar *, argc + 3);
+  gchar *index_str = g_strdup_printf("%u", worker->index);
+  GError *error = NULL;
+  guint first, count;
+
+  for (guint i = 0; i < argc; i++)
+    argv[i] = supervisor->argv[i];
+  argv[argc] = (gchar *)"--worker-index";
+  argv[argc + 1] = index_str;
+
+  worker->start_time = g_get_monotonic_time();
+  if (!g_spawn_async(NULL, argv, NULL, (GSpawnFlags)(G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH),
+                     worker_child_setup, NULL, &worker->pid, &error))
+  {
+    g_printerr("Failed to start worker %u: %s\n", worker->index, error->message);
+    g_error_free(error);
+    /* Retried like a crash */
+    worker->restart_source_id = g_timeout_add(worker->restart_delay_ms, on_restart_timeout, worker);
+    worker->restart_delay_ms = MIN(worker->restart_delay_ms * 2, WORKER_MAX_RESTART_DELAY_MS);
+  }
+  else
+  {
+    worker->running = TRUE;
+    g_child_watch_add(worker->pid, on_worker_exit, worker);
+
+    worker_source_range(worker->index, supervisor->num_workers, supervisor->num_sources, &first, &count);
+    g_print("worker %u (pid %d): sources %u to %u\n", worker->index, worker->pid, first, first + count - 1);
+    for (guint s = first; s < first + count; s++)
+      pose_index_set_owner(supervisor->index, s, worker->index, worker->pid, worker->num_restarts);
+  }
+
+  g_free(index_str);
+  g_free(argv);
+}
+
+WorkerSupervisor *
+worker_supervisor_start(gchar **argv, guint num_workers, guint num_sources, PoseIndex *index, GMainLoop *loop)
+{
+  WorkerSupervisor *supervisor = g_new0(WorkerSupervisor, 1);
+
+  supervisor->argv = g_strdupv(argv);
+  supervisor->num_workers = num_workers;
+  supervisor->num_sources = num_sources;
+  supervisor->index = index;
+  supervisor->loop = loop;
+  supervisor->workers = g_new0(WorkerProcess, num_workers);
+
+  for (guint w = 0; w < num_workers; w++)
+  {
+    WorkerProcess &worker = supervisor->workers[w];
+    worker.supervisor = supervisor;
+    worker.index = w;
+    worker.restart_delay_ms = WORKER_RESTART_DELAY_MS;
+    spawn_worker(&worker);
+  }
+  return supervisor;
+}
+
+void
+worker_supervisor_stop(WorkerSupervisor *supervisor)
+{
+  supervisor->stopping = TRUE;
+  for (guint w = 0; w < supervisor->num_workers; w++)
+  {
+    WorkerProcess &worker = supervisor->workers[w];
+    if (worker.restart_source_id)
+    {
+      g_source_remove(worker.restart_source_id);
+      worker.restart_source_id = 0;
+    }
+    if (worker.running)
+      kill(worker.pid, SIGTERM);
+  }
+  if (all_workers_done(supervisor))
+    g_main_loop_quit(supervisor->loop);
+}
+
+void
+worker_supervisor_print_stats(WorkerSupervisor *supervisor)
+{
+  for (guint w = 0; w < supervisor->num_workers; w++)
+  {
+    WorkerProcess &worker = supervisor->workers[w];
+    g_print("worker %u: %u restart(s)%s\n", worker.index, worker.num_restarts,
+            worker.finished ? ", finished" : "");
+  }
+}
+
+void
+worker_supervisor_free(WorkerSupervisor *supervisor)
+{
+  if (!supervisor)
+    return;
+
+  g_strfreev(supervisor->argv);
+  g_free(supervisor->workers);
+  g_free(supervisor);
+}
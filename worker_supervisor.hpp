@@ -0,0 +1,67 @@
+#pragma once
+
+#include "pose_index.hpp"
+
+#include <glib.h>
+
+/*
+ * Supervisor mode: the sources are split into contiguous slices, and each
+ * slice is processed by a worker process running its own pipeline. The
+ * workers are the application itself, started with the command line of the
+ * supervisor plus --worker-index. They publish their results in a shared
+ * PoseIndex. A worker that crashes is restarted alone, after a delay that
+ * grows while it keeps crashing soon after its start.
+ */
+
+/* Delay before a crashed worker is restarted, doubled up to the maximum on repeated crashes */
+#define WORKER_RESTART_DELAY_MS 500
+#define WORKER_MAX_RESTART_DELAY_MS 30000
+
+/* A worker running longer than this before it crashed is restarted after the initial delay */
+#define WORKER_STABLE_US (60 * G_USEC_PER_SEC)
+
+struct WorkerSupervisor;
+
+struct WorkerProcess
+{
+  WorkerSupervisor *supervisor;
+  guint index;
+  GPid pid;
+  gboolean running;
+  gboolean finished;
+  guint num_restarts;
+  guint restart_delay_ms;
+  guint restart_source_id;
+  gint64 start_time;
+};
+
+struct WorkerSupervisor
+{
+  gchar **argv;
+  guint num_workers;
+  guint num_sources;
+  PoseIndex *index;
+  GMainLoop *loop;
+  gboolean stopping;
+  WorkerProcess *workers;
+};
+
+/* Sources [*first, *first + *count) of 'worker' when 'num_sources' are split over 'num_workers' */
+void worker_source_range(guint worker, guint num_workers, guint num_sources, guint *first, guint *count);
+
+/**
+ * Starts 'num_workers' workers with the command line 'argv' and supervises
+ * them from 'loop', which quits once every worker finished or was stopped.
+ * Workers exiting with status 0 reached the end of their inputs and are not
+ * restarted.
+ */
+WorkerSupervisor *worker_supervisor_start(gchar **argv, guint num_workers, guint num_sources,
+                                          PoseIndex *index, GMainLoop *loop);
+
+/* Sends SIGTERM to the running workers and cancels the pending restarts */
+void worker_supervisor_stop(WorkerSupervisor *supervisor);
+
+/* Prints the restarts of each worker */
+void worker_supervisor_print_stats(WorkerSupervisor *supervisor);
+
+void worker_supervisor_free(WorkerSupervisor *supervisor);